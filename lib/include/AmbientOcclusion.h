@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// Baked ambient occlusion on the corners of the voxel grid, one GL_R8 texel per lattice point
+// ((worldSize + 1)^3). A corner is shared by 8 voxels: a visible face has its 4 voxels behind
+// solid and the one in front empty, so of the solid voxels beyond the first 4 at most 3 are the
+// neighbours that occlude that face corner, the usual side + side + corner vertex AO level.
+//
+// Each face's corners are lattice points, so a linear filtered fetch at the hit position is the
+// bilinear blend of its 4 corner levels, one texture read per hit. An edit changes only the 8
+// corners of the voxel it touches.
+class AmbientOcclusion {
+public:
+    static constexpr int MAX_LEVEL = 3;
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Recomputes the corners of one voxel after an edit
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side
+    void CreateTexture();
+    void UploadCorners(int x, int y, int z);
+
+    double GetBuildMs() const { return mBuildMs; }
+
+    GLuint Texture = 0;
+
+private:
+    int LatticeSize() const { return mWorldSize + 1; }
+    size_t Index(int x, int y, int z) const { return x + y * (size_t)LatticeSize() + z * (size_t)LatticeSize() * LatticeSize(); }
+    uint8_t CornerLevel(const std::vector<uint8_t> &voxels, int x, int y, int z) const;
+
+    int mWorldSize = 0;
+    std::vector<uint8_t> mCorners; // Occlusion level * 255 / MAX_LEVEL per lattice point
+    double mBuildMs = 0.0;
+};
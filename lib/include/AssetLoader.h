@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stb_image.h>
+
+class StartupTimeline;
+
+// What to decode and how to prepare it for upload
+struct ImageRequest {
+    std::string path;
+    bool flipVertically = false;
+    int desiredChannels = 0;    // 0 keeps the channel count of the file
+    int mipLevels = 1;          // Levels to precompute, 1 = base level only
+    int tilesX = 1;             // Atlas layout, mips are filtered per tile so neighbours never bleed
+    int tilesY = 1;
+    int tilePadding = 0;        // Gutter texels around each tile, re-extruded on every level
+};
+
+// Image decoded on a worker thread. Only the GL upload has to happen on the main thread.
+struct DecodedImage {
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::unique_ptr<stbi_uc, void(*)(void*)> pixels{nullptr, stbi_image_free};
+
+    // Set when the image comes with a precomputed mip chain (texture cache), the levels point into storage
+    std::vector<const stbi_uc*> levels;
+    std::shared_ptr<void> storage;
+
+    bool Valid() const { return pixels || !levels.empty(); }
+    int LevelCount() const { return levels.empty() ? 1 : (int)levels.size(); }
+    int LevelWidth(int level) const { return std::max(1, width >> level); }
+    int LevelHeight(int level) const { return std::max(1, height >> level); }
+    const stbi_uc* Level(int level) const { return levels.empty() ? pixels.get() : levels[level]; }
+};
+
+// desiredChannels = 0 keeps the channel count of the file
+DecodedImage DecodeImage(const std::string &path, bool flipVertically, int desiredChannels);
+// Goes through the texture cache, so repeated launches skip the decode entirely
+std::future<DecodedImage> DecodeImageAsync(const ImageRequest &request, StartupTimeline* timeline = nullptr);
+std::future<DecodedImage> DecodeImageAsync(const std::string &path, bool flipVertically, int desiredChannels,
+                                           StartupTimeline* timeline = nullptr);
+
+// Collects what happened during startup, on which thread and when, so we can see
+// how much the worker threads overlapped with SDL/GL initialization.
+class StartupTimeline {
+public:
+    StartupTimeline();
+
+    double Now() const; // ms since the timeline was created
+    static double ThreadCpuNow(); // ms of CPU time used by the calling thread
+
+    // cpuMs <= 0 means the phase kept its thread busy for the whole wall clock duration
+    void Record(const std::string &phase, bool onWorker, double beginMs, double endMs, double cpuMs = -1.0);
+    void Print() const;
+
+private:
+    struct Phase {
+        std::string name;
+        bool onWorker;
+        bool isWait;
+        double beginMs;
+        double endMs;
+        double cpuMs;
+    };
+
+    std::chrono::steady_clock::time_point mOrigin;
+    mutable std::mutex mMutex;
+    std::vector<Phase> mPhases;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Two level voxel storage: a page table with one entry per 8^3 brick and an atlas that only
+// holds the bricks with mixed content. Empty and single material bricks (the inside of the
+// terrain) live in the page entry itself, so memory follows the surface area of the world.
+//
+// Page entries, CPU and GPU:  0                     empty brick
+//                             UNIFORM_BIT | value   every voxel is `value`
+// CPU:                        index + 1             mixed brick in mPool
+// GPU:                        slot + 1              mixed brick resident in the atlas
+// Mixed bricks that do not fit in the atlas are shown as UNIFORM_BIT | their dominant material
+// until Stream() makes them resident, evicting the atlas bricks furthest from the camera.
+//
+// This is an extra representation for the raycast to read, not a replacement: the terrain keeps
+// its dense CPU array and the renderer its dense GL_R8 volume, which the other storage modes and
+// the surface cache fill still sample.
+class BrickMap {
+public:
+    static const int BRICK_SIZE = 8;
+    static const int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+    static const int ATLAS_BRICKS_PER_AXIS = 16;  // 4096 resident bricks, 2MB of atlas
+    static const int STREAM_BRICKS_PER_FRAME = 32;
+    static constexpr uint32_t UNIFORM_BIT = 0x80000000u;
+
+    struct Stats {
+        size_t bricks = 0;
+        size_t emptyBricks = 0;
+        size_t uniformBricks = 0;
+        size_t mixedBricks = 0;
+        size_t residentBricks = 0;
+        uint64_t brickUploads = 0;
+        uint64_t evictions = 0;
+        size_t pageTableBytes = 0;
+        size_t atlasBytes = 0;
+        size_t denseBytes = 0;      // The dense GL_R8 volume of the same world, allocated next to the brick map
+    };
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    void SetVoxel(int x, int y, int z, uint8_t value);
+    uint8_t GetVoxel(int x, int y, int z) const;
+
+    // GL side
+    void CreateTextures();
+    void UploadVoxel(int x, int y, int z);
+    void Stream(const glm::vec3 &cameraPos);
+
+    Stats GetStats() const;
+
+    GLuint PageTable = 0;   // GL_R32UI, one texel per brick
+    GLuint Atlas = 0;       // GL_R8, ATLAS_BRICKS_PER_AXIS^3 bricks
+
+private:
+    struct MixedBrick {
+        std::array<uint8_t, BRICK_VOXELS> voxels;
+        uint32_t brick = NONE;  // Page index, NONE while the pool entry is free
+        int slot = -1;          // Atlas slot while resident
+    };
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    uint32_t BrickIndex(int bx, int by, int bz) const { return bx + by * mBricksPerAxis + bz * mBricksPerAxis * mBricksPerAxis; }
+    static int LocalIndex(int x, int y, int z) { return (x & 7) + (y & 7) * BRICK_SIZE + (z & 7) * BRICK_SIZE * BRICK_SIZE; }
+    glm::vec3 BrickCenter(uint32_t brick) const;
+    static uint8_t DominantMaterial(const MixedBrick &mixed);
+
+    uint32_t AllocateMixed(uint32_t brick, uint8_t fill);
+    void FreeMixed(uint32_t index);
+    uint32_t GpuPage(uint32_t brick) const;
+    void UploadPage(uint32_t brick);
+    bool MakeResident(uint32_t index, const glm::vec3 &cameraPos, bool force = false);
+    void Evict(int slot);
+
+    int mWorldSize = 0;
+    int mBricksPerAxis = 0;
+    std::vector<uint32_t> mPages;
+    std::vector<MixedBrick> mPool;
+    std::vector<uint32_t> mFreePool;
+    std::vector<uint32_t> mSlotOwner;   // Atlas slot -> pool index
+    std::vector<int> mFreeSlots;
+    size_t mNonResident = 0;
+    glm::vec3 mLastCamera = glm::vec3(0.0f);
+    Stats mStats;
+};
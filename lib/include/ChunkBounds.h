@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Tight bounding box of the solid voxels in every CHUNK_SIZE^3 chunk of the terrain.
+// The renderer rasterizes the non-empty ones as proxies to find where rays can start.
+class ChunkBounds {
+public:
+    static const int CHUNK_SIZE = 32;
+
+    struct Box {
+        glm::ivec3 min;     // Inclusive voxel bounds, min > max while the chunk is empty
+        glm::ivec3 max;
+        bool IsEmpty() const { return min.x > max.x; }
+    };
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Grows the box for a solid voxel, refits the chunk when a voxel on its box was cleared
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    const std::vector<Box>& GetBoxes() const { return mBoxes; }
+    size_t GetNonEmptyCount() const;
+
+private:
+    static Box EmptyBox() { return Box{ glm::ivec3(INT32_MAX), glm::ivec3(-1) }; }
+    size_t ChunkIndex(int cx, int cy, int cz) const { return cx + cy * mChunksPerAxis + cz * mChunksPerAxis * mChunksPerAxis; }
+    void Refit(const std::vector<uint8_t> &voxels, int cx, int cy, int cz);
+
+    int mWorldSize = 0;
+    int mChunksPerAxis = 0;
+    std::vector<Box> mBoxes;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Point lights binned per frame into a froxel grid: GRID_X * GRID_Y screen tiles, each cut into
+// GRID_Z slices spaced exponentially between the near and far plane. Pixels only evaluate the
+// lights of the froxel they fall in.
+//
+// Binning works in view space on 4 lights at a time (SSE2 where available). A sphere's tile range
+// on an axis is the number of tile planes it lies entirely beyond, so every light costs a fixed
+// number of plane and slice compares, no matter how many froxels it covers.
+//
+// The GPU gets one RGBA32UI buffer texture, counted in uints:
+//   [0, 2 * CLUSTER_COUNT)    first index and light count per froxel
+//   LIGHT_BASE + 8 * light    position, radius, color (float bits), one light per 2 texels
+//   after the lights          texel index of a light record, grouped by froxel
+class ClusteredLights {
+public:
+    static const int GRID_X = 16;
+    static const int GRID_Y = 9;
+    static const int GRID_Z = 24;
+    static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+    static const int LIGHT_BASE = 2 * CLUSTER_COUNT;
+
+    struct PointLight {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color; // Already scaled by the intensity
+    };
+
+    struct Stats {
+        size_t lights = 0;
+        size_t visibleLights = 0;
+        size_t indices = 0;
+        size_t droppedIndices = 0; // Did not fit GL_MAX_TEXTURE_BUFFER_SIZE
+        int maxPerCluster = 0;
+        double binMs = 0.0;
+    };
+
+    // CPU side, the projection has to be a symmetric perspective
+    void Bin(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection,
+             float nearPlane, float farPlane);
+
+    // GL side
+    void CreateBuffer();
+    void Upload();
+
+    // Slice of a view depth d is log(d) * x + y
+    glm::vec2 GetDepthSliceParams() const { return mDepthSliceParams; }
+    const Stats& GetStats() const { return mStats; }
+
+    GLuint Texture = 0;
+
+private:
+    // Cell range of one light, empty when culled
+    struct Range {
+        glm::ivec3 min;
+        glm::ivec3 max;
+        bool visible;
+    };
+
+    void SetupPlanes(const glm::mat4 &projection, float nearPlane, float farPlane);
+    void BinRanges(size_t first);
+
+    GLuint mBuffer = 0;
+    size_t mMaxUints = 0;
+
+    // Tile planes through the eye as (normal across the tile, normal z), slice start depths
+    float mPlaneX[GRID_X + 1][2];
+    float mPlaneY[GRID_Y + 1][2];
+    float mSliceDepth[GRID_Z + 1];
+    glm::vec2 mDepthSliceParams = glm::vec2(0.0f);
+
+    // View space lights as 4 wide arrays, padded with culled lights
+    std::vector<float> mViewX, mViewY, mViewZ, mRadius;
+    std::vector<Range> mRanges;
+    std::vector<uint32_t> mCounts;
+    std::vector<uint32_t> mData;
+    Stats mStats;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// Chebyshev distance from every voxel to the nearest solid voxel, clamped to MAX_DISTANCE.
+// A value of d means the cube of radius d-1 around the voxel is empty, so the raycaster
+// can jump to the edge of that cube in one step. Stored as GL_R8 next to the voxel texture.
+class DistanceField {
+public:
+    static const int MAX_DISTANCE = 16; // Also bounds how far an edit can propagate
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Re-propagates the cube of radius MAX_DISTANCE around an edited voxel
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side
+    void CreateTexture();
+    void UploadRegion(int x, int y, int z);
+
+    double GetBuildMs() const { return mBuildMs; }
+    double GetLastUpdateMs() const { return mLastUpdateMs; }
+
+    GLuint Texture = 0;
+
+private:
+    size_t Index(int x, int y, int z) const { return x + y * (size_t)mWorldSize + z * (size_t)mWorldSize * mWorldSize; }
+    void Propagate(const int min[3], const int max[3]);
+    void RegionAround(int x, int y, int z, int min[3], int max[3]) const;
+
+    int mWorldSize = 0;
+    std::vector<uint8_t> mDistances;
+    std::vector<uint8_t> mStaging; // Packed sub-box for uploads
+    double mBuildMs = 0.0;
+    double mLastUpdateMs = 0.0;
+};
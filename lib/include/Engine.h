@@ -10,6 +10,7 @@
 #include "skybox.h"
 #include "VoxelRenderer.hpp"
 #include "Player.h"
+#include "AssetLoader.h"
 
 class Engine{
     public:
@@ -46,6 +47,8 @@ class Engine{
         std::vector<float> frameTimes;
         const int maxSamples = 100;
 
+        StartupTimeline mStartup;
+
         void Input();
         void InitializeProgram();
 
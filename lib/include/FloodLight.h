@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Flood filled sky and block light in levels 0..MAX_LEVEL, one GL_RGBA4 texel per voxel:
+// red/green/blue block light from emissive materials and sky light in alpha. Light lives in the
+// empty voxels, faces read the voxel in front of them.
+//
+// Every step away from a source costs a level, except sky light at full strength going down,
+// which fills open columns like the sky above them. The initial fill runs per chunk on all cores,
+// edits remove the light that depended on the changed voxel and flood the gap back in from the
+// remaining light around it.
+class FloodLight {
+public:
+    static const int MAX_LEVEL = 15;
+    static const int CHUNK_SIZE = 32;
+
+    // Block light levels emitted by a material, zero for the ones that do not glow
+    static glm::ivec3 Emission(uint8_t material);
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Relights around a voxel after it was written
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side, uploads the box of voxels relit since the last call
+    void CreateTexture();
+    void UploadDirty();
+
+    double GetBuildMs() const { return mBuildMs; }
+    double GetLastUpdateMs() const { return mLastUpdateMs; }
+    size_t GetLastUpdateVoxels() const { return mLastUpdateVoxels; }
+    // Box of voxels relit since the last upload, false if there are none
+    bool GetDirtyBox(glm::ivec3 &dirtyMin, glm::ivec3 &dirtyMax) const
+    {
+        dirtyMin = mDirtyMin;
+        dirtyMax = mDirtyMax;
+        return mDirty;
+    }
+
+    GLuint Texture = 0;
+
+private:
+    // Nibble of each channel in a packed texel, matches GL_UNSIGNED_SHORT_4_4_4_4 with GL_RGBA
+    enum Channel { CHANNEL_SKY = 0, CHANNEL_BLUE = 4, CHANNEL_GREEN = 8, CHANNEL_RED = 12 };
+
+    // A light value arriving at a voxel from a neighbouring chunk
+    struct Incoming {
+        uint32_t index;
+        uint16_t light;
+    };
+
+    size_t Index(int x, int y, int z) const { return x + y * (size_t)mWorldSize + z * (size_t)mWorldSize * mWorldSize; }
+    glm::ivec3 Position(size_t index) const;
+    int ChunkOf(const glm::ivec3 &voxel) const;
+    static int Level(uint16_t light, int channel) { return (light >> channel) & 0xF; }
+    static uint16_t EmittedLight(uint8_t material);
+    static uint16_t Spread(uint16_t light, bool down);
+    static uint16_t Max(uint16_t a, uint16_t b);
+
+    void PropagateChunk(const std::vector<uint8_t> &voxels, int chunk, std::vector<uint32_t> &queue,
+                        std::vector<std::vector<Incoming>> &outgoing);
+    void Propagate(const std::vector<uint8_t> &voxels, std::vector<uint32_t> &queue);
+    void Remove(const std::vector<uint8_t> &voxels, size_t start, int channel, std::vector<uint32_t> &relight);
+    void Touch(size_t index);
+
+    int mWorldSize = 0;
+    int mChunksPerAxis = 0;
+    std::vector<uint16_t> mLight;
+    std::vector<uint16_t> mStaging; // Packed dirty box for uploads
+
+    bool mDirty = false;
+    glm::ivec3 mDirtyMin = glm::ivec3(0);
+    glm::ivec3 mDirtyMax = glm::ivec3(0);
+    size_t mTouched = 0;
+
+    double mBuildMs = 0.0;
+    double mLastUpdateMs = 0.0;
+    size_t mLastUpdateVoxels = 0;
+};
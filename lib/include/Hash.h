@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a, used to key the on-disk caches. Pass the previous result as seed to chain inputs.
+inline uint64_t Fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
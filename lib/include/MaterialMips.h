@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// Majority material mip chain over the voxel grid, the coarse levels of the raycaster's LOD.
+// Level l stores one texel per (2 << l)^3 voxels: empty unless at least half of its 8 children
+// are solid, otherwise the most common material among them. Ties go to solid, so flat surfaces
+// that cut a cell in half keep it.
+class MaterialMips {
+public:
+    static const int MAX_LEVELS = 3; // Coarsest cell is 8^3 voxels
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Recomputes the cells covering one voxel on every level after an edit
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side
+    void CreateTexture();
+    void UploadCell(int x, int y, int z);
+
+    int GetLevelCount() const { return (int)mLevels.size(); }
+
+    GLuint Texture = 0;
+
+private:
+    int LevelSize(int level) const { return mWorldSize >> (level + 1); }
+    size_t Index(int level, int x, int y, int z) const;
+    uint8_t MajorityMaterial(const std::vector<uint8_t> &voxels, int level, int x, int y, int z) const;
+
+    int mWorldSize = 0;
+    std::vector<std::vector<uint8_t>> mLevels;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+struct DecodedImage;
+
+// Per material properties the shaders need at a hit, derived once from the voxel sprite sheet:
+// whether a tile is opaque, its cutout mask, emission and specular strength. Rays test the table
+// instead of sampling the sheet, so opaque materials cost no texture fetch while marching and
+// cutouts one bit lookup. The tiles themselves move into a GL_TEXTURE_2D_ARRAY with one layer per
+// material and column (layer = material * columns + column), sampled only to shade the final hit.
+//
+// The table is a std140 uniform block bound to BINDING, same layout as MaterialTable in the shaders:
+//   vec4  properties[MATERIALS]          rgb emission, a specular strength
+//   uvec4 tileFlags[MATERIALS]           per column, TILE_OPAQUE and TILE_SHADOW_OPAQUE
+//   uvec4 cutoutRows[MATERIALS * COLUMNS * 2 * MASK_SIZE / 4]
+// Cutout rows come per material, column and test (primary rays, then shadow rays), one uint of
+// MASK_SIZE texel bits per row, bit x of row y set where the texel stops the ray.
+class MaterialTable {
+public:
+    static constexpr int MAX_COLUMNS = 4; // Faces with their own tile, the uvec4 of tileFlags
+    static const int MASK_SIZE = 32;      // Cutout mask resolution per tile, point sampled from the base level
+    static const GLuint BINDING = 0;
+    static constexpr float PRIMARY_ALPHA = 0.9f; // Camera rays pass texels below this alpha
+    static constexpr float SHADOW_ALPHA = 0.1f;  // Shadow rays pass texels below this alpha
+
+    enum TileFlag : uint32_t { TILE_OPAQUE = 1u, TILE_SHADOW_OPAQUE = 2u };
+
+    struct Material {
+        uint32_t tileFlags[MAX_COLUMNS] = {};
+        glm::vec3 emission = glm::vec3(0.0f);
+        float specular = 0.0f;
+    };
+
+    // CPU side, from the decoded sheet: one row per material from the bottom up, columns left to right
+    void Build(const DecodedImage &sheet, int columns, int materials);
+
+    // GL side, the tile array takes every precomputed level of the sheet
+    void CreateBuffer();
+    void CreateTileArray(const DecodedImage &sheet, int maxLevel);
+
+    int GetMaterialCount() const { return (int)mMaterials.size(); }
+    int GetColumnCount() const { return mColumns; }
+    const Material& GetMaterial(int material) const { return mMaterials[material]; }
+    size_t GetOpaqueTileCount() const;
+
+    GLuint UniformBuffer = 0;
+    GLuint TileArray = 0;
+
+private:
+    void BuildMask(const DecodedImage &sheet, int material, int column, float alpha, uint32_t *rows) const;
+
+    int mColumns = 0;
+    int mTileWidth = 0;
+    int mTileHeight = 0;
+    std::vector<Material> mMaterials;
+    std::vector<uint32_t> mCutoutRows;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// Solid/empty bitmask of the voxel grid, one GL_RG32UI texel per 4x4x4 block.
+// Bit (x & 3) + (y & 3) * 4 + (z & 1) * 16 of word (z >> 1) & 1 is set when the voxel is solid.
+// The raycaster walks on these bits and only fetches the material byte once it hits something.
+class OccupancyBits {
+public:
+    static const int BLOCK_SIZE = 4;
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side
+    void CreateTexture();
+    void UploadBlock(int x, int y, int z);
+
+    GLuint Texture = 0;
+
+private:
+    size_t Index(int x, int y, int z) const { return 2 * ((x >> 2) + (y >> 2) * (size_t)mBlocksPerAxis + (z >> 2) * (size_t)mBlocksPerAxis * mBlocksPerAxis); }
+    static uint32_t Bit(int x, int y, int z) { return 1u << ((x & 3) + (y & 3) * 4 + (z & 1) * 16); }
+
+    int mWorldSize = 0;
+    int mBlocksPerAxis = 0;
+    std::vector<uint32_t> mMasks; // Two words per block
+};
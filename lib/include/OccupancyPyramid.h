@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// Max-occupancy mip chain over the voxel grid, used by the raycaster to skip empty space.
+// Level l stores one texel per (2 << l)^3 voxels, 255 if any voxel inside is solid.
+// The voxel texture itself acts as the finest level, so the chain starts at 2^3 cells.
+class OccupancyPyramid {
+public:
+    static const int MAX_LEVELS = 5; // Coarsest cell is 32^3 voxels
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    // Recomputes the cells covering one voxel on every level after an edit
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+
+    // GL side
+    void CreateTexture();
+    void UploadCell(int x, int y, int z);
+
+    int GetLevelCount() const { return (int)mLevels.size(); }
+
+    GLuint Texture = 0;
+
+private:
+    int LevelSize(int level) const { return mWorldSize >> (level + 1); }
+    size_t Index(int level, int x, int y, int z) const;
+    bool IsCellOccupied(const std::vector<uint8_t> &voxels, int level, int x, int y, int z) const;
+
+    int mWorldSize = 0;
+    std::vector<std::vector<uint8_t>> mLevels;
+};
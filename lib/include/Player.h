@@ -17,6 +17,8 @@ class Player {
         bool checkHorizontalCollision(const glm::vec3& centerPos, float yOffset, VoxelTerrain *terrain);
         int getChosenBlock();
         void Input();
+        // Window resized, keeps the camera's aspect ratio in step
+        void SetScreenSize(int ScreenWidth, int ScreenHeight);
         
         // UI 
         bool mQuit = false; 
@@ -31,6 +33,7 @@ class Player {
         SDL_Window* mGraphicsApplicationWindow;
         const float PLAYER_HEIGHT = 0.65f;
         const float PLAYER_RADIUS = 0.25f;
+        const float PICK_DISTANCE = 512.0f;
 
         int mScreenWidth;
         int mScreenHeight;
@@ -8,16 +8,38 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "Hash.h"
+
+// #define NAME VALUE lines spliced in after #version. Ordered so the same set always gives the same source.
+using ShaderDefines = std::map<std::string, std::string>;
 
 class Shader
 {
 public:
-    unsigned int ID;
+    unsigned int ID; // Program of the active variant
+
+    // Linked programs are stored with glGetProgramBinary so the next launch can skip compiling
+    static inline std::string sBinaryCacheDirectory = "cache/shaders/";
+    bool mLoadedFromBinary = false;
+    double mLoadMs = 0.0;
 
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
            const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr)
+        : Shader(vertexPath, fragmentPath, ShaderDefines(), geometryPath, tessControlPath, tessEvalPath)
+    {
+    }
+
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines, const char* geometryPath = nullptr,
+           const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr)
     {
         // Save paths if you want reload() without parameters later
         m_VertexPath = vertexPath;
@@ -26,20 +48,53 @@ public:
         m_TessControlPath = tessControlPath;
         m_TessEvalPath = tessEvalPath;
 
-        
+        if (GLAD_GL_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        else if (GLAD_GL_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+        m_Defines = defines;
         loadShader(); // main loading logic
     }
 
     void reload()
     {
-        glDeleteProgram(ID); // delete old program
+        // Sources changed on disk, every cached variant is stale
+        for (auto &entry : m_Variants)
+        {
+            if (entry.second.program != 0)
+                glDeleteProgram(entry.second.program);
+        }
+        m_Variants.clear();
         loadShader();        // reload from saved paths
     }
 
+    // Switch to the variant compiled with this define set. New variants are compiled without
+    // waiting on the driver and ID keeps pointing at the previous variant until the new one is linked.
+    // Returns true when the requested variant is already active.
+    bool setDefines(const ShaderDefines &defines)
+    {
+        m_Defines = defines;
+        Variant &variant = m_Variants[definesKey(defines)];
+        if (variant.program == 0 && !variant.failed)
+            beginVariant(variant, defines);
+        pollVariants();
+        return isVariantReady();
+    }
+
+    const ShaderDefines &getDefines() const { return m_Defines; }
+    size_t getVariantCount() const { return m_Variants.size(); }
+    bool isVariantReady() const
+    {
+        auto it = m_Variants.find(definesKey(m_Defines));
+        return it != m_Variants.end() && it->second.linked && it->second.program == ID;
+    }
+
     // activate the shader
     // ------------------------------------------------------------------------
     void use()
     {
+        pollVariants();
         glUseProgram(ID);
     }
     // utility uniform functions
@@ -100,66 +155,92 @@ public:
     {
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
+    // GLSL 330 has no binding qualifier for uniform blocks, the program is told instead
+    void setUniformBlock(const std::string &name, GLuint binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
 
 private:
 
+    struct Variant {
+        GLuint program = 0;
+        std::vector<std::pair<GLuint, std::string>> stages; // Compiling shaders and their type, until linked
+        uint64_t key = 0;
+        bool pending = false;
+        bool linked = false;
+        bool failed = false;
+        std::chrono::steady_clock::time_point start;
+    };
+
     const char* m_VertexPath;
     const char* m_FragmentPath;
     const char* m_GeometryPath;
     const char* m_TessControlPath;
     const char* m_TessEvalPath;
 
-    void loadShader()
+    ShaderDefines m_Defines;
+    std::map<std::string, Variant> m_Variants;
+
+    // Raw stage sources, read once and shared by all variants
+    std::string m_VertexCode;
+    std::string m_FragmentCode;
+    std::string m_GeometryCode;
+    std::string m_TessControlCode;
+    std::string m_TessEvalCode;
+
+    static std::string definesKey(const ShaderDefines &defines)
     {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::string tessControlCode;
-        std::string tessEvalCode;
+        std::string key;
+        for (const auto &define : defines)
+            key += define.first + "=" + define.second + ";";
+        return key;
+    }
 
-        std::ifstream vShaderFile, fShaderFile, gShaderFile, tcShaderFile, teShaderFile;
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        tcShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        teShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    static std::string injectDefines(const std::string &code, const ShaderDefines &defines)
+    {
+        if (defines.empty() || code.empty())
+            return code;
 
+        size_t versionEnd = 0;
+        size_t version = code.find("#version");
+        if (version != std::string::npos)
+            versionEnd = code.find('\n', version) + 1;
+
+        // Count lines up to #version so #line keeps compiler errors pointing at the file on disk
+        int nextLine = 1;
+        for (size_t i = 0; i < versionEnd; i++)
+            nextLine += code[i] == '\n';
+
+        std::string injected = code.substr(0, versionEnd);
+        for (const auto &define : defines)
+            injected += "#define " + define.first + " " + define.second + "\n";
+        injected += "#line " + std::to_string(nextLine) + "\n";
+        injected += code.substr(versionEnd);
+        return injected;
+    }
+
+    static std::string readFile(const char* path)
+    {
+        std::ifstream file;
+        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        file.open(path);
+        std::stringstream stream;
+        stream << file.rdbuf();
+        return stream.str();
+    }
+
+    void loadShader()
+    {
         try
         {
-            vShaderFile.open(m_VertexPath);
-            fShaderFile.open(m_FragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            vShaderFile.close();
-            fShaderFile.close();
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-
-            if (m_GeometryPath != nullptr)
-            {
-                gShaderFile.open(m_GeometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-            if (m_TessControlPath != nullptr)
-            {
-                tcShaderFile.open(m_TessControlPath);
-                std::stringstream tcShaderStream;
-                tcShaderStream << tcShaderFile.rdbuf();
-                tcShaderFile.close();
-                tessControlCode = tcShaderStream.str();
-            }
-            if (m_TessEvalPath != nullptr)
-            {
-                teShaderFile.open(m_TessEvalPath);
-                std::stringstream teShaderStream;
-                teShaderStream << teShaderFile.rdbuf();
-                teShaderFile.close();
-                tessEvalCode = teShaderStream.str();
-            }
+            m_VertexCode = readFile(m_VertexPath);
+            m_FragmentCode = readFile(m_FragmentPath);
+            m_GeometryCode = m_GeometryPath != nullptr ? readFile(m_GeometryPath) : "";
+            m_TessControlCode = m_TessControlPath != nullptr ? readFile(m_TessControlPath) : "";
+            m_TessEvalCode = m_TessEvalPath != nullptr ? readFile(m_TessEvalPath) : "";
         }
         catch (std::ifstream::failure& e)
         {
@@ -168,70 +249,208 @@ private:
             return;
         }
 
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
+        // The first variant is needed right away, so wait for it
+        Variant &variant = m_Variants[definesKey(m_Defines)];
+        beginVariant(variant, m_Defines);
+        if (variant.pending)
+            finishVariant(variant);
+        if (variant.linked)
+            ID = variant.program;
+    }
 
-        unsigned int vertex, fragment;
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+    // Kick off compile + link. Status is not queried here, so drivers with threaded
+    // compilers (KHR_parallel_shader_compile) do the work in the background.
+    void beginVariant(Variant &variant, const ShaderDefines &defines)
+    {
+        variant.start = std::chrono::steady_clock::now();
 
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        std::string vertexCode = injectDefines(m_VertexCode, defines);
+        std::string fragmentCode = injectDefines(m_FragmentCode, defines);
+        std::string geometryCode = injectDefines(m_GeometryCode, defines);
+        std::string tessControlCode = injectDefines(m_TessControlCode, defines);
+        std::string tessEvalCode = injectDefines(m_TessEvalCode, defines);
 
-        unsigned int geometry, tessControl, tessEval;
+        // Key: every stage source (defines included) + the driver that produced the binary
+        uint64_t key = 14695981039346656037ull;
+        for (const std::string* code : { &vertexCode, &fragmentCode, &geometryCode, &tessControlCode, &tessEvalCode })
+            key = Fnv1a(code->data(), code->size(), key);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char* value = (const char*)glGetString(name);
+            if (value)
+                key = Fnv1a(value, strlen(value), key);
+        }
+        variant.key = key;
 
-        if (m_GeometryPath != nullptr)
+        double compileMs = 0.0;
+        if (loadProgramBinary(variant, compileMs))
         {
-            const char* gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            variant.linked = true;
+            mLoadedFromBinary = true;
+            mLoadMs = elapsedMs(variant);
+            std::cout << "[Shader] " << m_FragmentPath << ": program binary loaded in " << mLoadMs
+                      << " ms (source compile took " << compileMs << " ms)" << std::endl;
+            return;
         }
+
+        variant.program = glCreateProgram();
+        auto addStage = [&variant](GLenum type, const std::string &code, const char* name) {
+            const char* source = code.c_str();
+            GLuint shader = glCreateShader(type);
+            glShaderSource(shader, 1, &source, NULL);
+            glCompileShader(shader);
+            glAttachShader(variant.program, shader);
+            variant.stages.push_back({shader, name});
+        };
+
+        addStage(GL_VERTEX_SHADER, vertexCode, "VERTEX");
+        addStage(GL_FRAGMENT_SHADER, fragmentCode, "FRAGMENT");
+        if (m_GeometryPath != nullptr)
+            addStage(GL_GEOMETRY_SHADER, geometryCode, "GEOMETRY");
         if (m_TessControlPath != nullptr)
+            addStage(GL_TESS_CONTROL_SHADER, tessControlCode, "TESS_CONTROL");
+        if (m_TessEvalPath != nullptr)
+            addStage(GL_TESS_EVALUATION_SHADER, tessEvalCode, "TESS_EVALUATION");
+
+        glProgramParameteri(variant.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(variant.program);
+        variant.pending = true;
+    }
+
+    // Query results, report errors and cache the binary. Blocks if the driver is not done yet.
+    void finishVariant(Variant &variant)
+    {
+        for (auto &stage : variant.stages)
         {
-            const char* tcShaderCode = tessControlCode.c_str();
-            tessControl = glCreateShader(GL_TESS_CONTROL_SHADER);
-            glShaderSource(tessControl, 1, &tcShaderCode, NULL);
-            glCompileShader(tessControl);
-            checkCompileErrors(tessControl, "TESS_CONTROL");
+            checkCompileErrors(stage.first, stage.second);
+            glDeleteShader(stage.first);
         }
-        if (m_TessEvalPath != nullptr)
+        variant.stages.clear();
+        variant.pending = false;
+
+        variant.linked = checkCompileErrors(variant.program, "PROGRAM");
+        mLoadedFromBinary = false;
+        mLoadMs = elapsedMs(variant);
+        if (!variant.linked)
         {
-            const char* teShaderCode = tessEvalCode.c_str();
-            tessEval = glCreateShader(GL_TESS_EVALUATION_SHADER);
-            glShaderSource(tessEval, 1, &teShaderCode, NULL);
-            glCompileShader(tessEval);
-            checkCompileErrors(tessEval, "TESS_EVALUATION");
+            glDeleteProgram(variant.program);
+            variant.program = 0;
+            variant.failed = true;
+            return;
         }
 
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (m_GeometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        if (m_TessControlPath != nullptr)
-            glAttachShader(ID, tessControl);
-        if (m_TessEvalPath != nullptr)
-            glAttachShader(ID, tessEval);
+        saveProgramBinary(variant, mLoadMs);
+        std::cout << "[Shader] " << m_FragmentPath << ": compiled and linked in " << mLoadMs << " ms" << std::endl;
+    }
 
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+    void pollVariants()
+    {
+        bool parallel = GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+        for (auto &entry : m_Variants)
+        {
+            Variant &variant = entry.second;
+            if (!variant.pending)
+                continue;
 
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (m_GeometryPath != nullptr)
-            glDeleteShader(geometry);
-        if (m_TessControlPath != nullptr)
-            glDeleteShader(tessControl);
-        if (m_TessEvalPath != nullptr)
-            glDeleteShader(tessEval);
+            // Without the extension the link was at least issued a frame ago, finish it now
+            GLint done = GL_TRUE;
+            if (parallel)
+                glGetProgramiv(variant.program, GL_COMPLETION_STATUS_KHR, &done);
+            if (done)
+                finishVariant(variant);
+        }
+
+        auto requested = m_Variants.find(definesKey(m_Defines));
+        if (requested != m_Variants.end() && requested->second.linked)
+            ID = requested->second.program;
+    }
+
+    static double elapsedMs(const Variant &variant)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - variant.start).count();
     }
 
+    //################ Program binary cache #############
+    struct BinaryHeader {
+        char magic[4];
+        uint32_t format;
+        uint64_t key;
+        uint32_t length;
+        float compileMs;
+    };
+
+    std::string binaryPath(uint64_t key) const
+    {
+        std::string name = std::filesystem::path(m_FragmentPath).filename().string();
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+        return sBinaryCacheDirectory + name + "-" + hex + ".bin";
+    }
+
+    static bool programBinarySupported()
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    bool loadProgramBinary(Variant &variant, double &compileMs)
+    {
+        if (!programBinarySupported())
+            return false;
+
+        std::ifstream file(binaryPath(variant.key), std::ios::binary);
+        BinaryHeader header;
+        if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, "PBIN", 4) != 0 || header.key != variant.key)
+            return false;
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+            return false;
+
+        variant.program = glCreateProgram();
+        glProgramBinary(variant.program, header.format, binary.data(), (GLsizei)binary.size());
+
+        // Drivers reject binaries after updates or for other GPUs, fall back to compiling from source
+        GLint success = GL_FALSE;
+        glGetProgramiv(variant.program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            std::cout << "[Shader] " << m_FragmentPath << ": driver rejected the cached program binary, compiling from source" << std::endl;
+            glDeleteProgram(variant.program);
+            variant.program = 0;
+            return false;
+        }
+        compileMs = header.compileMs;
+        return true;
+    }
+
+    void saveProgramBinary(const Variant &variant, double compileMs)
+    {
+        if (!programBinarySupported())
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(variant.program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(variant.program, length, &length, &format, binary.data());
+
+        BinaryHeader header;
+        memcpy(header.magic, "PBIN", 4);
+        header.format = format;
+        header.key = variant.key;
+        header.length = (uint32_t)length;
+        header.compileMs = (float)compileMs;
+
+        std::error_code error;
+        std::filesystem::create_directories(sBinaryCacheDirectory, error);
+        std::ofstream file(binaryPath(variant.key), std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write(binary.data(), length);
+    }
 
     const char* GetShaderPath(std::string type)
     {
@@ -250,7 +469,7 @@ private:
 
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -272,6 +491,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
 #endif
\ No newline at end of file
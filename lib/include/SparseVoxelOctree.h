@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+struct Ray;
+struct VoxelHit;
+
+// Sparse voxel octree over the terrain, stored as a flat array of 32 bit node words and
+// mirrored into a GL_R32UI buffer texture for the raycaster. Node words use the same
+// encoding as the BrickMap pages:
+//   0                     empty node
+//   UNIFORM_BIT | value   every voxel below the node is `value`
+//   index                 interior node, its 8 children start at mNodes[index], x + 2y + 4z order
+// mNodes[0] holds the root. Blocks of 8 children are recycled through a free list after edits.
+class SparseVoxelOctree {
+public:
+    static constexpr uint32_t UNIFORM_BIT = 0x80000000u;
+    static const int EDIT_SUBTREE_SIZE = 8;  // Edits rebuild the subtree of this size around the voxel
+
+    struct Stats {
+        size_t nodes = 0;       // Words in use, including the free blocks
+        size_t freeBlocks = 0;
+        size_t bytes = 0;
+        size_t denseBytes = 0;  // What a dense GL_R8 volume of the same world would take
+        double buildMs = 0.0;
+        double lastUpdateMs = 0.0;
+    };
+
+    // CPU side, safe to call from the terrain worker
+    void Build(const std::vector<uint8_t> &voxels, int worldSize);
+    void Update(const std::vector<uint8_t> &voxels, int x, int y, int z);
+    uint8_t GetVoxel(int x, int y, int z) const;
+    // Walks the ray through the octree, skipping whole empty nodes. Same traversal as the shader.
+    VoxelHit Raycast(const Ray &ray, float maxDistance) const;
+
+    // GL side
+    void CreateTexture();
+    void UploadDirty();
+
+    int GetLevelCount() const { return mLevels; }
+    Stats GetStats() const;
+
+    GLuint Texture = 0;     // GL_TEXTURE_BUFFER view of mBuffer
+
+private:
+    static bool IsLeaf(uint32_t node) { return node == 0 || (node & UNIFORM_BIT); }
+    static int ChildIndex(int x, int y, int z, int childSize) { return ((x / childSize) & 1) + ((y / childSize) & 1) * 2 + ((z / childSize) & 1) * 4; }
+
+    uint32_t BuildNode(const std::vector<uint8_t> &voxels, int x, int y, int z, int size, std::vector<uint32_t> &blocks) const;
+    static bool IsCollapsible(const uint32_t children[8]);
+    static uint32_t Combine(const uint32_t children[8], std::vector<uint32_t> &blocks);
+    uint32_t Leaf(int x, int y, int z, int &leafSize) const;
+
+    uint32_t AllocateBlock();
+    void FreeSubtree(uint32_t node);
+    void MarkDirty(size_t begin, size_t end);
+
+    int mWorldSize = 0;
+    int mLevels = 0;
+    std::vector<uint32_t> mNodes;
+    std::vector<uint32_t> mFreeBlocks;
+    double mBuildMs = 0.0;
+    double mLastUpdateMs = 0.0;
+
+    GLuint mBuffer = 0;
+    size_t mBufferCapacity = 0; // In node words
+    size_t mDirtyBegin = 0;
+    size_t mDirtyEnd = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Baked sun visibility per voxel face, one GL_R8UI texel per voxel. Bit f (VoxelTerrain::faceNormal
+// order) is set when face f of a solid voxel is exposed, faces the sun and the ray from its center
+// towards the sun leaves the world without hitting a solid voxel. Shading reads one texel per hit
+// instead of marching a shadow ray per pixel.
+//
+// Edits only re-bake their shadow volume: the faces whose sun rays can cross the edited box, found
+// slice by slice along the dominant axis of the sun direction.
+//
+// A new sun direction is baked in by a sweep over bands of SWEEP_ROWS rows, as many per frame as
+// fit in SWEEP_BUDGET_MS, each uploaded as soon as it is done. Until the sweep is through, the
+// texture mixes the old and the new direction, which a sun moving a little per frame never shows.
+class SunVisibility {
+public:
+    static const int SWEEP_ROWS = 8;
+    static constexpr double SWEEP_BUDGET_MS = 2.0;
+
+    // CPU side, safe to call from the terrain worker. The slices are baked on every core.
+    void Build(const std::vector<uint8_t> &voxels, int worldSize, const glm::vec3 &toSun);
+    // Called by VoxelTerrain::setVoxel, only grows the box of pending edits
+    void MarkDirty(int x, int y, int z);
+
+    // Starts the sweep towards a new direction, or queues it after the running one
+    void SetDirection(const glm::vec3 &toSun);
+
+    // GL side, once per frame: re-bakes the shadow volume of the pending edits, then continues the
+    // sweep within its budget, uploading what changed
+    void Update(const std::vector<uint8_t> &voxels);
+    void CreateTexture();
+
+    double GetBuildMs() const { return mBuildMs; }
+    double GetLastUpdateMs() const { return mLastUpdateMs; }
+    size_t GetLastUpdateVoxels() const { return mLastUpdateVoxels; }
+    double GetLastSweepMs() const { return mLastSweepMs; }
+    // 1 once the bake matches the last direction set
+    float GetSweepProgress() const;
+
+    GLuint Texture = 0;
+
+private:
+    // Inclusive voxel box, one slice thick along the sweep axis when it comes from ShadowVolume
+    struct Region {
+        glm::ivec3 min;
+        glm::ivec3 max;
+    };
+
+    size_t Index(int x, int y, int z) const { return x + y * (size_t)mWorldSize + z * (size_t)mWorldSize * mWorldSize; }
+    bool IsLit(const std::vector<uint8_t> &voxels, const glm::vec3 &start, glm::ivec3 voxel) const;
+    uint8_t FaceMask(const std::vector<uint8_t> &voxels, int x, int y, int z) const;
+    void Bake(const std::vector<uint8_t> &voxels, const std::vector<Region> &regions);
+    void UploadRegion(const Region &region);
+    void Sweep(const std::vector<uint8_t> &voxels);
+    std::vector<Region> ShadowVolume(const glm::ivec3 &editMin, const glm::ivec3 &editMax) const;
+
+    int mWorldSize = 0;
+    glm::vec3 mToSun = glm::vec3(0.0f, 1.0f, 0.0f);       // What the masks are baked with, edits included
+    glm::vec3 mTargetToSun = glm::vec3(0.0f, 1.0f, 0.0f); // Picked up by the next sweep
+    bool mSweeping = false;
+    int mSweepBand = 0;
+    std::vector<uint8_t> mMasks;
+    std::vector<uint8_t> mStaging; // Packed region for uploads
+
+    bool mDirty = false;
+    glm::ivec3 mDirtyMin = glm::ivec3(0);
+    glm::ivec3 mDirtyMax = glm::ivec3(0);
+
+    double mBuildMs = 0.0;
+    double mLastUpdateMs = 0.0;
+    size_t mLastUpdateVoxels = 0;
+    double mLastSweepMs = 0.0;
+};
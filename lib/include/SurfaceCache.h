@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Lighting cache in face space. Every exposed face of the chunks around the camera owns a
+// TEXELS_PER_FACE^2 block in an RGBA16F atlas: multiplier for the surface color in alpha (sun,
+// sky and AO) and added block light in rgb. The renderer fills new blocks and refreshes the
+// resident ones a budget per frame, blending jittered samples into what is already there.
+// Hits look their face up and read one filtered texel instead of shading from scratch.
+//
+// The shaders find a face's block through an open addressing hash table in a buffer texture,
+// GL_RG32UI entries (key + 1, slot) with key = voxel index * 6 + face. PENDING_BIT on the slot
+// marks a face that waits for its first fill after being added or invalidated, the shaders shade
+// those directly.
+class SurfaceCache {
+public:
+    static const int TEXELS_PER_FACE = 4;
+    static const int ATLAS_SIZE = 2048;
+    static const int SLOTS_PER_ROW = ATLAS_SIZE / TEXELS_PER_FACE;
+    static const int MAX_SLOTS = SLOTS_PER_ROW * SLOTS_PER_ROW;
+    static const int TABLE_BITS = 19;
+    static const int TABLE_SIZE = 1 << TABLE_BITS;
+    static const int MAX_PROBES = 16;
+    static const int CHUNK_SIZE = 32;
+    static const int RESIDENT_RADIUS = 96;     // Chunks closer than this to the camera are cached
+    static const int CHUNKS_PER_FRAME = 8;     // Newly cached chunks per frame, nearest first
+    static const int FILL_BUDGET = 8192;       // Blocks written per frame, new ones before refreshes
+    static constexpr uint32_t PENDING_BIT = 0x80000000u;
+
+    // One block to light, key as in the table
+    struct Fill {
+        uint32_t key;
+        uint32_t slot;
+    };
+
+    struct Stats {
+        size_t residentChunks = 0;
+        size_t residentFaces = 0;
+        size_t pendingFaces = 0;
+        size_t freshFills = 0;     // This frame
+        size_t refreshFills = 0;
+        size_t rejectedFaces = 0;  // Since startup: no slot or probe sequence too long, shaded directly
+        double lastUpdateMs = 0.0;
+    };
+
+    void Init(int worldSize);
+    bool IsInitialized() const { return mWorldSize != 0; }
+    // Called by VoxelTerrain::setVoxel, only grows the box of pending edits
+    void MarkDirty(int x, int y, int z);
+    // Relights the faces in front of a box of voxels whose light changed
+    void Invalidate(const glm::ivec3 &boxMin, const glm::ivec3 &boxMax);
+    void InvalidateAll();
+
+    // CPU side, once per frame: chunk residency around the camera, pending edits and this
+    // frame's fills. toSun only matters for which faces an edit can shadow.
+    void Update(const std::vector<uint8_t> &voxels, const glm::vec3 &cameraPos, const glm::vec3 &toSun);
+    const std::vector<Fill>& GetFreshFills() const { return mFreshFills; }
+    const std::vector<Fill>& GetRefreshFills() const { return mRefreshFills; }
+
+    // GL side
+    void CreateTextures();
+    void UploadTable();
+
+    const Stats& GetStats() const { return mStats; }
+
+    GLuint AtlasTexture = 0;
+    GLuint TableTexture = 0;
+
+private:
+    struct Chunk {
+        bool resident = false;
+        std::vector<uint32_t> keys; // Faces that got a table entry
+    };
+
+    static uint32_t Hash(uint32_t key) { return (key * 2654435761u) >> (32 - TABLE_BITS); }
+    size_t ChunkIndex(int cx, int cy, int cz) const { return cx + cy * mChunksPerAxis + (size_t)cz * mChunksPerAxis * mChunksPerAxis; }
+    glm::ivec3 KeyVoxel(uint32_t key) const;
+
+    void ScanFaces(const std::vector<uint8_t> &voxels, int chunk, std::vector<uint32_t> &keys) const;
+    void MakeResident(const std::vector<uint8_t> &voxels, int chunk);
+    void Evict(int chunk);
+    void Rescan(const std::vector<uint8_t> &voxels, int chunk);
+
+    bool Insert(uint32_t key);
+    void Remove(uint32_t key);
+    size_t Find(uint32_t key) const; // TABLE_SIZE when missing
+    void SetEntry(size_t entry, uint32_t keyPlusOne, uint32_t value);
+    void QueueFill(uint32_t slot);
+
+    int mWorldSize = 0;
+    int mChunksPerAxis = 0;
+    std::vector<Chunk> mChunks;
+
+    std::vector<uint32_t> mTable;      // 2 uints per entry
+    size_t mDirtyBegin = 0, mDirtyEnd = 0;
+
+    static constexpr uint32_t FREE_SLOT = 0xFFFFFFFFu;
+    std::vector<uint32_t> mSlotKey;    // Key per slot, FREE_SLOT when unused
+    std::vector<uint8_t> mSlotPending;
+    std::vector<uint32_t> mFreeSlots;
+    uint32_t mSlotHighWater = 0;
+    uint32_t mRefreshCursor = 0;
+    std::deque<uint32_t> mPending;     // Slots waiting for their first fill, oldest first
+
+    bool mEdited = false;
+    glm::ivec3 mEditMin = glm::ivec3(0);
+    glm::ivec3 mEditMax = glm::ivec3(0);
+
+    std::vector<Fill> mFreshFills;
+    std::vector<Fill> mRefreshFills;
+    GLuint mTableBuffer = 0;
+    Stats mStats;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "AssetLoader.h"
+
+// Disk cache of decoded texels with their mip chain already built.
+// One blob per source image, keyed by a hash of the source file contents and the
+// request parameters, so editing a PNG/JPEG (or changing how it is loaded) rebuilds it.
+// Blobs are memory mapped and handed straight to the upload ring.
+class TextureCache {
+public:
+    struct Stats {
+        int hits = 0;
+        int misses = 0;
+        double hitLoadMs = 0.0;          // Hashing + mapping on hits
+        double decodeMsEliminated = 0.0; // Decode + mip time the hits would have cost, recorded at build time
+        double missBuildMs = 0.0;        // Decode + mip + write on misses
+    };
+
+    static DecodedImage Load(const ImageRequest &request, bool* fromCache = nullptr);
+
+    static Stats GetStats();
+    static void PrintStats();
+
+    static std::string sDirectory;
+};
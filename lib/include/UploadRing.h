@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <glad/glad.h>
+
+// One GL_PIXEL_UNPACK_BUFFER ring that every texture upload goes through.
+// With ARB_buffer_storage the ring is persistently mapped and regions are guarded by
+// fences, otherwise the buffer is orphaned whenever the write head wraps around.
+// Callers bind the destination texture, the ring only replaces the client memory pointer.
+class UploadRing {
+public:
+    struct Stats {
+        uint64_t bytesStreamed = 0;
+        uint64_t uploads       = 0;
+        uint64_t stalls        = 0; // Fences that were not signaled when we needed the region
+        double   stallWaitMs   = 0.0;
+        uint64_t orphans       = 0; // Only used when persistent mapping is unavailable
+    };
+
+    static UploadRing& Get();
+
+    void TexImage2D(GLenum target, GLint level, GLint internalFormat, int width, int height,
+                    GLenum format, const void* data, GLenum type = GL_UNSIGNED_BYTE);
+    void TexSubImage2D(GLenum target, GLint level, int x, int y, int width, int height,
+                       GLenum format, const void* data, GLenum type = GL_UNSIGNED_BYTE);
+    void TexImage3D(GLenum target, GLint level, GLint internalFormat, int width, int height, int depth,
+                    GLenum format, const void* data, GLenum type = GL_UNSIGNED_BYTE);
+    void TexSubImage3D(GLenum target, GLint level, int x, int y, int z, int width, int height, int depth,
+                       GLenum format, const void* data, GLenum type = GL_UNSIGNED_BYTE);
+
+    const Stats& GetStats() const { return mStats; }
+    bool IsPersistent() const { return mPersistent; }
+    size_t GetCapacity() const { return mCapacity; }
+
+private:
+    UploadRing(size_t capacity);
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    struct Region {
+        size_t begin;
+        size_t end;
+        GLsync fence;
+    };
+
+    size_t Allocate(size_t size);
+    void WaitForRange(size_t begin, size_t end);
+    void RetireSignaled();
+    void Write(size_t offset, const void* data, size_t size);
+    void Fence(size_t begin, size_t end);
+
+    static size_t BytesPerPixel(GLenum format, GLenum type);
+
+    GLuint mBuffer = 0;
+    size_t mCapacity;
+    size_t mHead = 0;
+    bool mPersistent = false;
+    uint8_t* mMapped = nullptr;
+    std::deque<Region> mRegions;
+    Stats mStats;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Greedy meshes the terrain chunk by chunk for the rasterizing backend. Chunks are copied out
+// with a one voxel border and meshed on worker threads, the main thread only uploads finished
+// meshes, so edits never wait on the mesher and the previous mesh stays on screen meanwhile.
+//
+// Vertices are one packed 32 bit word, positions relative to the chunk origin:
+//   bits  0-17  x, y, z (6 bits each, 0..CHUNK_SIZE)
+//   bits 18-20  face, VoxelTerrain::faceNormal order
+//   bits 24-31  material
+class VoxelMesher {
+public:
+    static const int CHUNK_SIZE = 32;
+
+    struct Stats {
+        size_t chunks = 0;
+        size_t meshedChunks = 0;    // Chunks with an uploaded mesh
+        size_t quads = 0;
+        size_t vertexBytes = 0;
+        uint64_t remeshes = 0;
+        double lastJobMs = 0.0;     // Wall time of the last batch on the workers
+    };
+
+    // Marks every chunk dirty, the meshes are built by the following Update calls
+    void Init(int worldSize);
+    // CPU side, called by VoxelTerrain::setVoxel. Also dirties neighbours sharing a face with the voxel.
+    void MarkDirty(int x, int y, int z);
+
+    // GL side, once per frame: uploads the finished batch and starts the next one
+    void Update(const std::vector<uint8_t> &voxels);
+    // Draws the meshes of the chunks flagged in `visible`, the shader needs a chunkOrigin uniform
+    void Draw(GLint chunkOriginLocation, const std::vector<bool> &visible) const;
+
+    bool IsIdle() const { return !mJob.valid() && mDirtyCount == 0; }
+    bool IsInitialized() const { return mWorldSize != 0; }
+    int GetChunksPerAxis() const { return mChunksPerAxis; }
+    Stats GetStats() const;
+
+private:
+    static const int PADDED_SIZE = CHUNK_SIZE + 2;
+
+    struct ChunkJob {
+        int chunk;
+        std::vector<uint8_t> voxels;    // PADDED_SIZE^3, one voxel of the neighbours on every side
+        std::vector<uint32_t> vertices;
+    };
+    struct ChunkMesh {
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        GLsizei vertexCount = 0;
+    };
+
+    static void MeshChunk(ChunkJob &job);
+    static std::vector<ChunkJob> MeshBatch(std::vector<ChunkJob> jobs);
+    glm::ivec3 ChunkOrigin(int chunk) const;
+    void Upload(const ChunkJob &job);
+
+    int mWorldSize = 0;
+    int mChunksPerAxis = 0;
+    std::vector<bool> mDirty;
+    size_t mDirtyCount = 0;
+    std::vector<ChunkMesh> mMeshes;
+    std::future<std::vector<ChunkJob>> mJob;
+    std::chrono::steady_clock::time_point mJobStart;
+    double mLastJobMs = 0.0;
+    uint64_t mRemeshes = 0;
+};
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <future>
 #include <glm/glm.hpp>
 #include <glad/glad.h>
 #include "Camera.hpp"
@@ -9,26 +10,159 @@
 #include "VoxelTerrain.h"
 #include "BillboardSprite.h"
 #include "skybox.h"
+#include "AssetLoader.h"
+#include "MaterialTable.h"
 
 
 
 
 class VoxelRenderer {
 public:
+    // Everything the renderer reads from disk, decoded on worker threads while the engine starts up
+    struct Assets {
+        std::future<DecodedImage> floorTexture;
+        std::future<DecodedImage> wallTexture;
+        std::future<DecodedImage> billboardSpriteSheet;
+        std::future<DecodedImage> voxelSpriteSheet;
+        std::vector<std::future<DecodedImage>> skyboxFaces;
+
+        void Wait();
+    };
+    static Assets DecodeAssets(StartupTimeline* timeline = nullptr);
+
+    enum EmptySpaceSkipping { SKIP_NONE = 0, SKIP_OCCUPANCY_PYRAMID = 1, SKIP_DISTANCE_FIELD = 2 };
+    enum VoxelStorage { STORAGE_DENSE = 0, STORAGE_BRICKMAP = 1, STORAGE_OCTREE = 2 };
+    enum RenderBackend { BACKEND_RAYCAST = 0, BACKEND_MESH = 1 };
+
+    // Compile time knobs of the raycast shader, every combination is its own program variant
+    struct RaycastQuality {
+        int maxSteps = 256;
+        int maxLightSteps = 8;
+        int maxRaytraceRange = 64;
+        bool cameraPointLight = true;
+        bool raytracedShadows = true;
+        bool bakedSunVisibility = true; // Shadows from the per face bake instead of a shadow ray per pixel
+        bool floodLight = true;         // Sky and block light from the flood fill, dark caves and glowing materials
+        bool ambientOcclusion = true;   // Baked corner occlusion, one filtered fetch per hit
+        bool clusteredLights = true;    // Point lights of emissive voxels and sprites, binned into froxels every frame
+        bool surfaceCache = true;       // Sun, sky, block light and AO read per face from a cache relit over the frames
+        bool visibilityBuffer = true;   // Rays only write hit records, a second full screen pass shades them
+        bool checkerboard = false;      // Trace half the pixels per frame, the rest come from last frame and their neighbours
+        int emptySpaceSkipping = SKIP_OCCUPANCY_PYRAMID;
+        bool occupancyBits = false;     // March on the packed solid bits, fetch materials only at hits
+        int voxelStorage = STORAGE_DENSE; // Where the shader reads voxels from, the brick map and octree skip their own empty space
+        bool coarsePrepass = true;      // Start rays at a distance found by a low resolution cone march
+        bool temporalReprojection = true; // Start rays at last frame's surfaces where they still show empty space
+        bool chunkProxies = true;       // Rasterize chunk bounds, rays start at their entry and uncovered pixels skip the march
+        int lodDistance = 0;            // Rays switch to 2^3 majority cells here and double the cell size every time the distance doubles, 0 = off
+        bool stepHeatmap = false;       // Debug view, also measures the average ray steps per pixel
+    };
+
     // VoxelRenderer(int width, int height);
     VoxelRenderer(int width, int height, VoxelTerrain *terrain);
+    VoxelRenderer(int width, int height, VoxelTerrain *terrain, Assets assets);
     void Init();
     void RenderVoxels(const Camera& camera);
 
     bool isVoxel(glm::vec3 pos);
     // void loadTexture(const std::string &path, GLuint &textureRef);
     void loadTexture(const std::string &path, GLuint &textureRef, bool flipVertically, bool isRGBA=false, bool useMipMap=true);
+    void loadTexture(const DecodedImage &image, GLuint &textureRef, bool isRGBA=false, bool useMipMap=true);
     void RenderSkyBox(const glm::mat4& projection, const glm::mat4& view);
- 
+
+    // Variants compile in the background, the previous one keeps rendering until the new one is linked
+    void SetRaycastQuality(const RaycastQuality &quality);
+    const RaycastQuality& GetRaycastQuality() const { return mQuality; }
+    bool IsRaycastVariantReady() const { return mShader->isVariantReady(); }
+    size_t GetRaycastVariantCount() const { return mShader->getVariantCount(); }
+    float GetAverageSteps() const { return mAverageSteps; }
+
+    // Window size, the render targets follow it scaled by the render scale
+    void SetScreenSize(int width, int height);
+
+    // Scales the render targets each frame so the GPU time of a frame stays within targetMs, the
+    // image is upscaled to the window when presented. Off renders at the window size.
+    struct DynamicResolution {
+        bool enabled = false;
+        float targetMs = 16.6f;
+        float minScale = 0.5f;  // Per axis, of the window size
+        float maxScale = 1.0f;
+    };
+    void SetDynamicResolution(const DynamicResolution& settings);
+    const DynamicResolution& GetDynamicResolution() const { return mDynamicResolution; }
+    float GetRenderScale() const { return mRenderScale; }
+    int GetRenderWidth() const { return mRenderWidth; }
+    int GetRenderHeight() const { return mRenderHeight; }
+    // GPU time of RenderVoxels, smoothed over the frames and a few frames behind
+    float GetGpuFrameMs() const { return mGpuFrameMs; }
+
+    // Raycasting or rasterizing greedy meshes, billboards and the skybox are shared
+    void SetBackend(int backend) { mBackend = backend; }
+    int GetBackend() const { return mBackend; }
+
+    // Average frame times of both backends over the same scripted orbit around the world
+    struct BackendTimings {
+        double raycastMs = 0.0;
+        double meshMs = 0.0;
+    };
+    // Blocks until the meshes are built, then renders `frames` frames per backend with the camera's projection
+    BackendTimings CompareBackends(const Camera& camera, int frames = 120);
+    size_t GetDrawnProxyCount() const { return mProxyInstances.size() / 2; }
+
+    // Per light count: average CPU binning time and frame time with that many random lights added
+    struct LightTimings {
+        size_t lights = 0;
+        double binMs = 0.0;
+        double frameMs = 0.0;
+        size_t indices = 0;
+    };
+    // Renders `frames` frames from the camera with 10, 1k and 10k extra lights over the terrain
+    std::vector<LightTimings> BenchmarkLights(const Camera& camera, int frames = 60);
+    const ClusteredLights::Stats& GetLightStats() const { return mLights.GetStats(); }
+
+    // Frame times while the sun goes once around the sky, one step per frame
+    struct DayCycleTimings {
+        int frames = 0;
+        double averageMs = 0.0;
+        double worstMs = 0.0;
+        double worstSweepMs = 0.0; // Sun visibility re-bake within a frame
+    };
+    // Renders `frames` frames from the camera over a full 24 hours, then puts the sun back
+    DayCycleTimings BenchmarkDayCycle(const Camera& camera, int frames = 600);
+
+    // Frame times with every pixel traced and with the checkerboard, and how close the checkerboard
+    // frames come to the full ones
+    struct CheckerboardTimings {
+        double fullMs = 0.0;
+        double checkerboardMs = 0.0;
+        double psnr = 0.0;        // dB over the compared frames, higher is closer
+        double maxError = 0.0;    // Largest channel difference of a pixel, 0..255
+    };
+    // Renders the same orbit as CompareBackends in both modes and compares every 8th frame
+    CheckerboardTimings CompareCheckerboard(const Camera& camera, int frames = 120);
+    // False when the driver has too few texture units for the cache next to everything else the raycast binds
+    bool IsSurfaceCacheSupported() const { return mSurfaceCacheSupported; }
+    // Off for the step heatmap, which needs the step count of the traversal, and for worlds too large for the records
+    bool IsVisibilityBufferActive() const;
+    // Hit records of the last raycast frame for post effects, only written while the visibility buffer is active
+    GLuint GetHitRecordTexture() const { return mHitRecordTexture; }
+    // Opacity, cutouts, emission and specular per material, built from the voxel sprite sheet
+    const MaterialTable& GetMaterials() const { return mMaterials; }
 
 
 private:
     int mScreenWidth, mScreenHeight;
+    int mRenderWidth, mRenderHeight; // Of every offscreen target, the screen size times mRenderScale
+
+    // Timer queries around RenderVoxels, read back FRAME_QUERIES frames later so they never stall
+    static const int FRAME_QUERIES = 4;
+    DynamicResolution mDynamicResolution;
+    float mRenderScale = 1.0f;
+    float mGpuFrameMs = 0.0f;
+    GLuint mFrameQueries[FRAME_QUERIES] = {};
+    int mFrameQueryIndex = 0;
+    int mFrameQueriesIssued = 0;
+    int mFramesSinceRescale = 0;
     
     VoxelTerrain *mTerrain;
     std::vector<uint8_t> mFrameBuffer;
@@ -38,12 +172,10 @@ private:
     GLuint voxelSurfaceTexture_wall;
     GLuint voxelSurfaceTexture_floor;
     GLuint billboardSpriteTexture;
-    GLuint voxelSpriteSheet;
+    MaterialTable mMaterials; // Also owns the voxel tiles, one array layer per material and face column
 
     glm::vec2 uvVoxelOffset; // Bottom-left of tile in normalized UV
     glm::vec2 uvVoxelScale;  // Tile size in normalized UV
-    float VoxelScaleX;
-    float VoxelScaleY;
     
     std::vector<BillboardSprite> mSprites;
 
@@ -51,17 +183,99 @@ private:
     Shader* mShader = nullptr;
     Shader* mBillboardShader = nullptr;
     Shader* mSkyboxShader = nullptr;
+    Shader* mPrepassShader = nullptr;
+    Shader* mProxyShader = nullptr;
+    Shader* mMeshShader = nullptr;
+    Shader* mSurfaceCacheShader = nullptr;
+    Shader* mShadeShader = nullptr;
+    int mBackend = BACKEND_RAYCAST;
+    std::vector<bool> mChunkVisible;
+    ClusteredLights mLights;
+    std::vector<ClusteredLights::PointLight> mLightList;       // Rebuilt every frame
+    std::vector<ClusteredLights::PointLight> mBenchmarkLights; // Extra lights while BenchmarkLights runs
+    RaycastQuality mQuality;
+
+    // Surface cache fills, one instanced quad per atlas block drawn into the atlas
+    bool mSurfaceCacheSupported = false;
+    unsigned int mSurfaceCacheFBO = 0;
+    unsigned int mSurfaceCacheVAO = 0;
+    unsigned int mSurfaceCacheVBO = 0;
+    int mSurfaceCacheFrame = 0;
+    float mAverageSteps = 0.0f;
     unsigned int mQuadVAO = 0;
     unsigned int mQuadVBO = 0;
     
     unsigned int mFBO = 0;
     unsigned int mColorTexture = 0;
     unsigned int mDepthTexture = 0;
-    float tilesPerCol;
-    float tilesPerRow;
-    float sheetPadding;
+
+    // Visibility buffer: the raycast writes a GL_RG32UI hit record per pixel into mVisibilityFBO,
+    // which shares the depth texture of mFBO so billboards still sort against the voxels.
+    //   x: voxel (9 bits per axis) | face index << 27 | LOD cell hit << 30 | hit << 31, 1 outside the world box
+    //   y: float bits of the distance along the ray
+    // The shade pass rebuilds the ray of each pixel and shades into mFBO.
+    enum RaycastPass { PASS_FORWARD = 0, PASS_VISIBILITY = 1, PASS_SHADE = 2 };
+    bool mVisibilityBufferSupported = false;
+    int mRaycastPass = PASS_FORWARD; // Of the program mShader runs, lags behind the quality while a variant compiles
+    unsigned int mVisibilityFBO = 0;
+    unsigned int mHitRecordTexture = 0;
+
+    // Checkerboard: every row traces either its even or its odd pixels, alternating per frame, into
+    // half width targets of their own. ResolveCheckerboard rebuilds the full image in mFBO from them
+    // and the last resolved frame. The ray start history and hit records are sized like the trace.
+    bool mTraceCheckerboard = false; // Of the program mShader runs, lags behind the quality like mRaycastPass
+    int mCheckerParity = 0;
+    int mTraceWidth = 0, mTraceHeight = 0;
+    unsigned int mTraceFBO = 0;      // mFBO, or mCheckerFBO with the checkerboard
+    unsigned int mCheckerFBO = 0;
+    unsigned int mCheckerColorTexture = 0;
+    unsigned int mCheckerDepthTexture = 0;
+    unsigned int mResolvedTextures[2] = { 0, 0 }; // Full resolution color and camera distance of the last two resolves
+    int mResolvedIndex = 0;
+    bool mResolvedValid = false;
+    Shader* mResolveShader = nullptr;
+
+    unsigned int mPrepassFBO = 0;
+    unsigned int mPrepassTexture = 0;
+    int mPrepassWidth = 0, mPrepassHeight = 0;
+
+    // Distance to the first solid voxel per pixel, written as the second raycast target.
+    // Two of them so last frame's can be read while this frame's is written.
+    unsigned int mHistoryTextures[2] = { 0, 0 };
+    int mHistoryIndex = 0;
+    bool mHistoryValid = false;
+    glm::mat4 mPrevProjection = glm::mat4(1.0f);
+    glm::mat4 mPrevViewProjection = glm::mat4(1.0f);
+    glm::vec3 mPrevCameraPos = glm::vec3(0.0f);
+
+    // Chunk proxies: a unit cube instanced over the frustum culled chunk bounds
+    unsigned int mProxyVAO = 0;
+    unsigned int mProxyVBO = 0;
+    unsigned int mProxyInstanceVBO = 0;
+    unsigned int mProxyFBO = 0;
+    unsigned int mProxyTexture = 0;
+    std::vector<glm::vec3> mProxyInstances; // Box min and max per drawn chunk
     // unsigned int voxelTilesPerRow;
     std::vector<GLubyte> voxels;
 
     void InitFullscreenQuad();
+    void InitChunkProxies();
+    void RenderChunkProxies(const glm::mat4& viewProjection, const Camera& camera);
+    void RaycastVoxels(const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    void RenderMeshes(const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    ShaderDefines RaycastDefines() const;
+    ShaderDefines RaycastPassDefines(int pass) const;
+    void SetRaycastUniforms(Shader* shader, const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    void InitVisibilityBuffer();
+    void InitTraceTargets(bool checkerboard);
+    void ResolveCheckerboard(const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    void ShadeHitRecords(const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    void RenderPrepass(const glm::mat4& invProj, const glm::mat4& invView, const Camera& camera);
+    void BindHistory(const Camera& camera, const glm::mat4& projection);
+    void MeasureSteps();
+    void UpdateRenderScale();
+    void ResizeRenderTargets(int width, int height);
+    void GatherLights(const Camera& camera, const glm::mat4& projection, const glm::mat4& view);
+    void InitSurfaceCache();
+    void FillSurfaceCache(const Camera& camera);
 };
\ No newline at end of file
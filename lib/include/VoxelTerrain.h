@@ -2,10 +2,24 @@
 
 #include <vector>
 #include <string>
+#include <unordered_set>
 #include <glm/glm.hpp>
 #include <glad/glad.h>
 #include "Camera.hpp"
 #include "Shader.hpp"
+#include "OccupancyPyramid.h"
+#include "MaterialMips.h"
+#include "OccupancyBits.h"
+#include "DistanceField.h"
+#include "BrickMap.h"
+#include "SparseVoxelOctree.h"
+#include "ChunkBounds.h"
+#include "SunVisibility.h"
+#include "FloodLight.h"
+#include "AmbientOcclusion.h"
+#include "ClusteredLights.h"
+#include "SurfaceCache.h"
+#include "VoxelMesher.h"
 
 struct Ray {
     glm::vec3 origin;
@@ -23,17 +37,48 @@ class VoxelTerrain {
     public:
         VoxelTerrain(unsigned int seed);
         bool isVoxel(glm::vec3 pos);
+        VoxelHit raycast(const Ray &ray, float maxDistance);
         std::vector<GLubyte> getVoxels();
         void setVoxel(int x, int y, int z, uint8_t value);
         void updateVoxelGPU(int x, int y, int z);
-        glm::ivec3 decodeVoxel(int mScreenWidth, int mScreenHeight, bool addBlock);
+        // Uploads finished chunk meshes and hands the edited chunks to the mesher's workers
+        void updateMeshes();
+        // Re-bakes the sun visibility behind this frame's edits and uploads the voxels they relit
+        void updateLighting();
+        // Moves the surface cache's resident chunks with the camera and picks this frame's fills
+        void updateSurfaceCache(const glm::vec3 &cameraPos);
+        static glm::ivec3 faceNormal(int faceIndex);
+        // Towards the sun at a time of day in hours, see the definition for the path it takes
+        static glm::vec3 sunDirectionAt(float hours);
+        // The baked sun visibility follows over the next frames, see SunVisibility.h
+        void setSunDirection(const glm::vec3 &toSun);
+        // Point lights at the emissive voxels that have an empty neighbour
+        void collectEmissiveLights(std::vector<ClusteredLights::PointLight> &lights) const;
+        // Bounds of the voxels set since the last call, false if there were none
+        bool consumeEditBounds(glm::ivec3 &editMin, glm::ivec3 &editMax);
         int VoxelWorldSize = 256;
+        glm::vec3 SunDirection = glm::normalize(glm::vec3(0.2f, 1.0f, 0.2f)); // Towards the sun, passed to the shaders as lightDir
 
         GLuint VoxelTexture;
-        unsigned int mFBO = 0;
+        OccupancyPyramid Occupancy;
+        MaterialMips MaterialLevels;
+        OccupancyBits SolidBits;
+        DistanceField Distance;
+        BrickMap Bricks;
+        SparseVoxelOctree Octree;
+        ChunkBounds Chunks;
+        SunVisibility Sun;
+        FloodLight Light;
+        AmbientOcclusion AO;
+        SurfaceCache Cache;     // Only filled once the renderer creates its textures
+        VoxelMesher Meshes;     // Only meshed once the rasterizing backend is first used
 
     private:
         int mMapSize;
+        bool mHasEdits = false;
+        glm::ivec3 mEditMin = glm::ivec3(0);
+        glm::ivec3 mEditMax = glm::ivec3(0);
+        std::unordered_set<size_t> mEmissiveVoxels; // Indices of the voxels whose material glows
         std::vector<GLubyte> voxels;
 
     };
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include <stdio.h>
 #include <iostream>
-// #include <vector>
+#include <future>
+#include <vector>
+#include "AssetLoader.h"
 
 class SkyBox{
     public:
@@ -12,11 +14,14 @@ class SkyBox{
         float vertices[108];
 
         SkyBox();
-        unsigned int loadCubemap(std::vector<std::string> faces);
+        SkyBox(std::vector<std::future<DecodedImage>> &faces); // Faces already decoding on worker threads
+        static std::vector<std::future<DecodedImage>> DecodeFaces(StartupTimeline* timeline = nullptr);
+        unsigned int loadCubemap(std::vector<std::future<DecodedImage>> &faces);
 
         unsigned int cubemapTexture;
         unsigned int VAO, VBO;
     private:
+        void InitBuffers();
 };
 
 
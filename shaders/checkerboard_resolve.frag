@@ -0,0 +1,106 @@
+#version 330 core
+
+// Rebuilds the full resolution raycast image from a checkerboard frame, see PixelCoord in
+// voxel_raycast.frag. Pixels traced this frame are copied. The others take last frame's resolved
+// color where the surface behind them was already on screen, clamped to their four traced
+// neighbours so moving light and disocclusions cannot smear. Where last frame saw something else
+// they are interpolated from the two neighbours on the side of the edge they belong to.
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 Resolved;    // rgb color, a distance to the camera: next frame's history
+
+in vec2 TexCoords;
+
+uniform sampler2D traceColor;              // Half width checkerboard targets
+uniform sampler2D traceDepth;
+uniform sampler2D previousResolved;        // Last frame's Resolved
+uniform int checkerParity;
+uniform int historyValid;                  // 0 on the first frame and after camera cuts
+uniform mat4 invViewProjection;
+uniform mat4 prevViewProjection;
+uniform vec3 cameraPos;
+uniform vec3 prevCameraPos;
+uniform vec2 screenSize;
+
+const float EDGE_TOLERANCE    = 0.05; // Relative distance difference of neighbours on the same surface
+const float HISTORY_TOLERANCE = 0.02; // Relative change of the distance that still counts as the same surface
+const float STATIC_MOTION     = 0.01; // Pixels a reprojection may move and still take the history unclamped
+
+struct Sample {
+    vec4 color;
+    float depth;
+    float distance;  // To the camera, 1e30 for background
+};
+
+vec3 WorldPosition(ivec2 pixel, float depth) {
+    vec4 ndc = vec4((vec2(pixel) + 0.5) / screenSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = invViewProjection * ndc;
+    return world.xyz / world.w;
+}
+
+// Traced pixel, x must have the parity this frame traced in row y
+Sample Traced(ivec2 pixel) {
+    ivec2 size = textureSize(traceColor, 0);
+    ivec2 texel = clamp(ivec2(pixel.x >> 1, pixel.y), ivec2(0), size - 1);
+    Sample s;
+    s.color = texelFetch(traceColor, texel, 0);
+    s.depth = texelFetch(traceDepth, texel, 0).r;
+    s.distance = s.depth >= 1.0 ? 1e30 : distance(WorldPosition(pixel, s.depth), cameraPos);
+    return s;
+}
+
+bool SameSurface(float a, float b, float tolerance) {
+    return abs(a - b) <= tolerance * min(a, b);
+}
+
+void Write(Sample s, vec3 color) {
+    FragColor = vec4(color, s.color.a);
+    Resolved = vec4(color, s.distance);
+    gl_FragDepth = s.depth;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if ((pixel.x & 1) == ((pixel.y + checkerParity) & 1)) {
+        Sample traced = Traced(pixel);
+        Write(traced, traced.color.rgb);
+        return;
+    }
+
+    // The four direct neighbours were all traced this frame
+    Sample left = Traced(pixel - ivec2(1, 0));
+    Sample right = Traced(pixel + ivec2(1, 0));
+    Sample down = Traced(pixel - ivec2(0, 1));
+    Sample up = Traced(pixel + ivec2(0, 1));
+
+    // An edge runs along the pair whose distances agree best. On one surface the pair is
+    // averaged, across a silhouette the nearer side wins so thin geometry stays connected.
+    bool horizontal = abs(left.distance - right.distance) <= abs(down.distance - up.distance);
+    Sample a = horizontal ? left : down;
+    Sample b = horizontal ? right : up;
+    Sample fill = a.distance <= b.distance ? a : b;
+    vec3 color = fill.color.rgb;
+    if (SameSurface(a.distance, b.distance, EDGE_TOLERANCE) && a.distance < 1e29) {
+        color = (a.color.rgb + b.color.rgb) * 0.5;
+        fill.color.a = (a.color.a + b.color.a) * 0.5;
+    }
+
+    if (historyValid != 0 && fill.distance < 1e29) {
+        vec3 world = WorldPosition(pixel, fill.depth);
+        vec4 clip = prevViewProjection * vec4(world, 1.0);
+        vec2 previousUV = clip.xy / clip.w * 0.5 + 0.5;
+        if (clip.w > 0.0 && all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThan(previousUV, vec2(1.0)))) {
+            vec2 previousPixel = previousUV * screenSize;
+            vec4 previous = texelFetch(previousResolved, ivec2(previousPixel), 0);
+            if (SameSurface(previous.a, distance(world, prevCameraPos), HISTORY_TOLERANCE)) {
+                color = previous.rgb;
+                // A still camera gets back exactly what it traced a frame ago, motion is kept within the neighbours
+                if (length(previousPixel - (vec2(pixel) + 0.5)) > STATIC_MOTION) {
+                    vec3 low = min(min(left.color.rgb, right.color.rgb), min(down.color.rgb, up.color.rgb));
+                    vec3 high = max(max(left.color.rgb, right.color.rgb), max(down.color.rgb, up.color.rgb));
+                    color = clamp(color, low, high);
+                }
+            }
+        }
+    }
+    Write(fill, color);
+}
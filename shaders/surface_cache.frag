@@ -0,0 +1,131 @@
+#version 330 core
+
+// Lights one texel of a face's block in the surface cache: sun visibility along a jittered ray
+// towards the sun, sky and block light of the voxel in front and the corner AO, all at a jittered
+// point inside the texel. New blocks average sampleCount samples, refreshes take one and are
+// blended into the block, which converges to soft sun shadows over the frames.
+layout(location = 0) out vec4 FragColor; // Block light in rgb, multiplier of the surface color in alpha
+
+flat in ivec3 Voxel;
+flat in int Face;
+flat in ivec2 BlockOrigin;
+
+uniform sampler3D voxelTexture;
+uniform sampler3D floodLight;       // Block light in rgb and sky light in alpha of the empty voxels, see FloodLight.h
+uniform sampler3D ambientOcclusion; // Occlusion level per voxel corner, see AmbientOcclusion.h
+uniform vec3 lightDir;              // Towards the sun, normalized
+uniform int frameIndex;
+uniform int sampleCount;
+
+#ifndef VOXEL_WORLD_SIZE
+#define VOXEL_WORLD_SIZE 256
+#endif
+#ifndef SURFACE_TEXELS
+#define SURFACE_TEXELS 4
+#endif
+#ifndef RAYTRACED_SHADOWS
+#define RAYTRACED_SHADOWS 1
+#endif
+#ifndef FLOOD_LIGHT
+#define FLOOD_LIGHT 0
+#endif
+#ifndef AMBIENT_OCCLUSION
+#define AMBIENT_OCCLUSION 0
+#endif
+
+const float SHADOW_STRENGHT = 0.4;
+const float CAVE_AMBIENT    = 0.15;
+const float AO_STRENGTH     = 0.5;
+const float SUN_CONE        = 0.03; // Radius of the jitter around the sun direction, half angle in radians
+
+uint Hash(uint x) {
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+vec2 Random2(uint seed) {
+    uint a = Hash(seed);
+    uint b = Hash(a);
+    return vec2(a >> 8, b >> 8) / 16777216.0;
+}
+
+// Voxel DDA through the dense texture, the faces cache the same opaque voxels the sun bake sees
+float SunVisible(vec3 start, vec3 dir) {
+    ivec3 voxel = ivec3(floor(start));
+    vec3 rayStep = sign(dir);
+    vec3 tDelta = abs(1.0 / dir);
+    vec3 tMax = (vec3(voxel) + max(rayStep, 0.0) - start) / dir;
+
+    for (int i = 0; i < 3 * VOXEL_WORLD_SIZE; i++) {
+        if (any(lessThan(voxel, ivec3(0))) || any(greaterThanEqual(voxel, ivec3(VOXEL_WORLD_SIZE))))
+            return 1.0;
+        if (texelFetch(voxelTexture, voxel, 0).r != 0.0)
+            return 0.0;
+
+        if (tMax.x < tMax.y && tMax.x < tMax.z) {
+            voxel.x += int(rayStep.x);
+            tMax.x += tDelta.x;
+        } else if (tMax.y < tMax.z) {
+            voxel.y += int(rayStep.y);
+            tMax.y += tDelta.y;
+        } else {
+            voxel.z += int(rayStep.z);
+            tMax.z += tDelta.z;
+        }
+    }
+    return 1.0;
+}
+
+void main()
+{
+    int axis = Face / 2;
+    vec3 normal = vec3(0.0);
+    normal[axis] = (Face & 1) == 0 ? 1.0 : -1.0;
+    ivec3 front = clamp(Voxel + ivec3(normal), ivec3(0), ivec3(VOXEL_WORLD_SIZE - 1));
+
+    // Same face axes as the hit shading: x faces (z, y), y faces (x, z), z faces (x, y)
+    ivec2 texel = ivec2(gl_FragCoord.xy) - BlockOrigin;
+    vec3 uAxis = axis == 0 ? vec3(0, 0, 1) : vec3(1, 0, 0);
+    vec3 vAxis = axis == 2 ? vec3(0, 1, 0) : axis == 1 ? vec3(0, 0, 1) : vec3(0, 1, 0);
+    vec3 faceOrigin = vec3(Voxel) + max(normal, 0.0);
+
+    vec3 sunUp = abs(lightDir.y) < 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3 sunU = normalize(cross(lightDir, sunUp));
+    vec3 sunV = cross(lightDir, sunU);
+
+    vec4 light = vec4(0.0);
+    uint seed = Hash(uint(texel.x + texel.y * SURFACE_TEXELS) ^ Hash(uint(Voxel.x + Voxel.y * 4099 + Voxel.z * 16777259) * 6u + uint(Face)));
+    for (int s = 0; s < sampleCount; s++) {
+        uint sampleSeed = Hash(seed ^ uint(frameIndex * 64 + s) * 0x9e3779b9u);
+        vec2 uv = (vec2(texel) + Random2(sampleSeed)) / float(SURFACE_TEXELS);
+        vec3 pos = faceOrigin + uAxis * uv.x + vAxis * uv.y;
+
+        float sun = 1.0;
+        #if RAYTRACED_SHADOWS
+            // Uniform point on a disk around the sun direction
+            vec2 disk = Random2(sampleSeed ^ 0x68bc21ebu);
+            float radius = SUN_CONE * sqrt(disk.x);
+            float angle = 6.2831853 * disk.y;
+            vec3 toSun = normalize(lightDir + radius * (cos(angle) * sunU + sin(angle) * sunV));
+            sun = dot(normal, toSun) > 0.0 ? SunVisible(pos + normal * 0.01, toSun) : 0.0;
+            sun = mix(SHADOW_STRENGHT, 1.0, sun);
+        #endif
+
+        float multiplier = sun;
+        vec3 blockLight = vec3(0.0);
+        #if FLOOD_LIGHT
+            vec4 flood = texelFetch(floodLight, front, 0);
+            multiplier *= mix(CAVE_AMBIENT, 1.0, flood.a * flood.a);
+            blockLight = flood.rgb * flood.rgb;
+        #endif
+        #if AMBIENT_OCCLUSION
+            float occlusion = 1.0 - AO_STRENGTH * texture(ambientOcclusion, (pos + 0.5) / float(VOXEL_WORLD_SIZE + 1)).r;
+            multiplier *= occlusion;
+            blockLight *= occlusion;
+        #endif
+        light += vec4(blockLight, multiplier);
+    }
+    FragColor = light / float(sampleCount);
+}
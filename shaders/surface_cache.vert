@@ -0,0 +1,33 @@
+#version 330 core
+
+// One atlas block per instance, a quad over its SURFACE_TEXELS^2 texels. See SurfaceCache.h.
+layout(location = 0) in uvec2 aFill; // Face key, slot
+
+#ifndef VOXEL_WORLD_SIZE
+#define VOXEL_WORLD_SIZE 256
+#endif
+#ifndef SURFACE_TEXELS
+#define SURFACE_TEXELS 4
+#endif
+#ifndef SURFACE_ATLAS_SIZE
+#define SURFACE_ATLAS_SIZE 2048
+#endif
+
+flat out ivec3 Voxel;
+flat out int Face;          // VoxelTerrain::faceNormal order: +X, -X, +Y, -Y, +Z, -Z
+flat out ivec2 BlockOrigin; // First texel of the block in the atlas
+
+void main()
+{
+    const uint size = uint(VOXEL_WORLD_SIZE);
+    const int slotsPerRow = SURFACE_ATLAS_SIZE / SURFACE_TEXELS;
+    uint index = aFill.x / 6u;
+    Voxel = ivec3(index % size, (index / size) % size, index / (size * size));
+    Face = int(aFill.x % 6u);
+    BlockOrigin = ivec2(int(aFill.y) % slotsPerRow, int(aFill.y) / slotsPerRow) * SURFACE_TEXELS;
+
+    // Triangle strip corners
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 texel = vec2(BlockOrigin) + corner * float(SURFACE_TEXELS);
+    gl_Position = vec4(texel / float(SURFACE_ATLAS_SIZE) * 2.0 - 1.0, 0.0, 1.0);
+}
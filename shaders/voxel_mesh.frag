@@ -0,0 +1,250 @@
+#version 330 core
+
+// Shading of the greedy meshed terrain, kept as close to the hit shading in voxel_raycast.frag
+// as rasterization allows: same spritesheet tiles, point lights, flood light, ambient occlusion
+// and baked sun visibility. Without the bake there are no cast sun shadows, only faces turned away
+// from the sun get the shadow term.
+out vec4 FragColor;
+
+in vec3 WorldPos;
+flat in int Face;       // VoxelTerrain::faceNormal order: +X, -X, +Y, -Y, +Z, -Z
+flat in int Material;
+
+uniform sampler2DArray voxelTiles;  // One layer per material and face column, see MaterialTable.h
+uniform usampler3D sunVisibility;   // Bit per face of the solid voxels that sees the sun, see SunVisibility.h
+uniform sampler3D floodLight;       // Block light in rgb and sky light in alpha of the empty voxels, see FloodLight.h
+uniform sampler3D ambientOcclusion; // Occlusion level per voxel corner, see AmbientOcclusion.h
+uniform usamplerBuffer clusterData; // Froxel grid, light records and index list, see ClusteredLights.h
+uniform sampler2D surfaceAtlas;     // Cached face light, see SurfaceCache.h
+uniform usamplerBuffer surfaceTable; // Face key to atlas block hash table
+uniform vec3 cameraPos;
+uniform vec3 lightDir;              // Towards the sun, normalized
+uniform mat4 viewMatrix;
+uniform vec2 screenSize;
+uniform vec2 clusterDepthParams;    // Froxel slice of a view depth d is log(d) * x + y
+
+#ifndef VOXEL_SHEET_TILES_X
+#define VOXEL_SHEET_TILES_X 2
+#endif
+#ifndef VOXEL_SHEET_TILES_Y
+#define VOXEL_SHEET_TILES_Y 7
+#endif
+#ifndef MAX_RAYTRACE_RANGE
+#define MAX_RAYTRACE_RANGE 64
+#endif
+#ifndef CAMERA_POINTLIGHT
+#define CAMERA_POINTLIGHT 1
+#endif
+#ifndef RAYTRACED_SHADOWS
+#define RAYTRACED_SHADOWS 1
+#endif
+#ifndef BAKED_SUN_VISIBILITY
+#define BAKED_SUN_VISIBILITY 0
+#endif
+#ifndef FLOOD_LIGHT
+#define FLOOD_LIGHT 0
+#endif
+#ifndef AMBIENT_OCCLUSION
+#define AMBIENT_OCCLUSION 0
+#endif
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 0
+#endif
+#ifndef CLUSTER_GRID_X
+#define CLUSTER_GRID_X 16
+#endif
+#ifndef CLUSTER_GRID_Y
+#define CLUSTER_GRID_Y 9
+#endif
+#ifndef CLUSTER_GRID_Z
+#define CLUSTER_GRID_Z 24
+#endif
+#ifndef VOXEL_WORLD_SIZE
+#define VOXEL_WORLD_SIZE 256
+#endif
+#ifndef MATERIAL_MASK_SIZE
+#define MATERIAL_MASK_SIZE 32
+#endif
+#ifndef SURFACE_CACHE
+#define SURFACE_CACHE 0
+#endif
+#ifndef SURFACE_TEXELS
+#define SURFACE_TEXELS 4
+#endif
+#ifndef SURFACE_ATLAS_SIZE
+#define SURFACE_ATLAS_SIZE 2048
+#endif
+#ifndef SURFACE_TABLE_BITS
+#define SURFACE_TABLE_BITS 19
+#endif
+#ifndef SURFACE_MAX_PROBES
+#define SURFACE_MAX_PROBES 16
+#endif
+
+// Per material properties built from the sprite sheet, see MaterialTable.h for the layout
+layout(std140) uniform MaterialTable {
+    vec4 materialProperties[VOXEL_SHEET_TILES_Y]; // rgb emission, a specular strength
+    uvec4 materialTileFlags[VOXEL_SHEET_TILES_Y]; // Per face column
+    uvec4 materialCutoutRows[VOXEL_SHEET_TILES_Y * VOXEL_SHEET_TILES_X * 2 * MATERIAL_MASK_SIZE / 4];
+};
+const uint TILE_OPAQUE            = 1u;
+const int CUTOUT_PRIMARY          = 0;
+
+const float SHADOW_STRENGHT       = 0.4;
+const float CAVE_AMBIENT          = 0.15;
+const float AO_STRENGTH           = 0.5;
+const float pointLightVoxelRadius = 3.0;
+const float pointLightIntensity   = 1.0;
+const vec3 pointLightColor        = vec3(1.0, 1.0, 1.0);
+
+// Same cutout test as the raycaster, so both backends agree on which texels are holes
+bool TileTexelSolid(int material, int column, vec2 uv) {
+    if ((materialTileFlags[material][column] & TILE_OPAQUE) != 0u)
+        return true;
+    ivec2 texel = clamp(ivec2(uv * float(MATERIAL_MASK_SIZE)), ivec2(0), ivec2(MATERIAL_MASK_SIZE - 1));
+    int row = ((material * VOXEL_SHEET_TILES_X + column) * 2 + CUTOUT_PRIMARY) * MATERIAL_MASK_SIZE + texel.y;
+    return (materialCutoutRows[row >> 2][row & 3] & (1u << uint(texel.x))) != 0u;
+}
+
+// Sum of the point lights binned into this pixel's froxel, see ClusteredLights.h for the layout
+vec3 ClusteredLight(vec3 worldPos, vec3 normal, float viewDepth) {
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) / screenSize),
+                       ivec2(0), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    int slice = clamp(int(floor(log(max(viewDepth, 1e-4)) * clusterDepthParams.x + clusterDepthParams.y)), 0, CLUSTER_GRID_Z - 1);
+    int cluster = tile.x + tile.y * CLUSTER_GRID_X + slice * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+    uvec4 header = texelFetch(clusterData, cluster >> 1);
+    uint first = (cluster & 1) == 0 ? header.x : header.z;
+    uint count = (cluster & 1) == 0 ? header.y : header.w;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < count; i++) {
+        uint index = first + i;
+        int record = int(texelFetch(clusterData, int(index >> 2u))[int(index & 3u)]);
+        vec4 positionRadius = uintBitsToFloat(texelFetch(clusterData, record));
+        vec3 toLight = positionRadius.xyz - worldPos;
+        float dist = length(toLight);
+        if (dist >= positionRadius.w)
+            continue;
+        float falloff = 1.0 - dist / positionRadius.w;
+        float NdotL = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        result += uintBitsToFloat(texelFetch(clusterData, record + 1).xyz) * (falloff * falloff * NdotL);
+    }
+    return result;
+}
+
+// Cached sun, sky, block light and AO of a face at a point on it, false while the face has no
+// filled block. See SurfaceCache.h for the table and atlas layout.
+bool SurfaceCacheLookup(ivec3 voxel, int face, vec3 hitPos, out vec4 light) {
+    light = vec4(0.0);
+    uint key = (uint(voxel.x) + uint(voxel.y) * uint(VOXEL_WORLD_SIZE) + uint(voxel.z) * uint(VOXEL_WORLD_SIZE * VOXEL_WORLD_SIZE)) * 6u + uint(face);
+    uint home = (key * 2654435761u) >> uint(32 - SURFACE_TABLE_BITS);
+    const uint mask = (1u << uint(SURFACE_TABLE_BITS)) - 1u;
+    for (int probe = 0; probe < SURFACE_MAX_PROBES; probe++) {
+        uvec2 entry = texelFetch(surfaceTable, int((home + uint(probe)) & mask)).rg;
+        if (entry.x == 0u)
+            return false;
+        if (entry.x != key + 1u)
+            continue;
+        if ((entry.y & 0x80000000u) != 0u)
+            return false; // Waits for its fill
+
+        // Same face axes as the tiles, clamped to the block's texel centers so filtering stays inside it
+        int axis = face / 2;
+        vec3 local = clamp(hitPos - vec3(voxel), 0.0, 1.0);
+        vec2 uv = axis == 0 ? local.zy : axis == 1 ? local.xz : local.xy;
+        const int slotsPerRow = SURFACE_ATLAS_SIZE / SURFACE_TEXELS;
+        vec2 origin = vec2(int(entry.y) % slotsPerRow, int(entry.y) / slotsPerRow) * float(SURFACE_TEXELS);
+        vec2 texel = origin + clamp(uv * float(SURFACE_TEXELS), 0.5, float(SURFACE_TEXELS) - 0.5);
+        light = texture(surfaceAtlas, texel / float(SURFACE_ATLAS_SIZE));
+        return true;
+    }
+    return false;
+}
+
+void main()
+{
+    int axis = Face / 2;
+    vec3 normal = vec3(0.0);
+    normal[axis] = (Face & 1) == 0 ? 1.0 : -1.0;
+
+    // Same tile coordinates as the raycaster, the greedy quads repeat the tile per voxel
+    vec3 local = clamp(fract(WorldPos), 0.01, 1.0 - 0.01);
+    vec2 voxelUV = axis == 0 ? vec2(local.z, local.y)
+                 : axis == 1 ? vec2(local.x, local.z)
+                             : vec2(local.x, local.y);
+
+    int material = clamp(Material, 0, VOXEL_SHEET_TILES_Y - 1);
+    int column = axis == 1 ? 1 : 0;
+    if (!TileTexelSolid(material, column, voxelUV))
+        discard;
+    vec4 textureColor = texture(voxelTiles, vec3(voxelUV, float(material * VOXEL_SHEET_TILES_X + column)));
+    vec4 properties = materialProperties[material];
+
+    FragColor = textureColor;
+    vec3 baseColor = textureColor.rgb;
+
+    #if SURFACE_CACHE
+    vec4 cached;
+    if (SurfaceCacheLookup(ivec3(floor(WorldPos - normal * 0.5)), Face, WorldPos, cached)) {
+        if (cached.a > SHADOW_STRENGHT && distance(cameraPos, WorldPos) < MAX_RAYTRACE_RANGE) {
+            vec3 viewDir = normalize(cameraPos - WorldPos);
+            vec3 halfDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
+            FragColor.rgb += spec * properties.a;
+        }
+        FragColor.rgb = FragColor.rgb * cached.a + baseColor * cached.rgb;
+    } else {
+    #endif
+
+    #if RAYTRACED_SHADOWS
+        #if BAKED_SUN_VISIBILITY
+            // Half a voxel back from the face lands inside the voxel it belongs to
+            ivec3 voxel = ivec3(floor(WorldPos - normal * 0.5));
+            float light = (texelFetch(sunVisibility, voxel, 0).r & (1u << uint(Face))) != 0u ? 1.0 : SHADOW_STRENGHT;
+        #else
+            float light = dot(normal, lightDir) > 0.0 ? 1.0 : SHADOW_STRENGHT;
+        #endif
+        if (light == 1.0 && distance(cameraPos, WorldPos) < MAX_RAYTRACE_RANGE) {
+            vec3 viewDir = normalize(cameraPos - WorldPos);
+            vec3 halfDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
+            FragColor.rgb += spec * properties.a;
+        }
+        FragColor.rgb *= light;
+    #endif
+
+    #if FLOOD_LIGHT
+        // Half a voxel out from the face lands in the empty voxel in front of it
+        vec4 flood = texelFetch(floodLight, ivec3(floor(WorldPos + normal * 0.5)), 0);
+        FragColor.rgb *= mix(CAVE_AMBIENT, 1.0, flood.a * flood.a);
+        FragColor.rgb += baseColor * flood.rgb * flood.rgb;
+    #endif
+
+    #if AMBIENT_OCCLUSION
+        float occlusion = texture(ambientOcclusion, (WorldPos + 0.5) / vec3(textureSize(ambientOcclusion, 0))).r;
+        FragColor.rgb *= 1.0 - AO_STRENGTH * occlusion;
+    #endif
+
+    #if SURFACE_CACHE
+    }
+    #endif
+
+    #if !FLOOD_LIGHT
+        FragColor.rgb += baseColor * properties.rgb * properties.rgb;
+    #endif
+
+    #if CLUSTERED_LIGHTS
+        float viewDepth = -(viewMatrix * vec4(WorldPos, 1.0)).z;
+        FragColor.rgb += baseColor * ClusteredLight(WorldPos, normal, viewDepth);
+    #endif
+
+    #if CAMERA_POINTLIGHT
+        float voxelDist = distance(WorldPos, cameraPos);
+        if (voxelDist <= pointLightVoxelRadius) {
+            vec3 lightDirToCamera = normalize(cameraPos - WorldPos);
+            float attenuation = max(1.0 - (voxelDist / pointLightVoxelRadius), 0.0);
+            float NdotL = max(dot(normal, lightDirToCamera), 0.0);
+            FragColor.rgb += baseColor * pointLightColor * pointLightIntensity * NdotL * attenuation;
+        }
+    #endif
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+// One packed word per vertex, see VoxelMesher.h
+layout(location = 0) in uint aPacked;
+
+uniform mat4 viewProjection;
+uniform vec3 chunkOrigin;
+
+out vec3 WorldPos;
+flat out int Face;
+flat out int Material;
+
+void main()
+{
+    vec3 local = vec3(aPacked & 63u, (aPacked >> 6) & 63u, (aPacked >> 12) & 63u);
+    Face = int((aPacked >> 18) & 7u);
+    Material = int(aPacked >> 24);
+    WorldPos = chunkOrigin + local;
+    gl_Position = viewProjection * vec4(WorldPos, 1.0);
+}
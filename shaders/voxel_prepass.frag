@@ -0,0 +1,73 @@
+#version 330 core
+
+// Coarse ray prepass: one fragment per PREPASS_TILE_SIZE^2 pixel tile. Marches a cone that
+// contains every pixel ray of the tile through the distance field and writes how far all
+// of them can safely skip before they have to start testing voxels.
+out float RayStart;
+
+uniform sampler3D distanceField;    // Chebyshev distance to the nearest solid voxel, in voxels / 255
+
+uniform vec3 cameraPos;
+uniform mat4 invProjection;
+uniform mat4 invView;
+uniform vec2 screenSize;
+
+#ifndef VOXEL_WORLD_SIZE
+#define VOXEL_WORLD_SIZE 256
+#endif
+#ifndef PREPASS_TILE_SIZE
+#define PREPASS_TILE_SIZE 8
+#endif
+#ifndef PREPASS_MAX_STEPS
+#define PREPASS_MAX_STEPS 64
+#endif
+
+const float worldSize = float(VOXEL_WORLD_SIZE);
+
+// Same as generateRay in voxel_raycast.frag, fed with a pixel center instead of TexCoords
+vec3 PixelRay(vec2 pixel) {
+    vec2 uv = pixel / screenSize;
+    vec4 clip = vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+    vec4 view = invProjection * clip;
+    view /= view.w;
+    vec4 world = invView * view;
+    return normalize(world.xyz - cameraPos);
+}
+
+// Radius of a sphere around p that holds no solid voxel. Outside the world both the distance to it
+// and the field radius at the closest point on it, shrunk by that distance, are safe.
+float EmptyRadius(vec3 p) {
+    vec3 closest = clamp(p, vec3(0.0), vec3(worldSize - 0.001));
+    float outside = length(p - closest);
+    // A distance of d empties the cube of radius d - 1 voxels around the voxel, which holds the sphere
+    float inside = texelFetch(distanceField, ivec3(closest), 0).r * 255.0 - 1.0;
+    return max(outside, inside - outside);
+}
+
+void main() {
+    vec2 tileMin = floor(gl_FragCoord.xy) * float(PREPASS_TILE_SIZE) + 0.5;
+    vec2 tileMax = min(tileMin + float(PREPASS_TILE_SIZE - 1), screenSize - 0.5);
+
+    // Cone around the central ray, wide enough for the rays through the outer pixel centers
+    vec3 axis = PixelRay((tileMin + tileMax) * 0.5);
+    float minCos = 1.0;
+    minCos = min(minCos, dot(axis, PixelRay(tileMin)));
+    minCos = min(minCos, dot(axis, PixelRay(tileMax)));
+    minCos = min(minCos, dot(axis, PixelRay(vec2(tileMin.x, tileMax.y))));
+    minCos = min(minCos, dot(axis, PixelRay(vec2(tileMax.x, tileMin.y))));
+    float spread = sqrt(max(1.0 - minCos * minCos, 0.0)) / max(minCos, 1e-4); // Cone radius per unit of distance
+
+    // Sphere tracing with the cone: the step keeps the cone slice up to t + step inside the empty sphere
+    float t = 0.0;
+    float farthest = length(cameraPos - worldSize * 0.5) + worldSize; // Past this the cone has left the world
+    for (int i = 0; i < PREPASS_MAX_STEPS && t < farthest; ++i) {
+        float radius = EmptyRadius(cameraPos + axis * t);
+        float stepSize = (radius - spread * t) / (1.0 + spread);
+        if (stepSize < 0.5)
+            break;
+        t += stepSize;
+    }
+
+    // Dilated by a voxel so rays never start on the far side of a surface
+    RayStart = max(t - 1.0, 0.0);
+}
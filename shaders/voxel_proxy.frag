@@ -0,0 +1,24 @@
+#version 330 core
+
+// Chunk proxy pass: only back faces are drawn, so every pixel whose ray crosses a box gets exactly
+// one fragment from it, even with the camera inside. Writes where the pixel's ray enters the box,
+// the target min-blends them into the nearest entry over all boxes.
+out float RayStart;
+
+in vec3 WorldPos;
+flat in vec3 BoxMin;
+flat in vec3 BoxMax;
+
+uniform vec3 cameraPos;
+
+void main()
+{
+    vec3 rayDir = normalize(WorldPos - cameraPos);
+    vec3 t0 = (BoxMin - cameraPos) / rayDir;
+    vec3 t1 = (BoxMax - cameraPos) / rayDir;
+    vec3 tNear = min(t0, t1);
+    float tEnter = max(max(tNear.x, tNear.y), tNear.z);
+
+    // Pulled in by a voxel so rays start outside the box even along its silhouette
+    RayStart = max(tEnter - 1.0, 0.0);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+// Unit cube corner, stretched over one chunk's solid bounds per instance
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aBoxMin;
+layout(location = 2) in vec3 aBoxMax;
+
+uniform mat4 viewProjection;
+
+out vec3 WorldPos;
+flat out vec3 BoxMin;
+flat out vec3 BoxMax;
+
+void main()
+{
+    BoxMin = aBoxMin;
+    BoxMax = aBoxMax;
+    WorldPos = mix(aBoxMin, aBoxMax, aPos);
+    gl_Position = viewProjection * vec4(WorldPos, 1.0);
+}
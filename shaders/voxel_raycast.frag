@@ -1,48 +1,356 @@
 #version 330 core
 
-out vec4 FragColor;
+// The same source runs as one of three passes, picked by the renderer
+#define PASS_FORWARD    0 // Traverse and shade in one go
+#define PASS_VISIBILITY 1 // Traverse only, write a hit record per pixel
+#define PASS_SHADE      2 // Full screen, shade the hit records of the visibility pass
+#ifndef RAYCAST_PASS
+#define RAYCAST_PASS PASS_FORWARD
+#endif
+
+#if RAYCAST_PASS == PASS_VISIBILITY
+layout(location = 0) out uvec2 HitRecord;    // See VoxelRenderer.hpp for the packing
+#else
+layout(location = 0) out vec4 FragColor;
+#endif
+#if RAYCAST_PASS != PASS_SHADE
+layout(location = 1) out float HitDistance;  // Distance to the first solid voxel, history for the next frame
+#endif
 in vec2 TexCoords;
 
 uniform sampler3D voxelTexture;
-uniform sampler2D voxelSpriteSheet;
+uniform sampler2DArray voxelTiles;  // One layer per material and face column, see MaterialTable.h
+uniform sampler3D occupancyTexture; // Max-occupancy mips, level l covers (2 << l)^3 voxels
+uniform sampler3D distanceField;    // Chebyshev distance to the nearest solid voxel, in voxels / 255
+uniform usampler3D brickPageTable;  // One entry per 8^3 brick, see BrickMap.h for the encoding
+uniform sampler3D brickAtlas;       // Mixed bricks resident on the GPU
+uniform usamplerBuffer octreeNodes; // Sparse voxel octree node words, same encoding as the brick pages
+uniform usampler3D occupancyBits;   // Solid bit per voxel, 4x4x4 voxels per texel, see OccupancyBits.h
+uniform sampler2D rayStartTexture;  // Safe start distance per tile, written by voxel_prepass.frag
+uniform sampler2D historyDistance;  // Last frame's HitDistance
+uniform sampler2D proxyStartTexture; // Nearest chunk proxy entry per pixel, 1e30 where none covers it
+uniform sampler3D materialMips;     // Majority material mips, level l covers (2 << l)^3 voxels
+uniform usampler3D sunVisibility;   // Bit per face of the solid voxels that sees the sun, see SunVisibility.h
+uniform sampler3D floodLight;       // Block light in rgb and sky light in alpha of the empty voxels, see FloodLight.h
+uniform sampler3D ambientOcclusion; // Occlusion level per voxel corner, see AmbientOcclusion.h
+uniform usamplerBuffer clusterData; // Froxel grid, light records and index list, see ClusteredLights.h
+uniform sampler2D surfaceAtlas;     // Cached face light, see SurfaceCache.h
+uniform usamplerBuffer surfaceTable; // Face key to atlas block hash table
+uniform usampler2D hitRecords;      // Written by the visibility pass, read by the shade pass
 
 uniform vec3 cameraPos;
+uniform vec3 lightDir;              // Towards the sun, normalized
 uniform float nearPlane;
 uniform float farPlane;
 uniform mat4 invProjection;
 uniform mat4 projectionMatrix;
 uniform mat4 invView;
 uniform mat4 viewMatrix;
+uniform vec2 screenSize;
+uniform vec2 clusterDepthParams;    // Froxel slice of a view depth d is log(d) * x + y
+
+uniform int checkerParity;          // Which half of the pixels a checkerboard frame traces, see PixelCoord
+uniform int historyValid;           // 0 on the first frame and after camera cuts
+uniform mat4 prevViewProjection;
+uniform vec3 prevCameraPos;
+uniform vec3 editBoxMin;            // Voxels edited since last frame, empty when min > max
+uniform vec3 editBoxMax;
+
+// Constants the renderer knows at startup are injected as defines, so the compiler can fold them.
+// Without them the shader falls back to the uniforms.
+#ifdef VOXEL_WORLD_SIZE
+const int voxelWorldSize = VOXEL_WORLD_SIZE;
+#else
 uniform int voxelWorldSize;
-uniform float VoxelScaleX;
-uniform float VoxelScaleY;
-uniform int tilesPerCol;
-
-const int MAX_STEPS          = 256;
-const int MAX_LIGHT_STEPS    = 8;
-const int MAX_RAYTRACE_RANGE = 64;
+#endif
+// The material table is sized by the sheet layout, so that one has no uniform fallback
+#ifndef VOXEL_SHEET_TILES_X
+#define VOXEL_SHEET_TILES_X 2
+#endif
+#ifndef VOXEL_SHEET_TILES_Y
+#define VOXEL_SHEET_TILES_Y 7
+#endif
+#ifndef MATERIAL_MASK_SIZE
+#define MATERIAL_MASK_SIZE 32
+#endif
+
+// Per material properties built from the sprite sheet, see MaterialTable.h for the layout
+layout(std140) uniform MaterialTable {
+    vec4 materialProperties[VOXEL_SHEET_TILES_Y]; // rgb emission, a specular strength
+    uvec4 materialTileFlags[VOXEL_SHEET_TILES_Y]; // Per face column
+    uvec4 materialCutoutRows[VOXEL_SHEET_TILES_Y * VOXEL_SHEET_TILES_X * 2 * MATERIAL_MASK_SIZE / 4];
+};
+const uint TILE_OPAQUE        = 1u; // Every texel stops camera rays
+const uint TILE_SHADOW_OPAQUE = 2u; // Every texel stops shadow rays
+const int CUTOUT_PRIMARY      = 0;
+const int CUTOUT_SHADOW       = 1;
+
+// Quality variants, selected at runtime through Shader::setDefines
+#ifndef MAX_STEPS
+#define MAX_STEPS 256
+#endif
+#ifndef MAX_LIGHT_STEPS
+#define MAX_LIGHT_STEPS 8
+#endif
+#ifndef MAX_RAYTRACE_RANGE
+#define MAX_RAYTRACE_RANGE 64
+#endif
+#ifndef OCCUPANCY_LEVELS
+#define OCCUPANCY_LEVELS 5
+#endif
+#define SKIP_OCCUPANCY_PYRAMID 1
+#define SKIP_DISTANCE_FIELD    2
+#ifndef EMPTY_SPACE_SKIPPING
+#define EMPTY_SPACE_SKIPPING SKIP_OCCUPANCY_PYRAMID
+#endif
+#ifndef OCCUPANCY_BITS
+#define OCCUPANCY_BITS 0
+#endif
+#define STORAGE_DENSE    0
+#define STORAGE_BRICKMAP 1
+#define STORAGE_OCTREE   2
+#ifndef VOXEL_STORAGE
+#define VOXEL_STORAGE STORAGE_DENSE
+#endif
+#ifndef BRICK_ATLAS_BRICKS
+#define BRICK_ATLAS_BRICKS 16
+#endif
+#ifndef OCTREE_LEVELS
+#define OCTREE_LEVELS 8
+#endif
+#ifndef COARSE_PREPASS
+#define COARSE_PREPASS 0
+#endif
+#ifndef PREPASS_TILE_SIZE
+#define PREPASS_TILE_SIZE 8
+#endif
+#ifndef CHUNK_PROXIES
+#define CHUNK_PROXIES 0
+#endif
+#ifndef TEMPORAL_REPROJECTION
+#define TEMPORAL_REPROJECTION 0
+#endif
+#ifndef REPROJECTION_SAMPLES
+#define REPROJECTION_SAMPLES 4
+#endif
+#ifndef REPROJECTION_MARGIN
+#define REPROJECTION_MARGIN 1.5
+#endif
+#ifndef LOD_DISTANCE
+#define LOD_DISTANCE 0
+#endif
+#ifndef LOD_LEVELS
+#define LOD_LEVELS 3
+#endif
+#ifndef RAYCAST_STEP_HEATMAP
+#define RAYCAST_STEP_HEATMAP 0
+#endif
+#if RAYCAST_PASS != PASS_FORWARD
+// The step count never leaves the traversal
+#undef RAYCAST_STEP_HEATMAP
+#define RAYCAST_STEP_HEATMAP 0
+#endif
 const float SHADOW_STRENGHT  = 0.4;
+const float CAVE_AMBIENT     = 0.15; // What is left of the sky and sun where no sky light reaches
+const float AO_STRENGTH      = 0.5;  // Darkening of a fully occluded corner
 
 const float pointLightVoxelRadius = 3.0; // e.g., 6.0 voxels
 const float pointLightIntensity   = 1.0;  // e.g., 0.5
 const vec3 pointLightColor        = vec3(1.0,1.0,1.0); // e.g., vec3(1.0, 0.95, 0.8)
-const vec3 lightDir               = normalize(vec3(0.2, 1.0, 0.2));
 float voxelSize                   = 1.0;
 precision highp float;
 precision highp int;
 
+#ifndef CAMERA_POINTLIGHT
 #define CAMERA_POINTLIGHT 1
+#endif
+#ifndef RAYTRACED_SHADOWS
 #define RAYTRACED_SHADOWS 1
+#endif
+#ifndef BAKED_SUN_VISIBILITY
+#define BAKED_SUN_VISIBILITY 0
+#endif
+#ifndef FLOOD_LIGHT
+#define FLOOD_LIGHT 0
+#endif
+#ifndef AMBIENT_OCCLUSION
+#define AMBIENT_OCCLUSION 0
+#endif
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 0
+#endif
+#ifndef CLUSTER_GRID_X
+#define CLUSTER_GRID_X 16
+#endif
+#ifndef CLUSTER_GRID_Y
+#define CLUSTER_GRID_Y 9
+#endif
+#ifndef CLUSTER_GRID_Z
+#define CLUSTER_GRID_Z 24
+#endif
+#ifndef SURFACE_CACHE
+#define SURFACE_CACHE 0
+#endif
+#ifndef SURFACE_TEXELS
+#define SURFACE_TEXELS 4
+#endif
+#ifndef SURFACE_ATLAS_SIZE
+#define SURFACE_ATLAS_SIZE 2048
+#endif
+#ifndef SURFACE_TABLE_BITS
+#define SURFACE_TABLE_BITS 19
+#endif
+#ifndef SURFACE_MAX_PROBES
+#define SURFACE_MAX_PROBES 16
+#endif
+#ifndef CHECKERBOARD
+#define CHECKERBOARD 0
+#endif
+
+// Full resolution pixel of this fragment. Checkerboard targets are half as wide: each row traces
+// either its even or its odd pixels, flipping from row to row and from frame to frame, and
+// checkerboard_resolve.frag fills in the rest.
+ivec2 PixelCoord() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    #if CHECKERBOARD
+        pixel.x = pixel.x * 2 + ((pixel.y + checkerParity) & 1);
+    #endif
+    return pixel;
+}
+
+// Pixel center in 0..1 over the full screen, what TexCoords is without the checkerboard
+vec2 PixelUV() {
+    return (vec2(PixelCoord()) + 0.5) / screenSize;
+}
+
+// Sum of the point lights binned into this pixel's froxel, see ClusteredLights.h for the layout
+vec3 ClusteredLight(vec3 worldPos, vec3 normal, float viewDepth) {
+    ivec2 tile = clamp(ivec2(PixelUV() * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y)),
+                       ivec2(0), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    int slice = clamp(int(floor(log(max(viewDepth, 1e-4)) * clusterDepthParams.x + clusterDepthParams.y)), 0, CLUSTER_GRID_Z - 1);
+    int cluster = tile.x + tile.y * CLUSTER_GRID_X + slice * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+    uvec4 header = texelFetch(clusterData, cluster >> 1);
+    uint first = (cluster & 1) == 0 ? header.x : header.z;
+    uint count = (cluster & 1) == 0 ? header.y : header.w;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < count; i++) {
+        uint index = first + i;
+        int record = int(texelFetch(clusterData, int(index >> 2u))[int(index & 3u)]);
+        vec4 positionRadius = uintBitsToFloat(texelFetch(clusterData, record));
+        vec3 toLight = positionRadius.xyz - worldPos;
+        float dist = length(toLight);
+        if (dist >= positionRadius.w)
+            continue;
+        float falloff = 1.0 - dist / positionRadius.w;
+        float NdotL = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        result += uintBitsToFloat(texelFetch(clusterData, record + 1).xyz) * (falloff * falloff * NdotL);
+    }
+    return result;
+}
+
+// Cached sun, sky, block light and AO of a face at a point on it, false while the face has no
+// filled block. See SurfaceCache.h for the table and atlas layout.
+bool SurfaceCacheLookup(ivec3 voxel, int face, vec3 hitPos, out vec4 light) {
+    light = vec4(0.0);
+    uint key = (uint(voxel.x) + uint(voxel.y) * uint(voxelWorldSize) + uint(voxel.z) * uint(voxelWorldSize * voxelWorldSize)) * 6u + uint(face);
+    uint home = (key * 2654435761u) >> uint(32 - SURFACE_TABLE_BITS);
+    const uint mask = (1u << uint(SURFACE_TABLE_BITS)) - 1u;
+    for (int probe = 0; probe < SURFACE_MAX_PROBES; probe++) {
+        uvec2 entry = texelFetch(surfaceTable, int((home + uint(probe)) & mask)).rg;
+        if (entry.x == 0u)
+            return false;
+        if (entry.x != key + 1u)
+            continue;
+        if ((entry.y & 0x80000000u) != 0u)
+            return false; // Waits for its fill
+
+        // Same face axes as the tiles, clamped to the block's texel centers so filtering stays inside it
+        int axis = face / 2;
+        vec3 local = clamp(hitPos - vec3(voxel), 0.0, 1.0);
+        vec2 uv = axis == 0 ? local.zy : axis == 1 ? local.xz : local.xy;
+        const int slotsPerRow = SURFACE_ATLAS_SIZE / SURFACE_TEXELS;
+        vec2 origin = vec2(int(entry.y) % slotsPerRow, int(entry.y) / slotsPerRow) * float(SURFACE_TEXELS);
+        vec2 texel = origin + clamp(uv * float(SURFACE_TEXELS), 0.5, float(SURFACE_TEXELS) - 0.5);
+        light = texture(surfaceAtlas, texel / float(SURFACE_ATLAS_SIZE));
+        return true;
+    }
+    return false;
+}
+
+// Blue (few steps) -> green -> red (MAX_STEPS), raw count in alpha for the renderer to average
+vec4 StepHeatmap(int steps) {
+    float heat = clamp(float(steps) / float(MAX_STEPS), 0.0, 1.0);
+    vec3 color = heat < 0.5 ? mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), heat * 2.0)
+                            : mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), heat * 2.0 - 1.0);
+    return vec4(color, float(steps));
+}
+
+const uint UNIFORM_BIT = 0x80000000u;
+
+// Descends from the root to the leaf holding the voxel, leafSize gets the edge length of that leaf
+uint OctreeLeaf(ivec3 voxel, out int leafSize) {
+    uint node = texelFetch(octreeNodes, 0).r;
+    int level = 0;
+    for (; level < OCTREE_LEVELS && node != 0u && (node & UNIFORM_BIT) == 0u; ++level) {
+        ivec3 octant = (voxel >> (OCTREE_LEVELS - 1 - level)) & 1;
+        node = texelFetch(octreeNodes, int(node) + octant.x + octant.y * 2 + octant.z * 4).r;
+    }
+    leafSize = 1 << (OCTREE_LEVELS - level);
+    return node;
+}
+
+// Material of one voxel, read from the dense volume, the brick page table or the octree
+float VoxelAt(ivec3 voxel) {
+#if VOXEL_STORAGE == STORAGE_OCTREE
+    int leafSize;
+    return float(OctreeLeaf(voxel, leafSize) & 0xFFu) / 255.0;
+#elif VOXEL_STORAGE == STORAGE_BRICKMAP
+    uint page = texelFetch(brickPageTable, voxel >> 3, 0).r;
+    if (page == 0u)
+        return 0.0;
+    if ((page & UNIFORM_BIT) != 0u)
+        return float(page & 0xFFu) / 255.0;
+
+    int slot = int(page) - 1;
+    ivec3 slotCoord = ivec3(slot % BRICK_ATLAS_BRICKS, (slot / BRICK_ATLAS_BRICKS) % BRICK_ATLAS_BRICKS, slot / (BRICK_ATLAS_BRICKS * BRICK_ATLAS_BRICKS));
+    return texelFetch(brickAtlas, slotCoord * 8 + (voxel & 7), 0).r;
+#else
+    return texelFetch(voxelTexture, voxel, 0).r;
+#endif
+}
+
+// The last fetched occupancy texel, consecutive DDA steps mostly stay inside the same 4x4x4 block
+struct SolidCache {
+    ivec3 block;
+    uvec2 mask;
+};
+const SolidCache EMPTY_SOLID_CACHE = SolidCache(ivec3(-1), uvec2(0u));
+
+// Whether a voxel is solid, without touching the material unless OCCUPANCY_BITS is off
+bool IsSolid(ivec3 voxel, inout SolidCache cache) {
+#if OCCUPANCY_BITS
+    ivec3 block = voxel >> 2;
+    if (block != cache.block) {
+        cache.block = block;
+        cache.mask = texelFetch(occupancyBits, block, 0).rg;
+    }
+    uint word = (voxel.z & 2) != 0 ? cache.mask.y : cache.mask.x;
+    return (word & (1u << uint((voxel.x & 3) + (voxel.y & 3) * 4 + (voxel.z & 1) * 16))) != 0u;
+#else
+    return VoxelAt(voxel) != 0.0;
+#endif
+}
 
 bool isSkyLight(ivec3 voxel, vec3 lightDir) {
     vec3 pos = vec3(voxel) + 0.5; // center of voxel
+    SolidCache cache = EMPTY_SOLID_CACHE;
     for (int i = 0; i < voxelWorldSize; i++) {
         pos += lightDir;
         if (any(lessThan(pos, vec3(0.0))) || any(greaterThanEqual(pos, vec3(voxelWorldSize))))
             break;
 
-        float density = texture(voxelTexture, pos / float(voxelWorldSize)).r;
-        if (density != 0.0)
+        if (IsSolid(ivec3(floor(pos)), cache))
             return false; // blocked
     }
     return true;
@@ -56,37 +364,55 @@ void WriteDepth(vec3 hitPos)
     gl_FragDepth = ndcDepth * 0.5 + 0.5;
 }
 
-vec4 EncodeVoxel(ivec3 voxel, vec3 normal){
-    vec3 encodedVoxel = vec3(voxel) / float(voxelWorldSize);
-    vec3 encodedNormal = normal * 0.5 + 0.5; // Map [-1,1] → [0,1]
-
-    int faceIndex = 0;
-    if (normal.x > 0.5)      faceIndex = 0; // +X
-    else if (normal.x < -0.5) faceIndex = 1; // -X
-    else if (normal.y > 0.5)  faceIndex = 2; // +Y
-    else if (normal.y < -0.5) faceIndex = 3; // -Y
-    else if (normal.z > 0.5)  faceIndex = 4; // +Z
-    else                      faceIndex = 5; // -Z
+int FaceIndex(vec3 normal) {
+    if (normal.x > 0.5)       return 0; // +X
+    else if (normal.x < -0.5) return 1; // -X
+    else if (normal.y > 0.5)  return 2; // +Y
+    else if (normal.y < -0.5) return 3; // -Y
+    else if (normal.z > 0.5)  return 4; // +Z
+    else                      return 5; // -Z
+}
 
-    float encodedFace = float(faceIndex) / 5.0;
+const int NO_FACE = 6; // The ray started inside the voxel
 
-    return vec4(encodedVoxel, encodedFace);
+vec3 FaceNormal(int faceIndex) {
+    if (faceIndex == NO_FACE)
+        return vec3(0.0);
+    vec3 normal = vec3(0.0);
+    normal[faceIndex / 2] = (faceIndex & 1) == 0 ? 1.0 : -1.0;
+    return normal;
 }
 
 float SkyLight(ivec3 voxel, vec3 lightDir) {
     vec3 pos = vec3(voxel) + 0.5; // center of voxel
+    SolidCache cache = EMPTY_SOLID_CACHE;
     for (int i = 0; i < voxelWorldSize; i++) {
         pos += lightDir;
         if (any(lessThan(pos, vec3(0.0))) || any(greaterThanEqual(pos, vec3(voxelWorldSize))))
             break;
 
-        float density = texture(voxelTexture, pos / float(voxelWorldSize)).r;
-        if (density != 0.0)
+        if (IsSolid(ivec3(floor(pos)), cache))
             return SHADOW_STRENGHT; // blocked
     }
     return 1.0;
 }
 
+// Row of the material table and layer group of the tile array, from a normalized voxel value
+int MaterialOf(float density) {
+    return clamp(int(density * 255.0 + 0.5), 0, VOXEL_SHEET_TILES_Y - 1);
+}
+
+// Whether the tile texel at uv stops a ray, answered from the table alone. Opaque tiles return
+// before looking at the mask, cutouts read one bit of it.
+bool TileTexelSolid(int material, int column, int test, vec2 uv) {
+    uint opaque = test == CUTOUT_PRIMARY ? TILE_OPAQUE : TILE_SHADOW_OPAQUE;
+    if ((materialTileFlags[material][column] & opaque) != 0u)
+        return true;
+    ivec2 texel = clamp(ivec2(uv * float(MATERIAL_MASK_SIZE)), ivec2(0), ivec2(MATERIAL_MASK_SIZE - 1));
+    int row = ((material * VOXEL_SHEET_TILES_X + column) * 2 + test) * MATERIAL_MASK_SIZE + texel.y;
+    return (materialCutoutRows[row >> 2][row & 3] & (1u << uint(texel.x))) != 0u;
+}
+
 float voxelShadow(vec3 startPos, vec3 dir) {
     vec3 pos = startPos;
     ivec3 voxel = ivec3(floor(pos * voxelWorldSize));
@@ -101,13 +427,14 @@ float voxelShadow(vec3 startPos, vec3 dir) {
 
     int face = -1;       // 0 = X, 1 = Y, 2 = Z, Default invalid
     float faceDir = 0.0;
+    SolidCache cache = EMPTY_SOLID_CACHE;
 
     for (int i = 0; i < MAX_LIGHT_STEPS * voxelWorldSize; i++) {
         if (any(lessThan(voxel, ivec3(0))) || any(greaterThanEqual(voxel, ivec3(voxelWorldSize))))
             break;
 
-        float density = texelFetch(voxelTexture, voxel, 0).r;
-        if (density != 0.0) {
+        if (IsSolid(voxel, cache)) {
+            float density = VoxelAt(voxel);
             // Compute hit distance (t) along ray
             float hitT;
             if (face == 0) {
@@ -134,20 +461,9 @@ float voxelShadow(vec3 startPos, vec3 dir) {
             }
             voxelUV = clamp(voxelUV, 0.0, 1.0);
 
-            float voxelID = floor(density * 255.0);
-            float xOffset = (face == 1) ? 1.0 : 0.0; 
-            float yOffset = (tilesPerCol - 1 - voxelID) * VoxelScaleY;
-            voxelUV.x = voxelUV.x * VoxelScaleX + (xOffset * VoxelScaleX); 
-            voxelUV.y = voxelUV.y * VoxelScaleY + yOffset;
-
-            vec4 textureColor = texture(voxelSpriteSheet, voxelUV);
-
-            if (textureColor.a < 0.1) {
-                // Transparent pixel, ignore voxel and continue marching
-                // Do nothing here (just proceed with loop)
-            } else {
+            // Transparent texels let the ray continue, opaque materials never look at the mask
+            if (TileTexelSolid(MaterialOf(density), face == 1 ? 1 : 0, CUTOUT_SHADOW, voxelUV))
                 return SHADOW_STRENGHT;
-            }
         }
 
         // Step the voxel along the ray
@@ -198,19 +514,342 @@ bool intersectBox(vec3 rayOrigin, vec3 rayDir, out float tmin, out float tmax) {
     return tmax >= max(tmin, 0.0);
 }
 
+// Move the DDA state to the first voxel past the face where the ray leaves an empty box.
+// Returns false once the ray has left the world bounds.
+bool SkipEmptyBox(ivec3 boxMin, ivec3 boxMax, vec3 rayOrigin, vec3 rayDir, vec3 rayStep, float tmax,
+                  inout ivec3 voxel, inout ivec3 lastVoxel, inout int face, inout int faceDir,
+                  inout float tCurrent, inout vec3 pos, inout vec3 tMax)
+{
+    vec3 exitPlanes = mix(vec3(boxMin), vec3(boxMax + 1), step(0.0, rayDir)) * voxelSize;
+    vec3 tExit = (exitPlanes - rayOrigin) / rayDir;
+    int axis = (tExit.x < tExit.y && tExit.x < tExit.z) ? 0 : (tExit.y < tExit.z ? 1 : 2);
+
+    tCurrent = tExit[axis];
+    if (tCurrent > tmax)
+        return false;
+    pos = rayOrigin + rayDir * tCurrent;
+
+    // Land on the first voxel past the exit face, the other axes stay inside the box we crossed
+    face = axis;
+    faceDir = int(rayStep[axis]);
+    voxel = clamp(ivec3(floor(pos)), boxMin, boxMax);
+    voxel[axis] = faceDir > 0 ? boxMax[axis] + 1 : boxMin[axis] - 1;
+    lastVoxel = voxel;
+    lastVoxel[axis] -= faceDir;
+
+    vec3 voxelWorldPos = vec3(voxel) * voxelSize;
+    tMax = (voxelWorldPos + step(0.0, rayDir) * voxelSize - rayOrigin) / rayDir;
+    return true;
+}
+
+#if LOD_DISTANCE > 0
+// Level l (cells of 2^l voxels) takes over at LOD_DISTANCE * 2^(l-1). Pixels grow linearly with
+// distance, so every level covers about the same number of pixels per cell.
+int LodLevel(float t) {
+    float ratio = t / float(LOD_DISTANCE);
+    return ratio < 1.0 ? 0 : min(int(log2(ratio)) + 1, LOD_LEVELS);
+}
+#endif
+
+#if TEMPORAL_REPROJECTION
+// Nearest of last frame's first hit distances around where p was on screen, -1 if it was off screen.
+// The 3x3 neighbourhood keeps silhouettes that moved by a pixel covered.
+float HistoryDistanceAt(vec3 p) {
+    vec4 clip = prevViewProjection * vec4(p, 1.0);
+    if (clip.w <= 0.0)
+        return -1.0;
+    vec2 ndc = clip.xy / clip.w;
+    if (any(greaterThan(abs(ndc), vec2(1.0))))
+        return -1.0;
+
+    ivec2 size = textureSize(historyDistance, 0);
+    ivec2 pixel = ivec2((ndc * 0.5 + 0.5) * vec2(size));
+    float nearest = 1e30;
+    for (int y = -1; y <= 1; ++y)
+        for (int x = -1; x <= 1; ++x)
+            nearest = min(nearest, texelFetch(historyDistance, clamp(pixel + ivec2(x, y), ivec2(0), size - 1), 0).r);
+    return nearest;
+}
+
+// Furthest distance along the ray that last frame showed to be empty, never less than tmin.
+// Guesses where the ray meets last frame's surfaces, then only keeps the part of the way there
+// whose samples were all seen in front of a surface, by REPROJECTION_MARGIN voxels.
+float ReprojectedRayStart(vec3 rayOrigin, vec3 rayDir, float tmin, float tmax) {
+    if (historyValid == 0)
+        return tmin;
+
+    // Slide the guess onto the surface seen around its reprojection, twice is enough for slow motion
+    float guess = tmin;
+    for (int i = 0; i < 2; ++i) {
+        vec3 p = rayOrigin + rayDir * guess;
+        float surface = HistoryDistanceAt(p);
+        if (surface < 0.0)
+            return tmin;
+        guess = min(guess + surface - distance(p, prevCameraPos), tmax);
+    }
+    guess -= REPROJECTION_MARGIN + 0.25; // Just past the margin the end sample checks
+
+    // Voxels placed since last frame may sit in front of the surfaces it saw
+    vec3 boxMin = editBoxMin - REPROJECTION_MARGIN;
+    vec3 boxMax = editBoxMax + REPROJECTION_MARGIN;
+    vec3 t0 = (boxMin - rayOrigin) / rayDir;
+    vec3 t1 = (boxMax - rayOrigin) / rayDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float editEnter = max(max(tNear.x, tNear.y), tNear.z);
+    float editExit = min(min(tFar.x, tFar.y), tFar.z);
+    if (editEnter <= editExit && editExit > 0.0)
+        guess = min(guess, editEnter);
+
+    float start = tmin;
+    for (int i = 1; i <= REPROJECTION_SAMPLES; ++i) {
+        float t = mix(tmin, guess, float(i) / float(REPROJECTION_SAMPLES));
+        vec3 p = rayOrigin + rayDir * t;
+        float surface = HistoryDistanceAt(p);
+        if (surface < 0.0 || distance(p, prevCameraPos) + REPROJECTION_MARGIN > surface)
+            break;
+        start = t;
+    }
+    return start;
+}
+#endif
+
+// Tile coordinates of a hit, local is the hit point relative to the voxel. Side faces use the
+// first column of the material's tiles, top and bottom the second one.
+vec2 FaceUV(int faceIndex, vec3 local, out int column) {
+    local = clamp(local / voxelSize, 0.01, 1.0 - 0.01);
+    int axis = faceIndex / 2;
+    column = axis == 1 ? 1 : 0;
+    if (axis == 0)      // X face
+        return vec2(local.z, local.y);
+    else if (axis == 1) // Y face
+        return vec2(local.x, local.z);
+    else if (axis == 2) // Z face
+        return vec2(local.x, local.y);
+    return vec2(0.0);
+}
+
+// Whether a camera ray stops at this point of the face, no texture fetch involved
+bool FaceSolid(int material, int faceIndex, vec3 local) {
+    int column;
+    vec2 uv = FaceUV(faceIndex, local, column);
+    return TileTexelSolid(material, column, CUTOUT_PRIMARY, uv);
+}
+
+// Tile texel of a hit, only fetched for the hit that gets shaded
+vec4 FaceTexel(int material, int faceIndex, vec3 local) {
+    int column;
+    vec2 uv = FaceUV(faceIndex, local, column);
+    vec3 tile = vec3(uv, float(material * VOXEL_SHEET_TILES_X + column));
+    #if CHECKERBOARD
+        // Neighbours in the half width trace are two pixels apart in x, and the upper row of a
+        // quad is shifted by one pixel against the lower, see PixelCoord
+        vec2 dx = dFdx(uv) * 0.5;
+        vec2 dy = dFdy(uv) - dx * float(1 - 2 * checkerParity);
+        return textureGrad(voxelTiles, tile, dx, dy);
+    #else
+        return texture(voxelTiles, tile);
+    #endif
+}
+
+// Lit color of an opaque hit, shared by the forward and the shade pass. lodMaterial is the
+// majority material when the hit was on a LOD cell, 0 otherwise.
+vec4 ShadeHit(ivec3 voxel, int faceIndex, vec3 hitPos, vec4 textureColor, int material, float lodMaterial) {
+    vec3 normal = FaceNormal(faceIndex);
+    vec4 color = textureColor;
+    vec3 baseColor = textureColor.rgb;
+    vec4 properties = materialProperties[material];
+
+    float voxelWorldSizeF = float(voxelWorldSize);
+    vec3 startShadowPos = (hitPos) / voxelWorldSizeF;
+
+    #if SURFACE_CACHE
+    // Sun, sky, block light and AO come filled in from the cache, only the specular stays per pixel
+    vec4 cached;
+    if (SurfaceCacheLookup(voxel, FaceIndex(normal), hitPos, cached)) {
+        // Shadowed faces end up at SHADOW_STRENGHT or below
+        if (cached.a > SHADOW_STRENGHT && distance(cameraPos, hitPos) < MAX_RAYTRACE_RANGE) {
+            vec3 viewDir = normalize(cameraPos - hitPos);
+            vec3 halfDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
+            color.rgb += spec * properties.a;
+        }
+        color.rgb = color.rgb * cached.a + baseColor * cached.rgb;
+    } else {
+    #endif
+    #if RAYTRACED_SHADOWS && BAKED_SUN_VISIBILITY
+        float light;
+        #if LOD_DISTANCE > 0
+        // LOD hits can land on an empty voxel of a solid cell, which has no baked faces
+        if (lodMaterial != 0.0 && VoxelAt(voxel) == 0.0)
+            light = SkyLight(voxel, lightDir);
+        else
+        #endif
+        light = (texelFetch(sunVisibility, voxel, 0).r & (1u << uint(FaceIndex(normal)))) != 0u ? 1.0 : SHADOW_STRENGHT;
+
+        if (light == 1.0 && distance(cameraPos, hitPos) < MAX_RAYTRACE_RANGE) {
+            vec3 viewDir = normalize(cameraPos - hitPos);
+            vec3 halfDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
+            color.rgb += spec * properties.a;
+        }
+        color.rgb *= light;
+    #elif RAYTRACED_SHADOWS
+        float light = 0.7;
+        if(distance(cameraPos,hitPos) < MAX_RAYTRACE_RANGE)
+        {
+            light = voxelShadow(startShadowPos, lightDir);
+
+            if (light == 1.0) {
+                vec3 viewDir = normalize(cameraPos - hitPos);
+                vec3 halfDir = normalize(lightDir + viewDir);
+                float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
+                color.rgb += spec * properties.a;
+            }
+        }
+        else{
+            light = SkyLight(voxel,lightDir);
+        }
+  
+        color.rgb *= light;
+
+    #endif
+
+    #if FLOOD_LIGHT
+        // Light of the empty voxel in front of the face, squared so the falloff reads as distance
+        vec4 flood = texelFetch(floodLight, clamp(voxel + ivec3(normal), ivec3(0), ivec3(voxelWorldSize - 1)), 0);
+        color.rgb *= mix(CAVE_AMBIENT, 1.0, flood.a * flood.a);
+        color.rgb += baseColor * flood.rgb * flood.rgb;
+    #endif
+
+    #if AMBIENT_OCCLUSION
+        // Texel centers sit on the voxel corners, the hit lies on a face between 4 of them
+        float occlusion = texture(ambientOcclusion, (hitPos + 0.5) / float(voxelWorldSize + 1)).r;
+        color.rgb *= 1.0 - AO_STRENGTH * occlusion;
+    #endif
+
+    #if SURFACE_CACHE
+    }
+    #endif
+
+    #if !FLOOD_LIGHT
+        // Without the flood fill emissive materials still light their own faces
+        color.rgb += baseColor * properties.rgb * properties.rgb;
+    #endif
+
+    #if CLUSTERED_LIGHTS
+        float viewDepth = -(viewMatrix * vec4(hitPos, 1.0)).z;
+        color.rgb += baseColor * ClusteredLight(hitPos, normal, viewDepth);
+    #endif
+
+    vec3 voxelHit = hitPos / voxelSize; // convert hit position to voxel space
+    float voxelDist = distance(voxelHit, cameraPos / voxelSize);
+
+    #if CAMERA_POINTLIGHT
+        if (voxelDist <= pointLightVoxelRadius) {
+            // Normalized direction to the camera
+            vec3 lightDirToCamera = normalize(cameraPos - hitPos);
+            // Simple linear falloff for performance
+            float attenuation = 1.0 - (voxelDist / pointLightVoxelRadius);
+            attenuation = max(attenuation, 0.0);
+            // Lambert term
+            float NdotL = max(dot(normal, lightDirToCamera), 0.0);
+            // Final point light contribution
+            vec3 pointLight = pointLightColor * pointLightIntensity * NdotL * attenuation;
+            color.rgb += baseColor * pointLight;
+        }
+    #endif
+    return color;
+}
+
+// Hit records, see VoxelRenderer.hpp. Pixels without a hit keep RECORD_HIT clear, RECORD_OUTSIDE
+// marks the ones whose ray missed the world box.
+const uint RECORD_HIT     = 0x80000000u;
+const uint RECORD_LOD     = 0x40000000u;
+const uint RECORD_OUTSIDE = 1u;
+const vec4 BACKGROUND_COLOR = vec4(0.529, 0.808, 0.922, 1.0);
+const vec4 OUTSIDE_COLOR    = vec4(0.5, 0.5, 0.5, 1.0);
+
+uvec2 EncodeHit(ivec3 voxel, int faceIndex, float t, bool lodHit) {
+    uvec3 v = uvec3(voxel);
+    uint bits = v.x | (v.y << 9u) | (v.z << 18u) | (uint(faceIndex) << 27u) | RECORD_HIT;
+    return uvec2(lodHit ? bits | RECORD_LOD : bits, floatBitsToUint(t));
+}
+
+// A pixel without a solid hit: the background, or for the visibility pass a record saying so
+void WriteMiss(uint record) {
+    #if RAYCAST_PASS == PASS_VISIBILITY
+        HitRecord = uvec2(record, 0u);
+    #else
+        FragColor = record == RECORD_OUTSIDE ? OUTSIDE_COLOR : BACKGROUND_COLOR;
+    #endif
+}
+
+#if RAYCAST_PASS == PASS_SHADE
+// The ray is rebuilt from the pixel, the hit point lies at the recorded distance along it
+void main() {
+    uvec2 record = texelFetch(hitRecords, ivec2(gl_FragCoord.xy), 0).rg;
+    if ((record.x & RECORD_HIT) == 0u) {
+        WriteMiss(record.x);
+        return;
+    }
+
+    ivec3 voxel = ivec3(record.x & 511u, (record.x >> 9u) & 511u, (record.x >> 18u) & 511u);
+    int faceIndex = int((record.x >> 27u) & 7u);
+    float t = uintBitsToFloat(record.y);
+    vec3 hitPos = cameraPos + generateRay(PixelUV()) * t;
+
+    float lodMaterial = 0.0;
+    #if LOD_DISTANCE > 0
+        if ((record.x & RECORD_LOD) != 0u) {
+            int lod = LodLevel(t);
+            lodMaterial = texelFetch(materialMips, voxel >> lod, lod - 1).r;
+        }
+    #endif
+    int material = MaterialOf(lodMaterial != 0.0 ? lodMaterial : VoxelAt(voxel));
+
+    vec4 textureColor = FaceTexel(material, faceIndex, hitPos - vec3(voxel) * voxelSize);
+    FragColor = ShadeHit(voxel, faceIndex, hitPos, textureColor, material, lodMaterial);
+}
+#else
 void main() {
     float STEP_SIZE = 1.0 / voxelWorldSize;
 
+    #if CHUNK_PROXIES
+        // No chunk with solid voxels in this pixel, nothing to march
+        float proxyStart = texelFetch(proxyStartTexture, PixelCoord(), 0).r;
+        if (proxyStart >= 1e29) {
+            gl_FragDepth = 1.0;
+            WriteMiss(0u);
+            HitDistance = 1e30;
+            #if RAYCAST_STEP_HEATMAP
+                FragColor = StepHeatmap(0);
+            #endif
+            return;
+        }
+    #endif
+
     vec3 rayOrigin = cameraPos;
-    vec3 rayDir = generateRay(TexCoords);
+    vec3 rayDir = generateRay(PixelUV());
 
     float tmin, tmax;
     if (!intersectBox(cameraPos / voxelWorldSize, rayDir / voxelWorldSize, tmin, tmax)) {
-        FragColor = vec4(0.5, 0.5, 0.5, 1.0); // Background color
+        WriteMiss(RECORD_OUTSIDE);
+        HitDistance = 1e30;
         return;
     }
 
     tmin = max(tmin, 0.0);
+    #if CHUNK_PROXIES
+        tmin = max(tmin, proxyStart);
+    #endif
+    #if COARSE_PREPASS
+        // Everything in front of the tile's start distance is known to be empty
+        tmin = max(tmin, texelFetch(rayStartTexture, PixelCoord() / PREPASS_TILE_SIZE, 0).r);
+    #endif
+    #if TEMPORAL_REPROJECTION
+        tmin = ReprojectedRayStart(rayOrigin, rayDir, tmin, tmax);
+    #endif
     float tCurrent = tmin;  // <-- Declare and initialize here
     
     vec3 pos = rayOrigin + rayDir * tCurrent;
@@ -220,69 +859,119 @@ void main() {
     vec3 tDelta = abs(voxelSize / rayDir);
     vec3 voxelWorldPos = vec3(voxel) * voxelSize;
 
+    // Measured from the ray origin like tCurrent, the ray may start past it
     vec3 tMax;
-    tMax.x = ((rayDir.x > 0.0 ? voxelWorldPos.x + voxelSize : voxelWorldPos.x) - pos.x) / rayDir.x;
-    tMax.y = ((rayDir.y > 0.0 ? voxelWorldPos.y + voxelSize : voxelWorldPos.y) - pos.y) / rayDir.y;
-    tMax.z = ((rayDir.z > 0.0 ? voxelWorldPos.z + voxelSize : voxelWorldPos.z) - pos.z) / rayDir.z;
+    tMax.x = ((rayDir.x > 0.0 ? voxelWorldPos.x + voxelSize : voxelWorldPos.x) - rayOrigin.x) / rayDir.x;
+    tMax.y = ((rayDir.y > 0.0 ? voxelWorldPos.y + voxelSize : voxelWorldPos.y) - rayOrigin.y) / rayDir.y;
+    tMax.z = ((rayDir.z > 0.0 ? voxelWorldPos.z + voxelSize : voxelWorldPos.z) - rayOrigin.z) / rayDir.z;
 
     int face = -1;
     int faceDir = 0;
     ivec3 lastVoxel = voxel;
     vec3 normal = vec3(0.0);
-    bool isCenter = abs(TexCoords.x - 0.5) < 0.001 && abs(TexCoords.y - 0.5) < 0.001;
-    ivec3 centerVoxel = ivec3(-1); // invalid initially
+    SolidCache solidCache = EMPTY_SOLID_CACHE;
+    float firstSolid = 1e30;
 
-    for (int i = 0; i < MAX_STEPS; ++i) {
+    int i = 0;
+    for (; i < MAX_STEPS; ++i) {
         vec3 texCoord = vec3(voxel) / float(voxelWorldSize);
         if (any(lessThan(texCoord, vec3(0.0))) || any(greaterThanEqual(texCoord, vec3(1.0))))
             break;
 
-        if (isCenter && centerVoxel.x < 0) {
-            // Save the first voxel the center ray is in
-            centerVoxel = voxel;
-        }
+        #if LOD_DISTANCE > 0
+            // Far away the ray walks majority material cells instead of voxels. Solid cells are hit
+            // as a whole, the empty space skips below only run for empty ones.
+            int lod = LodLevel(tCurrent);
+            float lodMaterial = lod > 0 ? texelFetch(materialMips, voxel >> lod, lod - 1).r : 0.0;
+            if (lodMaterial == 0.0) {
+        #endif
+
+        #if VOXEL_STORAGE == STORAGE_OCTREE
+            // Empty leaves are skipped whole, the next step restarts the descent from the root
+            int leafSize;
+            if (OctreeLeaf(voxel, leafSize) == 0u) {
+                ivec3 leafMin = voxel & ~(leafSize - 1);
+                if (!SkipEmptyBox(leafMin, leafMin + ivec3(leafSize - 1), rayOrigin, rayDir, rayStep, tmax,
+                                  voxel, lastVoxel, face, faceDir, tCurrent, pos, tMax))
+                    break;
+                continue;
+            }
+        #endif
+
+        #if EMPTY_SPACE_SKIPPING == SKIP_OCCUPANCY_PYRAMID
+            // Climb the occupancy pyramid while the cell around the voxel is empty,
+            // then jump straight to where the ray leaves the largest empty cell.
+            int emptyLevel = -1;
+            for (int level = 0; level < OCCUPANCY_LEVELS; ++level) {
+                if (texelFetch(occupancyTexture, voxel >> (level + 1), level).r != 0.0)
+                    break;
+                emptyLevel = level;
+            }
+
+            if (emptyLevel >= 0) {
+                int cellSize = 2 << emptyLevel;
+                ivec3 cellMin = (voxel >> (emptyLevel + 1)) * cellSize;
+                if (!SkipEmptyBox(cellMin, cellMin + ivec3(cellSize - 1), rayOrigin, rayDir, rayStep, tmax,
+                                  voxel, lastVoxel, face, faceDir, tCurrent, pos, tMax))
+                    break;
+                continue;
+            }
+        #elif EMPTY_SPACE_SKIPPING == SKIP_DISTANCE_FIELD
+            // Distance d means every voxel within d-1 of this one is empty
+            int emptyDistance = int(texelFetch(distanceField, voxel, 0).r * 255.0 + 0.5);
+            if (emptyDistance > 1) {
+                if (!SkipEmptyBox(voxel - ivec3(emptyDistance - 1), voxel + ivec3(emptyDistance - 1), rayOrigin, rayDir, rayStep, tmax,
+                                  voxel, lastVoxel, face, faceDir, tCurrent, pos, tMax))
+                    break;
+                continue;
+            }
+        #endif
+
+        #if VOXEL_STORAGE == STORAGE_BRICKMAP
+            // Empty bricks are known from the page table alone. Checked after the coarser skips above,
+            // so it only catches what they leave behind.
+            if (texelFetch(brickPageTable, voxel >> 3, 0).r == 0u) {
+                ivec3 brickMin = (voxel >> 3) * 8;
+                if (!SkipEmptyBox(brickMin, brickMin + ivec3(7), rayOrigin, rayDir, rayStep, tmax,
+                                  voxel, lastVoxel, face, faceDir, tCurrent, pos, tMax))
+                    break;
+                continue;
+            }
+        #endif
+
+        #if LOD_DISTANCE > 0
+                // Majority empty, even if some of its voxels are solid
+                if (lod > 0) {
+                    int cellSize = 1 << lod;
+                    ivec3 cellMin = (voxel >> lod) * cellSize;
+                    if (!SkipEmptyBox(cellMin, cellMin + ivec3(cellSize - 1), rayOrigin, rayDir, rayStep, tmax,
+                                      voxel, lastVoxel, face, faceDir, tCurrent, pos, tMax))
+                        break;
+                    continue;
+                }
+            }
+        #endif
 
-        float density = texture(voxelTexture, texCoord).r;
         // Hit detected
-        if (density != 0.0) {
+        #if LOD_DISTANCE > 0
+        if (lodMaterial != 0.0 || IsSolid(voxel, solidCache)) {
+            float density = lodMaterial != 0.0 ? lodMaterial : VoxelAt(voxel);
+        #else
+        if (IsSolid(voxel, solidCache)) {
+            float density = VoxelAt(voxel);
+        #endif
+            firstSolid = min(firstSolid, tCurrent);
 
             //Calculate depth to populate the depthbuffer
             vec3 hitPos = rayOrigin + rayDir * tCurrent;
             WriteDepth(hitPos);
 
-            voxelWorldPos = vec3(lastVoxel) * voxelSize;
-            vec3 localPos = pos - voxelWorldPos;
-            // vec3 local = clamp(localPos / voxelSize, 0.0, 1.0);
-            vec3 local = clamp(vec3(pos - voxelWorldPos) / voxelSize, 0.01, 1.0- 0.01);
-            vec2 voxelUV = vec2(0.0);
+            // lastVoxel only differs from voxel along the face axis, the tile coordinates come out the same
+            int faceIndex = face < 0 ? NO_FACE : face * 2 + (faceDir < 0 ? 0 : 1);
+            int material = MaterialOf(density);
+            vec3 hitLocal = pos - vec3(lastVoxel) * voxelSize;
 
-            if (face == 0) // X face
-            { 
-                // voxelUV = faceDir < 0 ? vec2(local.z, local.y) : vec2(1.0 - local.z, local.y);
-                voxelUV = vec2(local.z, local.y);
-                normal = vec3(-faceDir, 0.0, 0.0);  // X face
-            } 
-            else if (face == 1) // Y face
-            { 
-                voxelUV = vec2(local.x, local.z);
-                normal = vec3(0.0, -faceDir, 0.0);  // Y face
-            } 
-            else if (face == 2) // Z face
-            { 
-                voxelUV = vec2(local.x, local.y);
-                normal = vec3(0.0, 0.0, -faceDir);  // Z face
-            }
-
-            voxelUV = clamp(voxelUV, 0.0, 1.0);
-           
-            float voxelID = floor(density * 255.0);
-            float xOffset = (face == 1) ? 1.0 : 0.0; 
-            float yOffset = (tilesPerCol - 1 - voxelID) * VoxelScaleY;
-            voxelUV.x = voxelUV.x * VoxelScaleX + (xOffset * VoxelScaleX); 
-            voxelUV.y = voxelUV.y * VoxelScaleY + yOffset;
-            vec4 textureColor = texture(voxelSpriteSheet, voxelUV);
-
-            if (textureColor.a < 0.9) {
+            if (!FaceSolid(material, faceIndex, hitLocal)) {
                 // Step to next voxel and continue loop
                 lastVoxel = voxel;
 
@@ -313,56 +1002,23 @@ void main() {
                 continue; // skip lighting and move to the next voxel
             }
 
-            FragColor = textureColor;
-            vec3 baseColor = textureColor.rgb;
-
-
-            float voxelWorldSizeF = float(voxelWorldSize);
-            vec3 startShadowPos = (hitPos) / voxelWorldSizeF;
-            #if RAYTRACED_SHADOWS
-                float light = 0.7;
-                if(distance(cameraPos,hitPos) < MAX_RAYTRACE_RANGE)
-                {
-                    light = voxelShadow(startShadowPos, lightDir);
-
-                    if (light == 1.0) {
-                        vec3 viewDir = normalize(cameraPos - hitPos);
-                        vec3 halfDir = normalize(lightDir + viewDir);
-                        float spec = pow(max(dot(normal, halfDir), 0.0), 32.0);
-                        FragColor.rgb += spec * vec3(0.5,0.5,0.5);
-                    }
-                }
-                else{
-                    light = SkyLight(voxel,lightDir);
-                }
-          
-                FragColor.rgb *= light;
-
+            HitDistance = firstSolid;
+            #if LOD_DISTANCE > 0
+                bool lodHit = lodMaterial != 0.0;
+            #else
+                bool lodHit = false;
+                float lodMaterial = 0.0;
             #endif
 
-            vec3 voxelHit = hitPos / voxelSize; // convert hit position to voxel space
-            float voxelDist = distance(voxelHit, cameraPos / voxelSize);
-
-            #if CAMERA_POINTLIGHT
-                if (voxelDist <= pointLightVoxelRadius) {
-                    // Normalized direction to the camera
-                    vec3 lightDirToCamera = normalize(cameraPos - hitPos);
-                    // Simple linear falloff for performance
-                    float attenuation = 1.0 - (voxelDist / pointLightVoxelRadius);
-                    attenuation = max(attenuation, 0.0);
-                    // Lambert term
-                    float NdotL = max(dot(normal, lightDirToCamera), 0.0);
-                    // Final point light contribution
-                    vec3 pointLight = pointLightColor * pointLightIntensity * NdotL * attenuation;
-                    FragColor.rgb += baseColor * pointLight;
-                }
+            #if RAYCAST_PASS == PASS_VISIBILITY
+                HitRecord = EncodeHit(voxel, faceIndex, tCurrent, lodHit);
+            #else
+                vec4 textureColor = FaceTexel(material, faceIndex, hitLocal);
+                FragColor = ShadeHit(voxel, faceIndex, hitPos, textureColor, material, lodMaterial);
+                #if RAYCAST_STEP_HEATMAP
+                    FragColor = StepHeatmap(i + 1);
+                #endif
             #endif
-
-            if (isCenter) 
-            {    
-                FragColor = EncodeVoxel(voxel,normal);
-            }
-
             return;
         }
         lastVoxel = voxel;
@@ -395,5 +1051,11 @@ void main() {
     }
 
     gl_FragDepth = 1.0; // Far plane
-    FragColor = vec4(0.529, 0.808, 0.922, 1.0); // Background
-}
\ No newline at end of file
+    // Out of steps, only the part marched so far is known to be empty
+    HitDistance = i >= MAX_STEPS ? min(firstSolid, tCurrent) : firstSolid;
+    WriteMiss(0u);
+    #if RAYCAST_STEP_HEATMAP
+        FragColor = StepHeatmap(i);
+    #endif
+}
+#endif
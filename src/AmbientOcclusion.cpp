@@ -0,0 +1,104 @@
+#include "AmbientOcclusion.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+// Lattice point (x, y, z) is the corner shared by voxels x-1..x, y-1..y, z-1..z
+uint8_t AmbientOcclusion::CornerLevel(const std::vector<uint8_t> &voxels, int x, int y, int z) const
+{
+    int solid = 0;
+    for (int vz = std::max(z - 1, 0); vz <= std::min(z, mWorldSize - 1); vz++)
+        for (int vy = std::max(y - 1, 0); vy <= std::min(y, mWorldSize - 1); vy++)
+            for (int vx = std::max(x - 1, 0); vx <= std::min(x, mWorldSize - 1); vx++)
+                solid += voxels[vx + vy * (size_t)mWorldSize + vz * (size_t)mWorldSize * mWorldSize] != 0;
+
+    int level = std::min(std::max(solid - 4, 0), MAX_LEVEL);
+    return (uint8_t)(level * 255 / MAX_LEVEL);
+}
+
+void AmbientOcclusion::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mWorldSize = worldSize;
+    int size = LatticeSize();
+    mCorners.assign((size_t)size * size * size, 0);
+
+    // Slices never overlap, so the workers can write without locking
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        std::vector<int> columns(worldSize);
+        for (int z = next++; z < size; z = next++)
+            for (int y = 0; y < size; y++)
+            {
+                if (y == 0 || z == 0 || y == worldSize || z == worldSize)
+                {
+                    for (int x = 0; x < size; x++)
+                        mCorners[Index(x, y, z)] = CornerLevel(voxels, x, y, z);
+                    continue;
+                }
+
+                // Solid voxels of the 4 rows around this line of corners, per x, shared by the two corners beside it
+                const uint8_t* rows[4];
+                for (int r = 0; r < 4; r++)
+                    rows[r] = &voxels[(y - 1 + (r & 1)) * (size_t)worldSize + (z - 1 + (r >> 1)) * (size_t)worldSize * worldSize];
+                for (int x = 0; x < worldSize; x++)
+                    columns[x] = (rows[0][x] != 0) + (rows[1][x] != 0) + (rows[2][x] != 0) + (rows[3][x] != 0);
+
+                mCorners[Index(0, y, z)] = CornerLevel(voxels, 0, y, z);
+                mCorners[Index(worldSize, y, z)] = CornerLevel(voxels, worldSize, y, z);
+                for (int x = 1; x < worldSize; x++)
+                {
+                    int level = std::min(std::max(columns[x - 1] + columns[x] - 4, 0), MAX_LEVEL);
+                    mCorners[Index(x, y, z)] = (uint8_t)(level * 255 / MAX_LEVEL);
+                }
+            }
+    };
+    int workerCount = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<std::future<void>> workers;
+    for (int w = 1; w < workerCount; w++)
+        workers.push_back(std::async(std::launch::async, worker));
+    worker();
+    for (auto &w : workers)
+        w.get();
+
+    mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void AmbientOcclusion::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    for (int cz = z; cz <= z + 1; cz++)
+        for (int cy = y; cy <= y + 1; cy++)
+            for (int cx = x; cx <= x + 1; cx++)
+                mCorners[Index(cx, cy, cz)] = CornerLevel(voxels, cx, cy, cz);
+}
+
+void AmbientOcclusion::CreateTexture()
+{
+    int size = LatticeSize();
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_R8, size, size, size, GL_RED, mCorners.data());
+
+    // Linear filtering does the bilinear blend across the face
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void AmbientOcclusion::UploadCorners(int x, int y, int z)
+{
+    if (Texture == 0)
+        return;
+
+    uint8_t corners[8];
+    for (int i = 0; i < 8; i++)
+        corners[i] = mCorners[Index(x + (i & 1), y + ((i >> 1) & 1), z + (i >> 2))];
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, 2, 2, 2, GL_RED, corners);
+}
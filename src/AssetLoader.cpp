@@ -0,0 +1,109 @@
+#include "AssetLoader.h"
+#include "TextureCache.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+
+DecodedImage DecodeImage(const std::string &path, bool flipVertically, int desiredChannels)
+{
+    DecodedImage image;
+    image.path = path;
+
+    // The global flip flag is shared by every thread, use the per-thread one instead
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+
+    int fileChannels = 0;
+    image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height, &fileChannels, desiredChannels));
+    image.channels = desiredChannels != 0 ? desiredChannels : fileChannels;
+    return image;
+}
+
+std::future<DecodedImage> DecodeImageAsync(const ImageRequest &request, StartupTimeline* timeline)
+{
+    return std::async(std::launch::async, [request, timeline]() {
+        double begin = timeline ? timeline->Now() : 0.0;
+        double cpuBegin = StartupTimeline::ThreadCpuNow();
+        bool fromCache = false;
+        DecodedImage image = TextureCache::Load(request, &fromCache);
+        if (timeline)
+        {
+            std::string phase = (fromCache ? "cache hit " : "decode ") + request.path;
+            timeline->Record(phase, true, begin, timeline->Now(), StartupTimeline::ThreadCpuNow() - cpuBegin);
+        }
+        return image;
+    });
+}
+
+std::future<DecodedImage> DecodeImageAsync(const std::string &path, bool flipVertically, int desiredChannels,
+                                           StartupTimeline* timeline)
+{
+    ImageRequest request;
+    request.path = path;
+    request.flipVertically = flipVertically;
+    request.desiredChannels = desiredChannels;
+    return DecodeImageAsync(request, timeline);
+}
+
+StartupTimeline::StartupTimeline()
+    : mOrigin(std::chrono::steady_clock::now())
+{
+}
+
+double StartupTimeline::Now() const
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mOrigin).count();
+}
+
+double StartupTimeline::ThreadCpuNow()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    return 0.0;
+#endif
+}
+
+void StartupTimeline::Record(const std::string &phase, bool onWorker, double beginMs, double endMs, double cpuMs)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    bool isWait = phase.compare(0, 4, "wait") == 0;
+    if (cpuMs <= 0.0)
+        cpuMs = endMs - beginMs;
+    mPhases.push_back({phase, onWorker, isWait, beginMs, endMs, cpuMs});
+}
+
+void StartupTimeline::Print() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    std::vector<Phase> phases = mPhases;
+    std::sort(phases.begin(), phases.end(), [](const Phase &a, const Phase &b) { return a.beginMs < b.beginMs; });
+
+    // Serial estimate: the CPU time of every phase, minus the time the main thread only spent waiting.
+    // Using CPU time keeps the estimate honest when workers outnumber the cores and get time sliced.
+    double serialMs = 0.0;
+    double wallMs = 0.0;
+    for (const Phase &phase : phases)
+    {
+        if (!phase.isWait)
+            serialMs += phase.cpuMs;
+        wallMs = std::max(wallMs, phase.endMs);
+    }
+
+    std::cout << "\n------------------------<Startup timeline>-----------------------" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Phase &phase : phases)
+    {
+        std::cout << "  " << std::left << std::setw(6) << (phase.onWorker ? "worker" : "main") << std::right
+                  << " " << std::setw(8) << phase.beginMs << " -> " << std::setw(8) << phase.endMs
+                  << " ms (" << std::setw(7) << phase.endMs - phase.beginMs << " ms wall, "
+                  << std::setw(7) << phase.cpuMs << " ms cpu)  " << phase.name << std::endl;
+    }
+    std::cout << "  Wall clock: " << wallMs << " ms, serial estimate: " << serialMs << " ms, saved: "
+              << serialMs - wallMs << " ms" << std::endl;
+    std::cout << std::defaultfloat;
+    std::cout << "-----------------------------------------------------------------\n" << std::endl;
+}
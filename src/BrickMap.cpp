@@ -0,0 +1,340 @@
+#include "BrickMap.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <iostream>
+
+void BrickMap::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    mWorldSize = worldSize;
+    mBricksPerAxis = worldSize / BRICK_SIZE;
+    mPages.assign((size_t)mBricksPerAxis * mBricksPerAxis * mBricksPerAxis, 0);
+    mPool.clear();
+    mFreePool.clear();
+    mNonResident = 0;
+    mStats.emptyBricks = 0;
+    mStats.uniformBricks = 0;
+
+    std::array<uint8_t, BRICK_VOXELS> brickVoxels;
+    for (int bz = 0; bz < mBricksPerAxis; bz++)
+        for (int by = 0; by < mBricksPerAxis; by++)
+            for (int bx = 0; bx < mBricksPerAxis; bx++)
+            {
+                // Gather the brick and check whether it is a single material
+                bool uniform = true;
+                for (int z = 0; z < BRICK_SIZE; z++)
+                    for (int y = 0; y < BRICK_SIZE; y++)
+                    {
+                        size_t row = (bx * BRICK_SIZE) + (size_t)(by * BRICK_SIZE + y) * worldSize + (size_t)(bz * BRICK_SIZE + z) * worldSize * worldSize;
+                        std::copy_n(&voxels[row], BRICK_SIZE, &brickVoxels[LocalIndex(0, y, z)]);
+                    }
+                for (int i = 1; i < BRICK_VOXELS && uniform; i++)
+                    uniform = brickVoxels[i] == brickVoxels[0];
+
+                uint32_t brick = BrickIndex(bx, by, bz);
+                if (uniform)
+                {
+                    mPages[brick] = brickVoxels[0] != 0 ? (UNIFORM_BIT | brickVoxels[0]) : 0;
+                    (brickVoxels[0] != 0 ? mStats.uniformBricks : mStats.emptyBricks)++;
+                    continue;
+                }
+                uint32_t index = AllocateMixed(brick, 0);
+                mPool[index].voxels = brickVoxels;
+            }
+}
+
+uint8_t BrickMap::GetVoxel(int x, int y, int z) const
+{
+    uint32_t page = mPages[BrickIndex(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE)];
+    if (page == 0 || (page & UNIFORM_BIT))
+        return (uint8_t)(page & 0xFF);
+    return mPool[page - 1].voxels[LocalIndex(x, y, z)];
+}
+
+void BrickMap::SetVoxel(int x, int y, int z, uint8_t value)
+{
+    uint32_t brick = BrickIndex(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE);
+    uint32_t page = mPages[brick];
+
+    if (page == 0 || (page & UNIFORM_BIT))
+    {
+        uint8_t fill = (uint8_t)(page & 0xFF);
+        if (fill == value)
+            return;
+        // First different voxel, the brick needs its own storage now
+        (fill != 0 ? mStats.uniformBricks : mStats.emptyBricks)--;
+        uint32_t index = AllocateMixed(brick, fill);
+        mPool[index].voxels[LocalIndex(x, y, z)] = value;
+        return;
+    }
+
+    MixedBrick &mixed = mPool[page - 1];
+    mixed.voxels[LocalIndex(x, y, z)] = value;
+
+    // Collapse back into the page entry once the brick is a single material again
+    if (std::all_of(mixed.voxels.begin(), mixed.voxels.end(), [value](uint8_t v) { return v == value; }))
+    {
+        FreeMixed(page - 1);
+        mPages[brick] = value != 0 ? (UNIFORM_BIT | value) : 0;
+        (value != 0 ? mStats.uniformBricks : mStats.emptyBricks)++;
+    }
+}
+
+uint32_t BrickMap::AllocateMixed(uint32_t brick, uint8_t fill)
+{
+    uint32_t index;
+    if (!mFreePool.empty())
+    {
+        index = mFreePool.back();
+        mFreePool.pop_back();
+    }
+    else
+    {
+        index = (uint32_t)mPool.size();
+        mPool.emplace_back();
+    }
+
+    MixedBrick &mixed = mPool[index];
+    mixed.voxels.fill(fill);
+    mixed.brick = brick;
+    mixed.slot = -1;
+    mPages[brick] = index + 1;
+    mNonResident++;
+    return index;
+}
+
+void BrickMap::FreeMixed(uint32_t index)
+{
+    MixedBrick &mixed = mPool[index];
+    if (mixed.slot >= 0)
+    {
+        mSlotOwner[mixed.slot] = NONE;
+        mFreeSlots.push_back(mixed.slot);
+    }
+    else
+    {
+        mNonResident--;
+    }
+    mixed.brick = NONE;
+    mixed.slot = -1;
+    mFreePool.push_back(index);
+}
+
+uint8_t BrickMap::DominantMaterial(const MixedBrick &mixed)
+{
+    int counts[256] = {};
+    for (uint8_t v : mixed.voxels)
+        counts[v]++;
+    return (uint8_t)(std::max_element(counts, counts + 256) - counts);
+}
+
+glm::vec3 BrickMap::BrickCenter(uint32_t brick) const
+{
+    int bx = brick % mBricksPerAxis;
+    int by = (brick / mBricksPerAxis) % mBricksPerAxis;
+    int bz = brick / (mBricksPerAxis * mBricksPerAxis);
+    return (glm::vec3(bx, by, bz) + 0.5f) * (float)BRICK_SIZE;
+}
+
+uint32_t BrickMap::GpuPage(uint32_t brick) const
+{
+    uint32_t page = mPages[brick];
+    if (page == 0 || (page & UNIFORM_BIT))
+        return page;
+    const MixedBrick &mixed = mPool[page - 1];
+    return mixed.slot >= 0 ? (uint32_t)mixed.slot + 1 : (UNIFORM_BIT | DominantMaterial(mixed));
+}
+
+void BrickMap::UploadPage(uint32_t brick)
+{
+    int bx = brick % mBricksPerAxis;
+    int by = (brick / mBricksPerAxis) % mBricksPerAxis;
+    int bz = brick / (mBricksPerAxis * mBricksPerAxis);
+    uint32_t page = GpuPage(brick);
+
+    glBindTexture(GL_TEXTURE_3D, PageTable);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, bx, by, bz, 1, 1, 1, GL_RED_INTEGER, &page, GL_UNSIGNED_INT);
+}
+
+void BrickMap::Evict(int slot)
+{
+    MixedBrick &mixed = mPool[mSlotOwner[slot]];
+    mixed.slot = -1;
+    mSlotOwner[slot] = NONE;
+    mNonResident++;
+    mStats.evictions++;
+    UploadPage(mixed.brick);
+}
+
+// With force the furthest resident brick gives up its slot even when it is closer than this one
+bool BrickMap::MakeResident(uint32_t index, const glm::vec3 &cameraPos, bool force)
+{
+    MixedBrick &mixed = mPool[index];
+    int slot;
+    if (!mFreeSlots.empty())
+    {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    }
+    else
+    {
+        // Atlas is full, take the slot of the resident brick furthest away if it is further than this one
+        float distance = glm::distance(BrickCenter(mixed.brick), cameraPos);
+        int furthest = -1;
+        float furthestDistance = force ? -1.0f : distance + BRICK_SIZE; // Some slack so two bricks can't keep swapping
+        for (int s = 0; s < (int)mSlotOwner.size(); s++)
+        {
+            float residentDistance = glm::distance(BrickCenter(mPool[mSlotOwner[s]].brick), cameraPos);
+            if (residentDistance > furthestDistance)
+            {
+                furthest = s;
+                furthestDistance = residentDistance;
+            }
+        }
+        if (furthest < 0)
+            return false;
+        Evict(furthest);
+        slot = furthest;
+    }
+
+    mixed.slot = slot;
+    mSlotOwner[slot] = index;
+    mNonResident--;
+
+    int sx = slot % ATLAS_BRICKS_PER_AXIS;
+    int sy = (slot / ATLAS_BRICKS_PER_AXIS) % ATLAS_BRICKS_PER_AXIS;
+    int sz = slot / (ATLAS_BRICKS_PER_AXIS * ATLAS_BRICKS_PER_AXIS);
+    glBindTexture(GL_TEXTURE_3D, Atlas);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, sx * BRICK_SIZE, sy * BRICK_SIZE, sz * BRICK_SIZE,
+                                    BRICK_SIZE, BRICK_SIZE, BRICK_SIZE, GL_RED, mixed.voxels.data());
+    mStats.brickUploads++;
+    UploadPage(mixed.brick);
+    return true;
+}
+
+void BrickMap::CreateTextures()
+{
+    int atlasSize = ATLAS_BRICKS_PER_AXIS * BRICK_SIZE;
+    glGenTextures(1, &Atlas);
+    glBindTexture(GL_TEXTURE_3D, Atlas);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, atlasSize, atlasSize, atlasSize, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    int slots = ATLAS_BRICKS_PER_AXIS * ATLAS_BRICKS_PER_AXIS * ATLAS_BRICKS_PER_AXIS;
+    mSlotOwner.assign(slots, NONE);
+    mFreeSlots.clear();
+    for (int slot = slots - 1; slot >= 0; slot--)
+        mFreeSlots.push_back(slot);
+
+    // Fill the atlas in pool order, Stream() sorts things out by distance once we know the camera
+    std::vector<uint8_t> atlasVoxels((size_t)atlasSize * atlasSize * atlasSize, 0);
+    for (uint32_t index = 0; index < mPool.size() && !mFreeSlots.empty(); index++)
+    {
+        MixedBrick &mixed = mPool[index];
+        if (mixed.brick == NONE)
+            continue;
+        mixed.slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        mSlotOwner[mixed.slot] = index;
+        mNonResident--;
+
+        int sx = mixed.slot % ATLAS_BRICKS_PER_AXIS;
+        int sy = (mixed.slot / ATLAS_BRICKS_PER_AXIS) % ATLAS_BRICKS_PER_AXIS;
+        int sz = mixed.slot / (ATLAS_BRICKS_PER_AXIS * ATLAS_BRICKS_PER_AXIS);
+        for (int z = 0; z < BRICK_SIZE; z++)
+            for (int y = 0; y < BRICK_SIZE; y++)
+            {
+                size_t row = sx * BRICK_SIZE + (size_t)(sy * BRICK_SIZE + y) * atlasSize + (size_t)(sz * BRICK_SIZE + z) * atlasSize * atlasSize;
+                std::copy_n(&mixed.voxels[LocalIndex(0, y, z)], BRICK_SIZE, &atlasVoxels[row]);
+            }
+        mStats.brickUploads++;
+    }
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, atlasSize, atlasSize, atlasSize, GL_RED, atlasVoxels.data());
+
+    std::vector<uint32_t> gpuPages(mPages.size());
+    for (uint32_t brick = 0; brick < mPages.size(); brick++)
+        gpuPages[brick] = GpuPage(brick);
+
+    glGenTextures(1, &PageTable);
+    glBindTexture(GL_TEXTURE_3D, PageTable);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, mBricksPerAxis, mBricksPerAxis, mBricksPerAxis,
+                                 GL_RED_INTEGER, gpuPages.data(), GL_UNSIGNED_INT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    Stats stats = GetStats();
+    std::cout << "[BrickMap] " << stats.mixedBricks << " mixed / " << stats.uniformBricks << " uniform / " << stats.emptyBricks
+              << " empty bricks, " << (stats.pageTableBytes + stats.atlasBytes) / 1024 << " KB on the GPU (plus the dense volume: "
+              << stats.denseBytes / 1024 << " KB)" << std::endl;
+}
+
+void BrickMap::UploadVoxel(int x, int y, int z)
+{
+    if (PageTable == 0)
+        return;
+
+    uint32_t brick = BrickIndex(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE);
+    uint32_t page = mPages[brick];
+    if (page != 0 && !(page & UNIFORM_BIT))
+    {
+        MixedBrick &mixed = mPool[page - 1];
+        // Edits happen right in front of the player, they always deserve a slot. Making it resident
+        // uploads the whole brick and its page, if that fails the page shows the dominant material.
+        if (mixed.slot < 0)
+        {
+            if (MakeResident(page - 1, mLastCamera, true))
+                return;
+        }
+        else
+        {
+            int sx = mixed.slot % ATLAS_BRICKS_PER_AXIS;
+            int sy = (mixed.slot / ATLAS_BRICKS_PER_AXIS) % ATLAS_BRICKS_PER_AXIS;
+            int sz = mixed.slot / (ATLAS_BRICKS_PER_AXIS * ATLAS_BRICKS_PER_AXIS);
+            glBindTexture(GL_TEXTURE_3D, Atlas);
+            UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, sx * BRICK_SIZE + (x & 7), sy * BRICK_SIZE + (y & 7), sz * BRICK_SIZE + (z & 7),
+                                            1, 1, 1, GL_RED, &mixed.voxels[LocalIndex(x, y, z)]);
+        }
+    }
+    UploadPage(brick);
+}
+
+void BrickMap::Stream(const glm::vec3 &cameraPos)
+{
+    mLastCamera = cameraPos;
+    if (mNonResident == 0 || PageTable == 0)
+        return;
+
+    // Closest bricks that are still shown as their dominant material
+    std::vector<std::pair<float, uint32_t>> candidates;
+    for (uint32_t index = 0; index < mPool.size(); index++)
+    {
+        const MixedBrick &mixed = mPool[index];
+        if (mixed.brick != NONE && mixed.slot < 0)
+            candidates.push_back({ glm::distance(BrickCenter(mixed.brick), cameraPos), index });
+    }
+    size_t count = std::min<size_t>(candidates.size(), STREAM_BRICKS_PER_FRAME);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!MakeResident(candidates[i].second, cameraPos))
+            break; // Everything resident is closer
+    }
+}
+
+BrickMap::Stats BrickMap::GetStats() const
+{
+    Stats stats = mStats;
+    stats.bricks = mPages.size();
+    stats.mixedBricks = mPool.size() - mFreePool.size();
+    stats.residentBricks = mSlotOwner.size() - mFreeSlots.size();
+
+    int atlasSize = ATLAS_BRICKS_PER_AXIS * BRICK_SIZE;
+    stats.pageTableBytes = mPages.size() * sizeof(uint32_t);
+    stats.atlasBytes = (size_t)atlasSize * atlasSize * atlasSize;
+    stats.denseBytes = (size_t)mWorldSize * mWorldSize * mWorldSize;
+    return stats;
+}
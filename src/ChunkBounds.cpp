@@ -0,0 +1,62 @@
+#include "ChunkBounds.h"
+
+void ChunkBounds::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    mWorldSize = worldSize;
+    mChunksPerAxis = worldSize / CHUNK_SIZE;
+    mBoxes.assign((size_t)mChunksPerAxis * mChunksPerAxis * mChunksPerAxis, EmptyBox());
+
+    for (int z = 0; z < worldSize; z++)
+        for (int y = 0; y < worldSize; y++)
+            for (int x = 0; x < worldSize; x++)
+            {
+                if (voxels[x + y * worldSize + (size_t)z * worldSize * worldSize] == 0)
+                    continue;
+                Box &box = mBoxes[ChunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE)];
+                glm::ivec3 voxel(x, y, z);
+                box.min = glm::min(box.min, voxel);
+                box.max = glm::max(box.max, voxel);
+            }
+}
+
+void ChunkBounds::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    int cx = x / CHUNK_SIZE, cy = y / CHUNK_SIZE, cz = z / CHUNK_SIZE;
+    Box &box = mBoxes[ChunkIndex(cx, cy, cz)];
+    glm::ivec3 voxel(x, y, z);
+
+    if (voxels[x + y * mWorldSize + (size_t)z * mWorldSize * mWorldSize] != 0) {
+        box.min = glm::min(box.min, voxel);
+        box.max = glm::max(box.max, voxel);
+        return;
+    }
+
+    // Clearing a voxel can only shrink the box if it lay on one of its faces
+    bool onFace = glm::any(glm::equal(voxel, box.min)) || glm::any(glm::equal(voxel, box.max));
+    if (!box.IsEmpty() && onFace)
+        Refit(voxels, cx, cy, cz);
+}
+
+void ChunkBounds::Refit(const std::vector<uint8_t> &voxels, int cx, int cy, int cz)
+{
+    Box box = EmptyBox();
+    for (int z = cz * CHUNK_SIZE; z < (cz + 1) * CHUNK_SIZE; z++)
+        for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++)
+            for (int x = cx * CHUNK_SIZE; x < (cx + 1) * CHUNK_SIZE; x++)
+            {
+                if (voxels[x + y * mWorldSize + (size_t)z * mWorldSize * mWorldSize] == 0)
+                    continue;
+                glm::ivec3 voxel(x, y, z);
+                box.min = glm::min(box.min, voxel);
+                box.max = glm::max(box.max, voxel);
+            }
+    mBoxes[ChunkIndex(cx, cy, cz)] = box;
+}
+
+size_t ChunkBounds::GetNonEmptyCount() const
+{
+    size_t count = 0;
+    for (const Box &box : mBoxes)
+        count += box.IsEmpty() ? 0 : 1;
+    return count;
+}
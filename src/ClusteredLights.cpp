@@ -0,0 +1,281 @@
+#include "ClusteredLights.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTS_SSE2 1
+#else
+#define CLUSTERED_LIGHTS_SSE2 0
+#endif
+
+static_assert(ClusteredLights::LIGHT_BASE % 4 == 0, "Light records have to start on a texel");
+
+static uint32_t FloatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// A view space point is right of the tile boundary at NDC x = a when P00 * x + a * z > 0, the
+// normalized plane turns that into a signed distance to compare against light radii
+void ClusteredLights::SetupPlanes(const glm::mat4 &projection, float nearPlane, float farPlane)
+{
+    for (int i = 0; i <= GRID_X; i++)
+    {
+        float a = -1.0f + 2.0f * i / GRID_X;
+        float length = std::sqrt(projection[0][0] * projection[0][0] + a * a);
+        mPlaneX[i][0] = projection[0][0] / length;
+        mPlaneX[i][1] = a / length;
+    }
+    for (int i = 0; i <= GRID_Y; i++)
+    {
+        float b = -1.0f + 2.0f * i / GRID_Y;
+        float length = std::sqrt(projection[1][1] * projection[1][1] + b * b);
+        mPlaneY[i][0] = projection[1][1] / length;
+        mPlaneY[i][1] = b / length;
+    }
+
+    float logRatio = std::log(farPlane / nearPlane);
+    for (int k = 0; k <= GRID_Z; k++)
+        mSliceDepth[k] = nearPlane * std::exp(logRatio * k / GRID_Z);
+    mDepthSliceParams = glm::vec2(GRID_Z / logRatio, -GRID_Z * std::log(nearPlane) / logRatio);
+}
+
+// Outer planes cull, inner planes count: a light entirely right of i inner boundaries starts in
+// tile i, entirely left of j of them ends j tiles before the last one
+void ClusteredLights::BinRanges(size_t first)
+{
+#if CLUSTERED_LIGHTS_SSE2
+    __m128 x = _mm_loadu_ps(&mViewX[first]);
+    __m128 y = _mm_loadu_ps(&mViewY[first]);
+    __m128 z = _mm_loadu_ps(&mViewZ[first]);
+    __m128 r = _mm_loadu_ps(&mRadius[first]);
+    __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+    __m128 culled = _mm_setzero_ps();
+
+    // Compare masks are all ones, subtracting them counts
+    __m128i beyondMin[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    __m128i beyondMax[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    const int gridSize[2] = { GRID_X, GRID_Y };
+    for (int axis = 0; axis < 2; axis++)
+    {
+        __m128 across = axis == 0 ? x : y;
+        for (int i = 0; i <= gridSize[axis]; i++)
+        {
+            const float* plane = axis == 0 ? mPlaneX[i] : mPlaneY[i];
+            __m128 d = _mm_add_ps(_mm_mul_ps(across, _mm_set1_ps(plane[0])), _mm_mul_ps(z, _mm_set1_ps(plane[1])));
+            __m128 after = _mm_cmpgt_ps(d, r);
+            __m128 before = _mm_cmplt_ps(d, negR);
+            if (i == 0)
+                culled = _mm_or_ps(culled, before);
+            else if (i == gridSize[axis])
+                culled = _mm_or_ps(culled, after);
+            else
+            {
+                beyondMin[axis] = _mm_sub_epi32(beyondMin[axis], _mm_castps_si128(after));
+                beyondMax[axis] = _mm_sub_epi32(beyondMax[axis], _mm_castps_si128(before));
+            }
+        }
+    }
+
+    __m128 depth = _mm_sub_ps(_mm_setzero_ps(), z);
+    __m128 nearest = _mm_sub_ps(depth, r);
+    __m128 farthest = _mm_add_ps(depth, r);
+    culled = _mm_or_ps(culled, _mm_cmplt_ps(farthest, _mm_set1_ps(mSliceDepth[0])));
+    culled = _mm_or_ps(culled, _mm_cmpgt_ps(nearest, _mm_set1_ps(mSliceDepth[GRID_Z])));
+    __m128i sliceMin = _mm_setzero_si128();
+    __m128i sliceMax = _mm_setzero_si128();
+    for (int k = 1; k < GRID_Z; k++)
+    {
+        __m128 start = _mm_set1_ps(mSliceDepth[k]);
+        sliceMin = _mm_sub_epi32(sliceMin, _mm_castps_si128(_mm_cmpge_ps(nearest, start)));
+        sliceMax = _mm_sub_epi32(sliceMax, _mm_castps_si128(_mm_cmpge_ps(farthest, start)));
+    }
+
+    alignas(16) int32_t minX[4], maxX[4], minY[4], maxY[4], minZ[4], maxZ[4];
+    _mm_store_si128((__m128i*)minX, beyondMin[0]);
+    _mm_store_si128((__m128i*)maxX, beyondMax[0]);
+    _mm_store_si128((__m128i*)minY, beyondMin[1]);
+    _mm_store_si128((__m128i*)maxY, beyondMax[1]);
+    _mm_store_si128((__m128i*)minZ, sliceMin);
+    _mm_store_si128((__m128i*)maxZ, sliceMax);
+    int culledMask = _mm_movemask_ps(culled);
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        Range &range = mRanges[first + lane];
+        range.visible = (culledMask & (1 << lane)) == 0;
+        range.min = glm::ivec3(minX[lane], minY[lane], minZ[lane]);
+        range.max = glm::ivec3(GRID_X - 1 - maxX[lane], GRID_Y - 1 - maxY[lane], maxZ[lane]);
+    }
+#else
+    for (size_t light = first; light < first + 4; light++)
+    {
+        float r = mRadius[light];
+        bool culled = false;
+        glm::ivec3 beyondMin(0), beyondMax(0);
+        const int gridSize[2] = { GRID_X, GRID_Y };
+        for (int axis = 0; axis < 2; axis++)
+        {
+            float across = axis == 0 ? mViewX[light] : mViewY[light];
+            for (int i = 0; i <= gridSize[axis]; i++)
+            {
+                const float* plane = axis == 0 ? mPlaneX[i] : mPlaneY[i];
+                float d = across * plane[0] + mViewZ[light] * plane[1];
+                if (i == 0)
+                    culled |= d < -r;
+                else if (i == gridSize[axis])
+                    culled |= d > r;
+                else
+                {
+                    beyondMin[axis] += d > r;
+                    beyondMax[axis] += d < -r;
+                }
+            }
+        }
+
+        float nearest = -mViewZ[light] - r;
+        float farthest = -mViewZ[light] + r;
+        culled |= farthest < mSliceDepth[0] || nearest > mSliceDepth[GRID_Z];
+        for (int k = 1; k < GRID_Z; k++)
+        {
+            beyondMin.z += nearest >= mSliceDepth[k];
+            beyondMax.z += farthest >= mSliceDepth[k];
+        }
+
+        Range &range = mRanges[light];
+        range.visible = !culled;
+        range.min = glm::ivec3(beyondMin.x, beyondMin.y, beyondMin.z);
+        range.max = glm::ivec3(GRID_X - 1 - beyondMax.x, GRID_Y - 1 - beyondMax.y, beyondMax.z);
+    }
+#endif
+}
+
+void ClusteredLights::Bin(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection,
+                          float nearPlane, float farPlane)
+{
+    auto start = std::chrono::steady_clock::now();
+    SetupPlanes(projection, nearPlane, farPlane);
+
+    // Padding sits behind the camera with no radius, so it is always culled
+    size_t padded = (lights.size() + 3) & ~(size_t)3;
+    mViewX.assign(padded, 0.0f);
+    mViewY.assign(padded, 0.0f);
+    mViewZ.assign(padded, 1.0f);
+    mRadius.assign(padded, 0.0f);
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        glm::vec4 p = view * glm::vec4(lights[i].position, 1.0f);
+        mViewX[i] = p.x;
+        mViewY[i] = p.y;
+        mViewZ[i] = p.z;
+        mRadius[i] = lights[i].radius;
+    }
+
+    mRanges.resize(padded);
+    for (size_t first = 0; first < padded; first += 4)
+        BinRanges(first);
+
+    // Count per froxel, then a prefix sum gives every froxel its slice of the index list
+    mStats = Stats();
+    mStats.lights = lights.size();
+    mCounts.assign(CLUSTER_COUNT, 0);
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const Range &range = mRanges[i];
+        if (!range.visible)
+            continue;
+        mStats.visibleLights++;
+        for (int z = range.min.z; z <= range.max.z; z++)
+            for (int y = range.min.y; y <= range.max.y; y++)
+                for (int x = range.min.x; x <= range.max.x; x++)
+                    mCounts[x + y * GRID_X + z * GRID_X * GRID_Y]++;
+    }
+
+    size_t indexBase = LIGHT_BASE + 8 * lights.size();
+    size_t capacity = mMaxUints > indexBase ? mMaxUints - indexBase : 0;
+    mData.resize(indexBase);
+    uint32_t next = 0;
+    for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+    {
+        uint32_t count = std::min<uint32_t>(mCounts[cluster], (uint32_t)(capacity > next ? capacity - next : 0));
+        mStats.droppedIndices += mCounts[cluster] - count;
+        mStats.maxPerCluster = std::max(mStats.maxPerCluster, (int)mCounts[cluster]);
+        mData[2 * cluster] = (uint32_t)indexBase + next;
+        mData[2 * cluster + 1] = count;
+        mCounts[cluster] = next; // Becomes the write cursor
+        next += count;
+    }
+    mStats.indices = next;
+
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        uint32_t* record = &mData[LIGHT_BASE + 8 * i];
+        record[0] = FloatBits(lights[i].position.x);
+        record[1] = FloatBits(lights[i].position.y);
+        record[2] = FloatBits(lights[i].position.z);
+        record[3] = FloatBits(lights[i].radius);
+        record[4] = FloatBits(lights[i].color.r);
+        record[5] = FloatBits(lights[i].color.g);
+        record[6] = FloatBits(lights[i].color.b);
+        record[7] = 0;
+    }
+
+    // Padded to whole texels
+    mData.resize((indexBase + next + 3) & ~(size_t)3, 0);
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const Range &range = mRanges[i];
+        if (!range.visible)
+            continue;
+        uint32_t texel = (uint32_t)((LIGHT_BASE + 8 * i) / 4);
+        for (int z = range.min.z; z <= range.max.z; z++)
+            for (int y = range.min.y; y <= range.max.y; y++)
+                for (int x = range.min.x; x <= range.max.x; x++)
+                {
+                    int cluster = x + y * GRID_X + z * GRID_X * GRID_Y;
+                    uint32_t &cursor = mCounts[cluster];
+                    if (cursor < mData[2 * cluster] - indexBase + mData[2 * cluster + 1])
+                        mData[indexBase + cursor++] = texel;
+                }
+    }
+
+    mStats.binMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ClusteredLights::CreateBuffer()
+{
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    mMaxUints = (size_t)maxTexels * 4;
+    if (mMaxUints < (size_t)LIGHT_BASE + 8)
+        std::cout << "[ClusteredLights] Warning: GL_MAX_TEXTURE_BUFFER_SIZE (" << maxTexels << ") is too small for the froxel grid" << std::endl;
+
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, mBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, LIGHT_BASE * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_BUFFER, Texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, mBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Rewritten every frame, orphaning lets the driver hand out fresh storage instead of waiting
+void ClusteredLights::Upload()
+{
+    if (mBuffer == 0 || mData.empty())
+        return;
+
+    size_t uints = std::min(mData.size(), mMaxUints);
+    glBindBuffer(GL_TEXTURE_BUFFER, mBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, uints * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, uints * sizeof(uint32_t), mData.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,141 @@
+#include "DistanceField.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Two raster passes over the 26-neighbourhood give the exact Chebyshev distance.
+// Voxels outside the box are read but not written, so they act as fixed seeds.
+void DistanceField::Propagate(const int min[3], const int max[3])
+{
+    // The half of the neighbourhood that precedes a voxel in raster order, as index offsets
+    long offsets[13];
+    int count = 0;
+    for (int dz = -1; dz <= 0; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+                if (dz < 0 || (dz == 0 && dy < 0) || (dz == 0 && dy == 0 && dx < 0))
+                    offsets[count++] = dx + dy * (long)mWorldSize + dz * (long)mWorldSize * mWorldSize;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        // Forward pass reads the 13 neighbours already visited, backward pass mirrors them
+        int dir = pass == 0 ? 1 : -1;
+        int zBegin = pass == 0 ? min[2] : max[2], zEnd = pass == 0 ? max[2] + 1 : min[2] - 1;
+        int yBegin = pass == 0 ? min[1] : max[1], yEnd = pass == 0 ? max[1] + 1 : min[1] - 1;
+        int xBegin = pass == 0 ? min[0] : max[0], xEnd = pass == 0 ? max[0] + 1 : min[0] - 1;
+
+        for (int z = zBegin; z != zEnd; z += dir)
+            for (int y = yBegin; y != yEnd; y += dir)
+            {
+                bool rowInterior = y > 0 && z > 0 && y < mWorldSize - 1 && z < mWorldSize - 1;
+                for (int x = xBegin; x != xEnd; x += dir)
+                {
+                    size_t index = Index(x, y, z);
+                    int best = mDistances[index];
+                    if (best <= 1)
+                        continue;
+
+                    if (rowInterior && x > 0 && x < mWorldSize - 1)
+                    {
+                        for (int i = 0; i < 13; i++)
+                            best = std::min(best, mDistances[index + offsets[i] * dir] + 1);
+                    }
+                    else
+                    {
+                        // World border, bounds check every neighbour
+                        for (int dz = -1; dz <= 1; dz++)
+                            for (int dy = -1; dy <= 1; dy++)
+                                for (int dx = -1; dx <= 1; dx++)
+                                {
+                                    bool precedes = dz < 0 || (dz == 0 && dy < 0) || (dz == 0 && dy == 0 && dx < 0);
+                                    int nx = x + dx * dir, ny = y + dy * dir, nz = z + dz * dir;
+                                    if (!precedes || nx < 0 || ny < 0 || nz < 0 || nx >= mWorldSize || ny >= mWorldSize || nz >= mWorldSize)
+                                        continue;
+                                    best = std::min(best, mDistances[Index(nx, ny, nz)] + 1);
+                                }
+                    }
+                    mDistances[index] = (uint8_t)best;
+                }
+            }
+    }
+}
+
+void DistanceField::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mWorldSize = worldSize;
+    mDistances.resize(voxels.size());
+    for (size_t i = 0; i < voxels.size(); i++)
+        mDistances[i] = voxels[i] != 0 ? 0 : MAX_DISTANCE;
+
+    int min[3] = { 0, 0, 0 };
+    int max[3] = { worldSize - 1, worldSize - 1, worldSize - 1 };
+    Propagate(min, max);
+
+    mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[DistanceField] Baked " << worldSize << "^3 field in " << mBuildMs << " ms" << std::endl;
+}
+
+void DistanceField::RegionAround(int x, int y, int z, int min[3], int max[3]) const
+{
+    int center[3] = { x, y, z };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        min[axis] = std::max(center[axis] - MAX_DISTANCE, 0);
+        max[axis] = std::min(center[axis] + MAX_DISTANCE, mWorldSize - 1);
+    }
+}
+
+// Only voxels closer than MAX_DISTANCE to the edit can change. Reset them and let the
+// surrounding, still valid, distances flow back in. Works for both adding and removing.
+void DistanceField::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    int min[3], max[3];
+    RegionAround(x, y, z, min, max);
+    for (int vz = min[2]; vz <= max[2]; vz++)
+        for (int vy = min[1]; vy <= max[1]; vy++)
+            for (int vx = min[0]; vx <= max[0]; vx++)
+            {
+                size_t index = Index(vx, vy, vz);
+                mDistances[index] = voxels[index] != 0 ? 0 : MAX_DISTANCE;
+            }
+    Propagate(min, max);
+
+    mLastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void DistanceField::CreateTexture()
+{
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_R8, mWorldSize, mWorldSize, mWorldSize, GL_RED, mDistances.data());
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void DistanceField::UploadRegion(int x, int y, int z)
+{
+    if (Texture == 0)
+        return;
+
+    int min[3], max[3];
+    RegionAround(x, y, z, min, max);
+    int width = max[0] - min[0] + 1, height = max[1] - min[1] + 1, depth = max[2] - min[2] + 1;
+
+    mStaging.resize((size_t)width * height * depth);
+    uint8_t* dst = mStaging.data();
+    for (int vz = min[2]; vz <= max[2]; vz++)
+        for (int vy = min[1]; vy <= max[1]; vy++, dst += width)
+            std::copy_n(&mDistances[Index(min[0], vy, vz)], width, dst);
+
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, min[0], min[1], min[2], width, height, depth, GL_RED, mStaging.data());
+}
@@ -0,0 +1,363 @@
+#include "FloodLight.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <utility>
+
+// Same order as VoxelTerrain::faceNormal, index 3 is straight down
+static const glm::ivec3 NEIGHBOURS[6] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+static const int DOWN = 3;
+
+glm::ivec3 FloodLight::Emission(uint8_t material)
+{
+    switch (material) {
+        case 2: return { 15, 10, 4 };  // Amber rock
+        case 3: return { 4, 15, 8 };   // Green crystal
+    }
+    return glm::ivec3(0);
+}
+
+uint16_t FloodLight::EmittedLight(uint8_t material)
+{
+    glm::ivec3 emission = Emission(material);
+    return (uint16_t)((emission.r << CHANNEL_RED) | (emission.g << CHANNEL_GREEN) | (emission.b << CHANNEL_BLUE));
+}
+
+// The light a neighbour receives, one level less on every channel
+uint16_t FloodLight::Spread(uint16_t light, bool down)
+{
+    uint16_t spread = 0;
+    for (int channel : { CHANNEL_SKY, CHANNEL_BLUE, CHANNEL_GREEN, CHANNEL_RED })
+    {
+        int level = Level(light, channel);
+        if (!(channel == CHANNEL_SKY && down && level == MAX_LEVEL))
+            level = std::max(level - 1, 0);
+        spread |= level << channel;
+    }
+    return spread;
+}
+
+uint16_t FloodLight::Max(uint16_t a, uint16_t b)
+{
+    uint16_t result = 0;
+    for (int channel : { CHANNEL_SKY, CHANNEL_BLUE, CHANNEL_GREEN, CHANNEL_RED })
+        result |= std::max(Level(a, channel), Level(b, channel)) << channel;
+    return result;
+}
+
+glm::ivec3 FloodLight::Position(size_t index) const
+{
+    return glm::ivec3(index % mWorldSize, (index / mWorldSize) % mWorldSize, index / ((size_t)mWorldSize * mWorldSize));
+}
+
+int FloodLight::ChunkOf(const glm::ivec3 &voxel) const
+{
+    glm::ivec3 chunk = voxel / CHUNK_SIZE;
+    return chunk.x + chunk.y * mChunksPerAxis + chunk.z * mChunksPerAxis * mChunksPerAxis;
+}
+
+void FloodLight::Touch(size_t index)
+{
+    glm::ivec3 voxel = Position(index);
+    mDirtyMin = mDirty ? glm::min(mDirtyMin, voxel) : voxel;
+    mDirtyMax = mDirty ? glm::max(mDirtyMax, voxel) : voxel;
+    mDirty = true;
+    mTouched++;
+}
+
+// Breadth first fill inside one chunk. Light leaving the chunk is handed to its neighbour through
+// `outgoing`, so workers only ever write voxels of their own chunk.
+void FloodLight::PropagateChunk(const std::vector<uint8_t> &voxels, int chunk, std::vector<uint32_t> &queue,
+                                std::vector<std::vector<Incoming>> &outgoing)
+{
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        uint32_t index = queue[head];
+        glm::ivec3 voxel = Position(index);
+        uint16_t light = mLight[index];
+        for (int d = 0; d < 6; d++)
+        {
+            glm::ivec3 neighbour = voxel + NEIGHBOURS[d];
+            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(mWorldSize))))
+                continue;
+            uint32_t neighbourIndex = (uint32_t)Index(neighbour.x, neighbour.y, neighbour.z);
+            uint16_t spread = Spread(light, d == DOWN);
+            if (voxels[neighbourIndex] != 0 || spread == 0)
+                continue;
+
+            int neighbourChunk = ChunkOf(neighbour);
+            if (neighbourChunk != chunk)
+            {
+                outgoing[neighbourChunk].push_back(Incoming{ neighbourIndex, spread });
+                continue;
+            }
+            uint16_t merged = Max(mLight[neighbourIndex], spread);
+            if (merged != mLight[neighbourIndex])
+            {
+                mLight[neighbourIndex] = merged;
+                queue.push_back(neighbourIndex);
+            }
+        }
+    }
+    queue.clear();
+}
+
+void FloodLight::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mWorldSize = worldSize;
+    mChunksPerAxis = (worldSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int chunkCount = mChunksPerAxis * mChunksPerAxis * mChunksPerAxis;
+    mLight.assign((size_t)worldSize * worldSize * worldSize, 0);
+
+    int workerCount = std::max(1, std::min((int)std::thread::hardware_concurrency(), chunkCount));
+    auto runWorkers = [workerCount](const auto &worker) {
+        std::vector<std::future<void>> workers;
+        for (int w = 1; w < workerCount; w++)
+            workers.push_back(std::async(std::launch::async, worker, w));
+        worker(0);
+        for (auto &w : workers)
+            w.get();
+    };
+
+    // Sources: open columns get full sky light down to the first solid voxel, emitters their emission
+    std::atomic<int> nextSlice(0);
+    runWorkers([&](int) {
+        for (int z = nextSlice++; z < worldSize; z = nextSlice++)
+            for (int x = 0; x < worldSize; x++)
+            {
+                bool open = true;
+                for (int y = worldSize - 1; y >= 0; y--)
+                {
+                    size_t index = Index(x, y, z);
+                    open = open && voxels[index] == 0;
+                    mLight[index] = open ? (uint16_t)(MAX_LEVEL << CHANNEL_SKY) : EmittedLight(voxels[index]);
+                }
+            }
+    });
+
+    // Seeds: sources that still have something to give to an empty neighbour
+    std::vector<std::vector<uint32_t>> queues(chunkCount);
+    std::atomic<int> nextChunk(0);
+    runWorkers([&](int) {
+        for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+        {
+            glm::ivec3 chunkMin = glm::ivec3(chunk % mChunksPerAxis, (chunk / mChunksPerAxis) % mChunksPerAxis,
+                                             chunk / (mChunksPerAxis * mChunksPerAxis)) * CHUNK_SIZE;
+            glm::ivec3 chunkMax = glm::min(chunkMin + CHUNK_SIZE, glm::ivec3(worldSize));
+            for (int z = chunkMin.z; z < chunkMax.z; z++)
+                for (int y = chunkMin.y; y < chunkMax.y; y++)
+                    for (int x = chunkMin.x; x < chunkMax.x; x++)
+                    {
+                        size_t index = Index(x, y, z);
+                        if (mLight[index] == 0)
+                            continue;
+                        for (int d = 0; d < 6; d++)
+                        {
+                            glm::ivec3 neighbour = glm::ivec3(x, y, z) + NEIGHBOURS[d];
+                            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(worldSize))))
+                                continue;
+                            size_t neighbourIndex = Index(neighbour.x, neighbour.y, neighbour.z);
+                            // Spread light never exceeds its source, so equally lit neighbours have nothing to gain
+                            if (mLight[neighbourIndex] == mLight[index])
+                                continue;
+                            if (voxels[neighbourIndex] == 0 && Max(mLight[neighbourIndex], Spread(mLight[index], d == DOWN)) != mLight[neighbourIndex])
+                            {
+                                queues[chunk].push_back((uint32_t)index);
+                                break;
+                            }
+                        }
+                    }
+        }
+    });
+
+    // Fill every chunk in parallel, then pass what crossed chunk borders on until nothing is left.
+    // Light only ever grows, so the order chunks see it in does not matter.
+    std::vector<std::vector<Incoming>> inbox(chunkCount);
+    for (;;)
+    {
+        std::vector<int> active;
+        for (int chunk = 0; chunk < chunkCount; chunk++)
+            if (!queues[chunk].empty() || !inbox[chunk].empty())
+                active.push_back(chunk);
+        if (active.empty())
+            break;
+
+        std::vector<std::vector<std::vector<Incoming>>> outgoing(workerCount, std::vector<std::vector<Incoming>>(chunkCount));
+        std::atomic<size_t> next(0);
+        runWorkers([&](int w) {
+            for (size_t a = next++; a < active.size(); a = next++)
+            {
+                int chunk = active[a];
+                for (const Incoming &incoming : inbox[chunk])
+                {
+                    uint16_t merged = Max(mLight[incoming.index], incoming.light);
+                    if (merged != mLight[incoming.index])
+                    {
+                        mLight[incoming.index] = merged;
+                        queues[chunk].push_back(incoming.index);
+                    }
+                }
+                inbox[chunk].clear();
+                PropagateChunk(voxels, chunk, queues[chunk], outgoing[w]);
+            }
+        });
+        for (auto &lists : outgoing)
+            for (int chunk = 0; chunk < chunkCount; chunk++)
+                inbox[chunk].insert(inbox[chunk].end(), lists[chunk].begin(), lists[chunk].end());
+    }
+
+    mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void FloodLight::Propagate(const std::vector<uint8_t> &voxels, std::vector<uint32_t> &queue)
+{
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        uint32_t index = queue[head];
+        glm::ivec3 voxel = Position(index);
+        uint16_t light = mLight[index];
+        for (int d = 0; d < 6; d++)
+        {
+            glm::ivec3 neighbour = voxel + NEIGHBOURS[d];
+            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(mWorldSize))))
+                continue;
+            uint32_t neighbourIndex = (uint32_t)Index(neighbour.x, neighbour.y, neighbour.z);
+            if (voxels[neighbourIndex] != 0)
+                continue;
+            uint16_t merged = Max(mLight[neighbourIndex], Spread(light, d == DOWN));
+            if (merged != mLight[neighbourIndex])
+            {
+                mLight[neighbourIndex] = merged;
+                Touch(neighbourIndex);
+                queue.push_back(neighbourIndex);
+            }
+        }
+    }
+}
+
+// Clears one channel of everything lit through `start`. Neighbours holding light from elsewhere
+// (brighter, emitters, or full sky light not coming from above) are collected to flood back in.
+void FloodLight::Remove(const std::vector<uint8_t> &voxels, size_t start, int channel, std::vector<uint32_t> &relight)
+{
+    int startLevel = Level(mLight[start], channel);
+    if (startLevel == 0)
+        return;
+
+    std::vector<std::pair<uint32_t, int>> queue;
+    mLight[start] &= ~(0xF << channel);
+    Touch(start);
+    queue.emplace_back((uint32_t)start, startLevel);
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        glm::ivec3 voxel = Position(queue[head].first);
+        int level = queue[head].second;
+        for (int d = 0; d < 6; d++)
+        {
+            glm::ivec3 neighbour = voxel + NEIGHBOURS[d];
+            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(mWorldSize))))
+                continue;
+            uint32_t neighbourIndex = (uint32_t)Index(neighbour.x, neighbour.y, neighbour.z);
+            int neighbourLevel = Level(mLight[neighbourIndex], channel);
+            if (neighbourLevel == 0)
+                continue;
+
+            bool dependent = neighbourLevel < level ||
+                             (channel == CHANNEL_SKY && d == DOWN && level == MAX_LEVEL && neighbourLevel == MAX_LEVEL);
+            if (dependent && voxels[neighbourIndex] == 0)
+            {
+                mLight[neighbourIndex] &= ~(0xF << channel);
+                Touch(neighbourIndex);
+                queue.emplace_back(neighbourIndex, neighbourLevel);
+            }
+            else
+            {
+                relight.push_back(neighbourIndex);
+            }
+        }
+    }
+}
+
+void FloodLight::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    auto start = std::chrono::steady_clock::now();
+    mTouched = 0;
+
+    size_t index = Index(x, y, z);
+    std::vector<uint32_t> relight;
+    for (int channel : { CHANNEL_SKY, CHANNEL_BLUE, CHANNEL_GREEN, CHANNEL_RED })
+        Remove(voxels, index, channel, relight);
+
+    if (voxels[index] != 0)
+    {
+        uint16_t emitted = EmittedLight(voxels[index]);
+        if (emitted != 0)
+        {
+            mLight[index] = emitted;
+            Touch(index);
+            relight.push_back((uint32_t)index);
+        }
+    }
+    else
+    {
+        // The gap fills from its neighbours, the top layer also sees the sky directly
+        if (y == mWorldSize - 1)
+        {
+            mLight[index] = Max(mLight[index], MAX_LEVEL << CHANNEL_SKY);
+            Touch(index);
+            relight.push_back((uint32_t)index);
+        }
+        for (int d = 0; d < 6; d++)
+        {
+            glm::ivec3 neighbour = glm::ivec3(x, y, z) + NEIGHBOURS[d];
+            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(mWorldSize))))
+                continue;
+            size_t neighbourIndex = Index(neighbour.x, neighbour.y, neighbour.z);
+            if (mLight[neighbourIndex] != 0)
+                relight.push_back((uint32_t)neighbourIndex);
+        }
+    }
+    Propagate(voxels, relight);
+
+    mLastUpdateVoxels = mTouched;
+    mLastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void FloodLight::CreateTexture()
+{
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_RGBA4, mWorldSize, mWorldSize, mWorldSize, GL_RGBA, mLight.data(),
+                                 GL_UNSIGNED_SHORT_4_4_4_4);
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    mDirty = false;
+}
+
+void FloodLight::UploadDirty()
+{
+    if (Texture == 0 || !mDirty)
+        return;
+
+    glm::ivec3 size = mDirtyMax - mDirtyMin + 1;
+    mStaging.resize((size_t)size.x * size.y * size.z);
+    uint16_t* dst = mStaging.data();
+    for (int z = mDirtyMin.z; z <= mDirtyMax.z; z++)
+        for (int y = mDirtyMin.y; y <= mDirtyMax.y; y++, dst += size.x)
+            std::copy_n(&mLight[Index(mDirtyMin.x, y, z)], size.x, dst);
+
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, mDirtyMin.x, mDirtyMin.y, mDirtyMin.z, size.x, size.y, size.z,
+                                    GL_RGBA, mStaging.data(), GL_UNSIGNED_SHORT_4_4_4_4);
+    mDirty = false;
+}
@@ -0,0 +1,142 @@
+#include "MaterialTable.h"
+#include "AssetLoader.h"
+#include "FloodLight.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <iostream>
+
+// Highlight strength every material had while the shaders used a constant
+static const float DEFAULT_SPECULAR = 0.5f;
+
+void MaterialTable::Build(const DecodedImage &sheet, int columns, int materials)
+{
+    mColumns = std::min(columns, MAX_COLUMNS);
+    mTileWidth = sheet.width / columns;
+    mTileHeight = sheet.height / materials;
+    mMaterials.assign(materials, Material());
+    mCutoutRows.assign((size_t)materials * mColumns * 2 * MASK_SIZE, 0u);
+
+    for (int material = 0; material < materials; material++) {
+        Material &properties = mMaterials[material];
+        glm::ivec3 emission = FloodLight::Emission((uint8_t)material);
+        properties.emission = glm::vec3(emission) / (float)FloodLight::MAX_LEVEL;
+        properties.specular = material == 0 ? 0.0f : DEFAULT_SPECULAR;
+
+        for (int column = 0; column < mColumns; column++) {
+            uint32_t *rows = &mCutoutRows[((size_t)material * mColumns + column) * 2 * MASK_SIZE];
+            BuildMask(sheet, material, column, PRIMARY_ALPHA, rows);
+            BuildMask(sheet, material, column, SHADOW_ALPHA, rows + MASK_SIZE);
+
+            bool primaryOpaque = true, shadowOpaque = true;
+            for (int row = 0; row < MASK_SIZE; row++) {
+                primaryOpaque = primaryOpaque && rows[row] == 0xFFFFFFFFu;
+                shadowOpaque = shadowOpaque && rows[MASK_SIZE + row] == 0xFFFFFFFFu;
+            }
+            properties.tileFlags[column] = (primaryOpaque ? TILE_OPAQUE : 0u) | (shadowOpaque ? TILE_SHADOW_OPAQUE : 0u);
+        }
+    }
+
+    std::cout << "[MaterialTable] " << materials << " materials, " << GetOpaqueTileCount() << " of "
+              << materials * mColumns << " tiles opaque" << std::endl;
+}
+
+// Point samples the base level of a tile, rows are in texture order (v grows with the row)
+void MaterialTable::BuildMask(const DecodedImage &sheet, int material, int column, float alpha, uint32_t *rows) const
+{
+    const stbi_uc *pixels = sheet.Level(0);
+    int materials = (int)mMaterials.size();
+    int tileX = column * mTileWidth;
+    int tileY = (materials - 1 - material) * mTileHeight; // The sheet is stored bottom row first
+    int threshold = (int)(alpha * 255.0f + 0.5f);
+
+    for (int row = 0; row < MASK_SIZE; row++) {
+        uint32_t bits = 0;
+        int y = tileY + row * mTileHeight / MASK_SIZE;
+        for (int bit = 0; bit < MASK_SIZE; bit++) {
+            int x = tileX + bit * mTileWidth / MASK_SIZE;
+            bool solid = sheet.channels < 4 || pixels[((size_t)y * sheet.width + x) * sheet.channels + 3] >= threshold;
+            if (solid)
+                bits |= 1u << bit;
+        }
+        rows[row] = bits;
+    }
+}
+
+size_t MaterialTable::GetOpaqueTileCount() const
+{
+    size_t count = 0;
+    for (const Material &material : mMaterials)
+        for (int column = 0; column < mColumns; column++)
+            count += (material.tileFlags[column] & TILE_OPAQUE) != 0;
+    return count;
+}
+
+void MaterialTable::CreateBuffer()
+{
+    // std140: every array element takes a full vec4
+    std::vector<glm::vec4> properties(mMaterials.size());
+    std::vector<glm::uvec4> flags(mMaterials.size());
+    for (size_t material = 0; material < mMaterials.size(); material++) {
+        properties[material] = glm::vec4(mMaterials[material].emission, mMaterials[material].specular);
+        for (int column = 0; column < MAX_COLUMNS; column++)
+            flags[material][column] = mMaterials[material].tileFlags[column];
+    }
+
+    size_t propertyBytes = properties.size() * sizeof(glm::vec4);
+    size_t flagBytes = flags.size() * sizeof(glm::uvec4);
+    size_t maskBytes = mCutoutRows.size() * sizeof(uint32_t);
+
+    glGenBuffers(1, &UniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, UniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, propertyBytes + flagBytes + maskBytes, nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, propertyBytes, properties.data());
+    glBufferSubData(GL_UNIFORM_BUFFER, propertyBytes, flagBytes, flags.data());
+    glBufferSubData(GL_UNIFORM_BUFFER, propertyBytes + flagBytes, maskBytes, mCutoutRows.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, UniformBuffer);
+}
+
+void MaterialTable::CreateTileArray(const DecodedImage &sheet, int maxLevel)
+{
+    int materials = (int)mMaterials.size();
+    int layers = materials * mColumns;
+    int levels = std::min(sheet.LevelCount(), maxLevel + 1);
+    int channels = sheet.channels;
+    GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+
+    glGenTextures(1, &TileArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, TileArray);
+
+    // The texture cache filters mips per tile, so cutting the tiles out of each level keeps them intact
+    std::vector<stbi_uc> staging;
+    for (int level = 0; level < levels; level++) {
+        int levelWidth = sheet.LevelWidth(level);
+        int tileWidth = std::max(1, mTileWidth >> level);
+        int tileHeight = std::max(1, mTileHeight >> level);
+        const stbi_uc *pixels = sheet.Level(level);
+        staging.resize((size_t)tileWidth * tileHeight * layers * channels);
+
+        for (int material = 0; material < materials; material++) {
+            for (int column = 0; column < mColumns; column++) {
+                int layer = material * mColumns + column;
+                int tileY = (materials - 1 - material) * tileHeight;
+                for (int y = 0; y < tileHeight; y++) {
+                    const stbi_uc *src = pixels + ((size_t)(tileY + y) * levelWidth + column * tileWidth) * channels;
+                    stbi_uc *dst = &staging[(((size_t)layer * tileHeight + y) * tileWidth) * channels];
+                    std::copy(src, src + (size_t)tileWidth * channels, dst);
+                }
+            }
+        }
+        UploadRing::Get().TexImage3D(GL_TEXTURE_2D_ARRAY, level, channels == 4 ? GL_RGBA8 : GL_RGB8,
+                                     tileWidth, tileHeight, layers, format, staging.data());
+    }
+    if (sheet.LevelCount() == 1 && maxLevel > 0)
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, sheet.LevelCount() == 1 ? maxLevel : levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,51 @@
+#include "OccupancyBits.h"
+#include "UploadRing.h"
+
+void OccupancyBits::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    mWorldSize = worldSize;
+    mBlocksPerAxis = worldSize / BLOCK_SIZE;
+    mMasks.assign((size_t)mBlocksPerAxis * mBlocksPerAxis * mBlocksPerAxis * 2, 0);
+
+    for (int z = 0; z < worldSize; z++)
+        for (int y = 0; y < worldSize; y++)
+        {
+            const uint8_t* row = &voxels[(size_t)y * worldSize + (size_t)z * worldSize * worldSize];
+            for (int x = 0; x < worldSize; x++)
+                if (row[x] != 0)
+                    mMasks[Index(x, y, z) + ((z >> 1) & 1)] |= Bit(x, y, z);
+        }
+}
+
+void OccupancyBits::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    uint32_t &word = mMasks[Index(x, y, z) + ((z >> 1) & 1)];
+    if (voxels[x + y * (size_t)mWorldSize + z * (size_t)mWorldSize * mWorldSize] != 0)
+        word |= Bit(x, y, z);
+    else
+        word &= ~Bit(x, y, z);
+}
+
+void OccupancyBits::CreateTexture()
+{
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_RG32UI, mBlocksPerAxis, mBlocksPerAxis, mBlocksPerAxis,
+                                 GL_RG_INTEGER, mMasks.data(), GL_UNSIGNED_INT);
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void OccupancyBits::UploadBlock(int x, int y, int z)
+{
+    if (Texture == 0)
+        return;
+
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, x >> 2, y >> 2, z >> 2, 1, 1, 1,
+                                    GL_RG_INTEGER, &mMasks[Index(x, y, z)], GL_UNSIGNED_INT);
+}
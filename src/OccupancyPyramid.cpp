@@ -0,0 +1,89 @@
+#include "OccupancyPyramid.h"
+#include "UploadRing.h"
+
+size_t OccupancyPyramid::Index(int level, int x, int y, int z) const
+{
+    size_t size = LevelSize(level);
+    return x + y * size + z * size * size;
+}
+
+// A cell is occupied if any of its 8 children is, children are voxels for level 0
+bool OccupancyPyramid::IsCellOccupied(const std::vector<uint8_t> &voxels, int level, int x, int y, int z) const
+{
+    for (int dz = 0; dz < 2; dz++)
+        for (int dy = 0; dy < 2; dy++)
+            for (int dx = 0; dx < 2; dx++)
+            {
+                int cx = x * 2 + dx, cy = y * 2 + dy, cz = z * 2 + dz;
+                bool occupied = level == 0
+                    ? voxels[cx + cy * mWorldSize + (size_t)cz * mWorldSize * mWorldSize] != 0
+                    : mLevels[level - 1][Index(level - 1, cx, cy, cz)] != 0;
+                if (occupied)
+                    return true;
+            }
+    return false;
+}
+
+void OccupancyPyramid::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    mWorldSize = worldSize;
+    mLevels.clear();
+
+    for (int level = 0; level < MAX_LEVELS && LevelSize(level) >= 1; level++)
+    {
+        int size = LevelSize(level);
+        mLevels.emplace_back((size_t)size * size * size, 0);
+        for (int z = 0; z < size; z++)
+            for (int y = 0; y < size; y++)
+                for (int x = 0; x < size; x++)
+                    mLevels[level][Index(level, x, y, z)] = IsCellOccupied(voxels, level, x, y, z) ? 255 : 0;
+    }
+}
+
+void OccupancyPyramid::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    for (int level = 0; level < GetLevelCount(); level++)
+    {
+        int shift = level + 1;
+        uint8_t& cell = mLevels[level][Index(level, x >> shift, y >> shift, z >> shift)];
+        uint8_t value = IsCellOccupied(voxels, level, x >> shift, y >> shift, z >> shift) ? 255 : 0;
+        // Coarser levels only change if this one did
+        if (cell == value)
+            break;
+        cell = value;
+    }
+}
+
+void OccupancyPyramid::CreateTexture()
+{
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    for (int level = 0; level < GetLevelCount(); level++)
+    {
+        int size = LevelSize(level);
+        UploadRing::Get().TexImage3D(GL_TEXTURE_3D, level, GL_R8, size, size, size, GL_RED, mLevels[level].data());
+    }
+
+    // Only read with texelFetch, the level range just has to make the texture complete
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, GetLevelCount() - 1);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void OccupancyPyramid::UploadCell(int x, int y, int z)
+{
+    if (Texture == 0)
+        return;
+
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    for (int level = 0; level < GetLevelCount(); level++)
+    {
+        int shift = level + 1;
+        int cx = x >> shift, cy = y >> shift, cz = z >> shift;
+        UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, level, cx, cy, cz, 1, 1, 1, GL_RED, &mLevels[level][Index(level, cx, cy, cz)]);
+    }
+}
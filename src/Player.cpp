@@ -26,9 +26,11 @@ void Player::Update(float deltaTime, VoxelTerrain *terrain)
 
     if(removeBlock || addBlock)
     {  
-        glm::ivec3 targetVoxel = terrain->decodeVoxel(mScreenWidth,mScreenHeight,addBlock);
+        // Pick on the CPU through the octree, no need to read back the GPU buffer and stall
+        VoxelHit hit = terrain->raycast(Ray{ mCamera.mEye, glm::normalize(mCamera.mViewDirection) }, PICK_DISTANCE);
+        glm::ivec3 targetVoxel = hit.voxel + (addBlock ? VoxelTerrain::faceNormal(hit.face) : glm::ivec3(0));
 
-        if(targetVoxel != glm::ivec3((int)mPosition.x,(int)mPosition.y,(int)mPosition.z))
+        if(hit.valid && targetVoxel != glm::ivec3((int)mPosition.x,(int)mPosition.y,(int)mPosition.z))
         {
 
             int densityValue = removeBlock ? 0 : mChosenBlock;
@@ -150,6 +152,13 @@ int Player::getChosenBlock()
     return mChosenBlock;
 }
 
+void Player::SetScreenSize(int ScreenWidth, int ScreenHeight)
+{
+    mScreenWidth = ScreenWidth;
+    mScreenHeight = ScreenHeight;
+    mCamera.SetProjectionMatrix(90.0f,(float)ScreenWidth/(float)ScreenHeight,0.1,1000);
+}
+
 void Player::Input()
 {
     SDL_Event e;
@@ -0,0 +1,340 @@
+#include "SparseVoxelOctree.h"
+#include "VoxelTerrain.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <thread>
+
+bool SparseVoxelOctree::IsCollapsible(const uint32_t children[8])
+{
+    return IsLeaf(children[0]) && std::all_of(children + 1, children + 8, [&](uint32_t child) { return child == children[0]; });
+}
+
+// A node collapses into a leaf when all 8 children are the same leaf, otherwise its children
+// are appended to `blocks` as one block. Index 0 of `blocks` is never a block, it is the root slot.
+uint32_t SparseVoxelOctree::Combine(const uint32_t children[8], std::vector<uint32_t> &blocks)
+{
+    if (IsCollapsible(children))
+        return children[0];
+
+    uint32_t index = (uint32_t)blocks.size();
+    blocks.insert(blocks.end(), children, children + 8);
+    return index;
+}
+
+// Bottom-up: children are built (and collapsed) before their parent, so blocks end up in post-order
+uint32_t SparseVoxelOctree::BuildNode(const std::vector<uint8_t> &voxels, int x, int y, int z, int size, std::vector<uint32_t> &blocks) const
+{
+    uint32_t children[8];
+    int half = size / 2;
+    for (int i = 0; i < 8; i++)
+    {
+        int cx = x + (i & 1) * half, cy = y + ((i >> 1) & 1) * half, cz = z + (i >> 2) * half;
+        if (half == 1)
+        {
+            uint8_t value = voxels[cx + cy * (size_t)mWorldSize + cz * (size_t)mWorldSize * mWorldSize];
+            children[i] = value != 0 ? (UNIFORM_BIT | value) : 0;
+        }
+        else
+        {
+            children[i] = BuildNode(voxels, cx, cy, cz, half, blocks);
+        }
+    }
+    return Combine(children, blocks);
+}
+
+void SparseVoxelOctree::Build(const std::vector<uint8_t> &voxels, int worldSize)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mWorldSize = worldSize;
+    mLevels = 0;
+    while ((1 << mLevels) < worldSize)
+        mLevels++;
+
+    // The 64 subtrees two levels below the root are independent, build them on every core
+    int subtreeSize = std::max(worldSize / 4, 2);
+    int subtreesPerAxis = worldSize / subtreeSize;
+    int subtreeCount = subtreesPerAxis * subtreesPerAxis * subtreesPerAxis;
+    std::vector<std::vector<uint32_t>> subtreeBlocks(subtreeCount);
+    std::vector<uint32_t> subtreeRoots(subtreeCount);
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int s = next++; s < subtreeCount; s = next++)
+        {
+            int sx = s % subtreesPerAxis, sy = (s / subtreesPerAxis) % subtreesPerAxis, sz = s / (subtreesPerAxis * subtreesPerAxis);
+            subtreeBlocks[s].assign(1, 0);
+            subtreeRoots[s] = BuildNode(voxels, sx * subtreeSize, sy * subtreeSize, sz * subtreeSize, subtreeSize, subtreeBlocks[s]);
+        }
+    };
+    int workerCount = std::max(1, std::min((int)std::thread::hardware_concurrency(), subtreeCount));
+    std::vector<std::future<void>> workers;
+    for (int w = 1; w < workerCount; w++)
+        workers.push_back(std::async(std::launch::async, worker));
+    worker();
+    for (auto &w : workers)
+        w.get();
+
+    // Stitch the subtrees into one array, moving their child pointers along with them
+    mNodes.assign(1, 0);
+    mFreeBlocks.clear();
+    for (int s = 0; s < subtreeCount; s++)
+    {
+        uint32_t offset = (uint32_t)mNodes.size() - 1;
+        for (size_t i = 1; i < subtreeBlocks[s].size(); i++)
+        {
+            uint32_t node = subtreeBlocks[s][i];
+            mNodes.push_back(IsLeaf(node) ? node : node + offset);
+        }
+        if (!IsLeaf(subtreeRoots[s]))
+            subtreeRoots[s] += offset;
+        std::vector<uint32_t>().swap(subtreeBlocks[s]);
+    }
+
+    // And the levels above them
+    auto assemble = [&](auto &self, int x, int y, int z, int size) -> uint32_t {
+        if (size == subtreeSize)
+            return subtreeRoots[x / size + (y / size) * subtreesPerAxis + (z / size) * subtreesPerAxis * subtreesPerAxis];
+        uint32_t children[8];
+        int half = size / 2;
+        for (int i = 0; i < 8; i++)
+            children[i] = self(self, x + (i & 1) * half, y + ((i >> 1) & 1) * half, z + (i >> 2) * half, half);
+        return Combine(children, mNodes);
+    };
+    mNodes[0] = assemble(assemble, 0, 0, 0, worldSize);
+
+    mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[SparseVoxelOctree] Built " << mNodes.size() << " nodes in " << mBuildMs << " ms on "
+              << workerCount << " threads" << std::endl;
+}
+
+uint32_t SparseVoxelOctree::AllocateBlock()
+{
+    if (!mFreeBlocks.empty())
+    {
+        uint32_t block = mFreeBlocks.back();
+        mFreeBlocks.pop_back();
+        return block;
+    }
+    uint32_t block = (uint32_t)mNodes.size();
+    mNodes.resize(mNodes.size() + 8, 0);
+    return block;
+}
+
+void SparseVoxelOctree::FreeSubtree(uint32_t node)
+{
+    if (IsLeaf(node))
+        return;
+    for (int i = 0; i < 8; i++)
+        FreeSubtree(mNodes[node + i]);
+    mFreeBlocks.push_back(node);
+}
+
+void SparseVoxelOctree::MarkDirty(size_t begin, size_t end)
+{
+    if (mDirtyBegin == mDirtyEnd)
+    {
+        mDirtyBegin = begin;
+        mDirtyEnd = end;
+        return;
+    }
+    mDirtyBegin = std::min(mDirtyBegin, begin);
+    mDirtyEnd = std::max(mDirtyEnd, end);
+}
+
+// Rebuilds the EDIT_SUBTREE_SIZE^3 subtree around the voxel from the dense voxels, then
+// collapses the ancestors that became uniform. Leaves above the subtree are split on the way down.
+void SparseVoxelOctree::Update(const std::vector<uint8_t> &voxels, int x, int y, int z)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint32_t> path; // Slots of the interior nodes above the subtree
+    uint32_t slot = 0;
+    for (int size = mWorldSize; size > EDIT_SUBTREE_SIZE; size /= 2)
+    {
+        uint32_t node = mNodes[slot];
+        if (IsLeaf(node))
+        {
+            uint32_t block = AllocateBlock();
+            std::fill_n(&mNodes[block], 8, node);
+            mNodes[slot] = block;
+            MarkDirty(block, block + 8);
+            MarkDirty(slot, slot + 1);
+        }
+        path.push_back(slot);
+        slot = mNodes[slot] + ChildIndex(x, y, z, size / 2);
+    }
+
+    FreeSubtree(mNodes[slot]);
+    std::vector<uint32_t> blocks(1, 0);
+    int mask = ~(EDIT_SUBTREE_SIZE - 1);
+    uint32_t node = BuildNode(voxels, x & mask, y & mask, z & mask, EDIT_SUBTREE_SIZE, blocks);
+
+    // Post-order, so every pointer refers to a block that was already placed
+    std::vector<uint32_t> placed;
+    for (size_t local = 1; local < blocks.size(); local += 8)
+    {
+        uint32_t block = AllocateBlock();
+        for (int i = 0; i < 8; i++)
+        {
+            uint32_t child = blocks[local + i];
+            mNodes[block + i] = IsLeaf(child) ? child : placed[(child - 1) / 8];
+        }
+        placed.push_back(block);
+        MarkDirty(block, block + 8);
+    }
+    mNodes[slot] = IsLeaf(node) ? node : placed[(node - 1) / 8];
+    MarkDirty(slot, slot + 1);
+
+    for (auto it = path.rbegin(); it != path.rend(); ++it)
+    {
+        uint32_t block = mNodes[*it];
+        if (!IsCollapsible(&mNodes[block]))
+            break;
+        mNodes[*it] = mNodes[block];
+        mFreeBlocks.push_back(block);
+        MarkDirty(*it, *it + 1);
+    }
+
+    mLastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t SparseVoxelOctree::Leaf(int x, int y, int z, int &leafSize) const
+{
+    uint32_t node = mNodes[0];
+    int size = mWorldSize;
+    while (!IsLeaf(node))
+    {
+        size /= 2;
+        node = mNodes[node + ChildIndex(x, y, z, size)];
+    }
+    leafSize = size;
+    return node;
+}
+
+uint8_t SparseVoxelOctree::GetVoxel(int x, int y, int z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x >= mWorldSize || y >= mWorldSize || z >= mWorldSize)
+        return 0;
+    int leafSize;
+    return (uint8_t)(Leaf(x, y, z, leafSize) & 0xFF);
+}
+
+VoxelHit SparseVoxelOctree::Raycast(const Ray &ray, float maxDistance) const
+{
+    VoxelHit hit = { false, glm::ivec3(-1), glm::vec3(0.0f), -1 };
+
+    // Clip the ray against the world box
+    glm::vec3 invDir = 1.0f / ray.dir;
+    glm::vec3 t0 = (glm::vec3(0.0f) - ray.origin) * invDir;
+    glm::vec3 t1 = (glm::vec3((float)mWorldSize) - ray.origin) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    float tEnter = std::max(std::max(tNear.x, tNear.y), tNear.z);
+    float tExit = std::min(std::min(std::min(tFar.x, tFar.y), tFar.z), maxDistance);
+    if (tExit < std::max(tEnter, 0.0f))
+        return hit;
+
+    float t = std::max(tEnter, 0.0f);
+    int face = -1;
+    if (tEnter > 0.0f)
+    {
+        int axis = (tNear.x > tNear.y && tNear.x > tNear.z) ? 0 : (tNear.y > tNear.z ? 1 : 2);
+        face = axis * 2 + (ray.dir[axis] > 0.0f ? 1 : 0);
+    }
+    glm::ivec3 voxel = glm::clamp(glm::ivec3(glm::floor(ray.origin + ray.dir * t)), glm::ivec3(0), glm::ivec3(mWorldSize - 1));
+
+    while (true)
+    {
+        int leafSize;
+        uint32_t leaf = Leaf(voxel.x, voxel.y, voxel.z, leafSize);
+        if (leaf != 0)
+        {
+            hit.valid = true;
+            hit.voxel = voxel;
+            hit.position = ray.origin + ray.dir * t;
+            hit.face = face;
+            return hit;
+        }
+
+        // Leave the empty leaf through its nearest exit plane
+        glm::ivec3 boxMin = voxel & ~(leafSize - 1);
+        glm::ivec3 boxMax = boxMin + leafSize - 1;
+        glm::vec3 planes = glm::mix(glm::vec3(boxMin), glm::vec3(boxMax + 1), glm::step(0.0f, ray.dir));
+        glm::vec3 tPlanes = (planes - ray.origin) * invDir;
+        int axis = (tPlanes.x < tPlanes.y && tPlanes.x < tPlanes.z) ? 0 : (tPlanes.y < tPlanes.z ? 1 : 2);
+
+        t = tPlanes[axis];
+        if (t > tExit)
+            return hit;
+
+        // Face indices follow VoxelTerrain::faceNormal: +X, -X, +Y, -Y, +Z, -Z, and name the face of the voxel we enter
+        bool positive = ray.dir[axis] > 0.0f;
+        face = axis * 2 + (positive ? 1 : 0);
+        voxel = glm::clamp(glm::ivec3(glm::floor(ray.origin + ray.dir * t)), boxMin, boxMax);
+        voxel[axis] = positive ? boxMax[axis] + 1 : boxMin[axis] - 1;
+        if (voxel[axis] < 0 || voxel[axis] >= mWorldSize)
+            return hit;
+    }
+}
+
+void SparseVoxelOctree::CreateTexture()
+{
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+
+    mBufferCapacity = mNodes.size() + mNodes.size() / 2 + 64 * 1024; // Headroom for edits
+    if ((size_t)maxTexels < mBufferCapacity)
+        std::cout << "[SparseVoxelOctree] Warning: " << mBufferCapacity << " nodes exceed GL_MAX_TEXTURE_BUFFER_SIZE ("
+                  << maxTexels << ")" << std::endl;
+
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, mBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, mBufferCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, mNodes.size() * sizeof(uint32_t), mNodes.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_BUFFER, Texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, mBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    mDirtyBegin = mDirtyEnd = 0;
+
+    Stats stats = GetStats();
+    std::cout << "[SparseVoxelOctree] " << stats.bytes / 1024 << " KB on the GPU (dense: " << stats.denseBytes / 1024 << " KB)" << std::endl;
+}
+
+void SparseVoxelOctree::UploadDirty()
+{
+    if (Texture == 0 || mDirtyBegin == mDirtyEnd)
+        return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, mBuffer);
+    if (mNodes.size() > mBufferCapacity)
+    {
+        // Out of headroom, reallocate. The buffer texture keeps pointing at the same buffer name.
+        mBufferCapacity = mNodes.size() + mNodes.size() / 2;
+        glBufferData(GL_TEXTURE_BUFFER, mBufferCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, mNodes.size() * sizeof(uint32_t), mNodes.data());
+    }
+    else
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, mDirtyBegin * sizeof(uint32_t), (mDirtyEnd - mDirtyBegin) * sizeof(uint32_t), &mNodes[mDirtyBegin]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    mDirtyBegin = mDirtyEnd = 0;
+}
+
+SparseVoxelOctree::Stats SparseVoxelOctree::GetStats() const
+{
+    Stats stats;
+    stats.nodes = mNodes.size();
+    stats.freeBlocks = mFreeBlocks.size();
+    stats.bytes = mNodes.size() * sizeof(uint32_t);
+    stats.denseBytes = (size_t)mWorldSize * mWorldSize * mWorldSize;
+    stats.buildMs = mBuildMs;
+    stats.lastUpdateMs = mLastUpdateMs;
+    return stats;
+}
@@ -0,0 +1,257 @@
+#include "SunVisibility.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <thread>
+
+// Walks the voxels along the ray towards the sun, starting in the voxel the ray enters first
+bool SunVisibility::IsLit(const std::vector<uint8_t> &voxels, const glm::vec3 &start, glm::ivec3 voxel) const
+{
+    glm::ivec3 step;
+    glm::vec3 tDelta, tMax;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        step[axis] = mToSun[axis] > 0.0f ? 1 : -1;
+        if (mToSun[axis] == 0.0f)
+        {
+            tDelta[axis] = tMax[axis] = INFINITY;
+            continue;
+        }
+        tDelta[axis] = std::abs(1.0f / mToSun[axis]);
+        tMax[axis] = (voxel[axis] + (step[axis] > 0 ? 1 : 0) - start[axis]) / mToSun[axis];
+    }
+
+    while (voxel.x >= 0 && voxel.y >= 0 && voxel.z >= 0 &&
+           voxel.x < mWorldSize && voxel.y < mWorldSize && voxel.z < mWorldSize)
+    {
+        if (voxels[Index(voxel.x, voxel.y, voxel.z)] != 0)
+            return false;
+        int axis = (tMax.x < tMax.y && tMax.x < tMax.z) ? 0 : (tMax.y < tMax.z ? 1 : 2);
+        voxel[axis] += step[axis];
+        tMax[axis] += tDelta[axis];
+    }
+    return true;
+}
+
+uint8_t SunVisibility::FaceMask(const std::vector<uint8_t> &voxels, int x, int y, int z) const
+{
+    if (voxels[Index(x, y, z)] == 0)
+        return 0;
+
+    uint8_t mask = 0;
+    glm::ivec3 voxel(x, y, z);
+    for (int face = 0; face < 6; face++)
+    {
+        // Face order +X, -X, +Y, -Y, +Z, -Z
+        int axis = face / 2;
+        int sign = (face & 1) == 0 ? 1 : -1;
+        if (mToSun[axis] * sign <= 0.0f)
+            continue;
+
+        glm::ivec3 neighbour = voxel;
+        neighbour[axis] += sign;
+        bool inside = neighbour[axis] >= 0 && neighbour[axis] < mWorldSize;
+        if (inside && voxels[Index(neighbour.x, neighbour.y, neighbour.z)] != 0)
+            continue;
+
+        glm::vec3 center = glm::vec3(voxel) + 0.5f;
+        center[axis] += 0.5f * sign;
+        if (IsLit(voxels, center, neighbour))
+            mask |= 1 << face;
+    }
+    return mask;
+}
+
+// Regions never overlap, so the workers can write their masks without locking
+void SunVisibility::Bake(const std::vector<uint8_t> &voxels, const std::vector<Region> &regions)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t r = next++; r < regions.size(); r = next++)
+        {
+            const Region &region = regions[r];
+            for (int z = region.min.z; z <= region.max.z; z++)
+                for (int y = region.min.y; y <= region.max.y; y++)
+                    for (int x = region.min.x; x <= region.max.x; x++)
+                        mMasks[Index(x, y, z)] = FaceMask(voxels, x, y, z);
+        }
+    };
+    int workerCount = std::max(1, std::min((int)std::thread::hardware_concurrency(), (int)regions.size()));
+    std::vector<std::future<void>> workers;
+    for (int w = 1; w < workerCount; w++)
+        workers.push_back(std::async(std::launch::async, worker));
+    worker();
+    for (auto &w : workers)
+        w.get();
+}
+
+void SunVisibility::Build(const std::vector<uint8_t> &voxels, int worldSize, const glm::vec3 &toSun)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mWorldSize = worldSize;
+    mToSun = mTargetToSun = glm::normalize(toSun);
+    mMasks.assign((size_t)worldSize * worldSize * worldSize, 0);
+
+    std::vector<Region> slices;
+    for (int z = 0; z < worldSize; z++)
+        slices.push_back(Region{ glm::ivec3(0, 0, z), glm::ivec3(worldSize - 1, worldSize - 1, z) });
+    Bake(voxels, slices);
+
+    mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SunVisibility::MarkDirty(int x, int y, int z)
+{
+    glm::ivec3 voxel(x, y, z);
+    mDirtyMin = mDirty ? glm::min(mDirtyMin, voxel) : voxel;
+    mDirtyMax = mDirty ? glm::max(mDirtyMax, voxel) : voxel;
+    mDirty = true;
+}
+
+// Every face whose sun ray can pass through the edited box lies in the box swept backwards along
+// the sun direction. Cut into slices along the dominant axis, each slice only needs the range the
+// swept box covers there, padded by a voxel for the faces next to the edits.
+std::vector<SunVisibility::Region> SunVisibility::ShadowVolume(const glm::ivec3 &editMin, const glm::ivec3 &editMax) const
+{
+    glm::vec3 absDir = glm::abs(mToSun);
+    int sweep = (absDir.x > absDir.y && absDir.x > absDir.z) ? 0 : (absDir.y > absDir.z ? 1 : 2);
+    float s = mToSun[sweep];
+    int sliceStep = s > 0.0f ? -1 : 1;
+    int first = s > 0.0f ? editMax[sweep] + 1 : editMin[sweep] - 1;
+    int last = s > 0.0f ? 0 : mWorldSize - 1;
+
+    std::vector<Region> slices;
+    for (int c = first; c != last + sliceStep; c += sliceStep)
+    {
+        if (c < 0 || c >= mWorldSize)
+            continue;
+
+        // Distances along the ray for which the swept box overlaps the slab [c, c + 1]
+        float a = (editMin[sweep] - c - 1) / s;
+        float b = (editMax[sweep] + 1 - c) / s;
+        float t0 = std::max(std::min(a, b), 0.0f);
+        float t1 = std::max(a, b);
+        if (t1 < 0.0f)
+            continue;
+
+        Region region;
+        region.min[sweep] = region.max[sweep] = c;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (axis == sweep)
+                continue;
+            float lo = editMin[axis] - std::max(t0 * mToSun[axis], t1 * mToSun[axis]);
+            float hi = editMax[axis] + 1 - std::min(t0 * mToSun[axis], t1 * mToSun[axis]);
+            region.min[axis] = std::max((int)std::floor(lo) - 1, 0);
+            region.max[axis] = std::min((int)std::floor(hi) + 1, mWorldSize - 1);
+        }
+        slices.push_back(region);
+    }
+    return slices;
+}
+
+void SunVisibility::SetDirection(const glm::vec3 &toSun)
+{
+    mTargetToSun = glm::normalize(toSun);
+}
+
+float SunVisibility::GetSweepProgress() const
+{
+    if (!mSweeping)
+        return mTargetToSun == mToSun ? 1.0f : 0.0f;
+    int bandsPerSlice = (mWorldSize + SWEEP_ROWS - 1) / SWEEP_ROWS;
+    return (float)mSweepBand / (bandsPerSlice * mWorldSize);
+}
+
+void SunVisibility::UploadRegion(const Region &region)
+{
+    glm::ivec3 size = region.max - region.min + 1;
+    mStaging.resize((size_t)size.x * size.y * size.z);
+    uint8_t* dst = mStaging.data();
+    for (int z = region.min.z; z <= region.max.z; z++)
+        for (int y = region.min.y; y <= region.max.y; y++, dst += size.x)
+            std::copy_n(&mMasks[Index(region.min.x, y, z)], size.x, dst);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, region.min.x, region.min.y, region.min.z, size.x, size.y, size.z,
+                                    GL_RED_INTEGER, mStaging.data());
+}
+
+void SunVisibility::Update(const std::vector<uint8_t> &voxels)
+{
+    if (mDirty)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Region> slices = ShadowVolume(mDirtyMin, mDirtyMax);
+        mDirty = false;
+        Bake(voxels, slices);
+
+        mLastUpdateVoxels = 0;
+        for (const Region &region : slices)
+        {
+            glm::ivec3 size = region.max - region.min + 1;
+            mLastUpdateVoxels += (size_t)size.x * size.y * size.z;
+            if (Texture != 0)
+                UploadRegion(region);
+        }
+        mLastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    Sweep(voxels);
+}
+
+// Bands in z then y order, one per worker per step. The budget is checked between steps, so a
+// frame goes over it by at most one step.
+void SunVisibility::Sweep(const std::vector<uint8_t> &voxels)
+{
+    mLastSweepMs = 0.0;
+    if (!mSweeping)
+    {
+        // A sweep always finishes with the direction it started with, edits bake with it too
+        if (mTargetToSun == mToSun)
+            return;
+        mToSun = mTargetToSun;
+        mSweepBand = 0;
+        mSweeping = true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int bandsPerSlice = (mWorldSize + SWEEP_ROWS - 1) / SWEEP_ROWS;
+    int bandCount = bandsPerSlice * mWorldSize;
+    int workerCount = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<Region> bands;
+    do
+    {
+        bands.clear();
+        for (int w = 0; w < workerCount && mSweepBand < bandCount; w++, mSweepBand++)
+        {
+            int z = mSweepBand / bandsPerSlice;
+            int y = (mSweepBand % bandsPerSlice) * SWEEP_ROWS;
+            bands.push_back(Region{ glm::ivec3(0, y, z), glm::ivec3(mWorldSize - 1, std::min(y + SWEEP_ROWS, mWorldSize) - 1, z) });
+        }
+        Bake(voxels, bands);
+        if (Texture != 0)
+            for (const Region &band : bands)
+                UploadRegion(band);
+        mLastSweepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } while (mSweepBand < bandCount && mLastSweepMs < SWEEP_BUDGET_MS);
+
+    if (mSweepBand == bandCount)
+        mSweeping = false;
+}
+
+void SunVisibility::CreateTexture()
+{
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_3D, Texture);
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, mWorldSize, mWorldSize, mWorldSize, GL_RED_INTEGER, mMasks.data());
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
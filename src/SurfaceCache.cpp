@@ -0,0 +1,388 @@
+#include "SurfaceCache.h"
+#include "VoxelTerrain.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+void SurfaceCache::Init(int worldSize)
+{
+    mWorldSize = worldSize;
+    mChunksPerAxis = (worldSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    mChunks.assign((size_t)mChunksPerAxis * mChunksPerAxis * mChunksPerAxis, Chunk());
+
+    mTable.assign(2 * (size_t)TABLE_SIZE, 0);
+    mDirtyBegin = 0;
+    mDirtyEnd = TABLE_SIZE;
+
+    mSlotKey.assign(MAX_SLOTS, FREE_SLOT);
+    mSlotPending.assign(MAX_SLOTS, 0);
+    mFreeSlots.clear();
+    mSlotHighWater = 0;
+    mRefreshCursor = 0;
+    mPending.clear();
+}
+
+glm::ivec3 SurfaceCache::KeyVoxel(uint32_t key) const
+{
+    uint32_t index = key / 6;
+    return glm::ivec3(index % mWorldSize, (index / mWorldSize) % mWorldSize, index / ((uint32_t)mWorldSize * mWorldSize));
+}
+
+void SurfaceCache::MarkDirty(int x, int y, int z)
+{
+    glm::ivec3 voxel(x, y, z);
+    mEditMin = mEdited ? glm::min(mEditMin, voxel) : voxel;
+    mEditMax = mEdited ? glm::max(mEditMax, voxel) : voxel;
+    mEdited = true;
+}
+
+//################ HASH TABLE ####
+
+void SurfaceCache::SetEntry(size_t entry, uint32_t keyPlusOne, uint32_t value)
+{
+    mTable[2 * entry] = keyPlusOne;
+    mTable[2 * entry + 1] = value;
+
+    if (mDirtyBegin == mDirtyEnd)
+    {
+        mDirtyBegin = entry;
+        mDirtyEnd = entry + 1;
+        return;
+    }
+    mDirtyBegin = std::min(mDirtyBegin, entry);
+    mDirtyEnd = std::max(mDirtyEnd, entry + 1);
+}
+
+size_t SurfaceCache::Find(uint32_t key) const
+{
+    size_t home = Hash(key);
+    for (int probe = 0; probe < MAX_PROBES; probe++)
+    {
+        size_t entry = (home + probe) & (TABLE_SIZE - 1);
+        if (mTable[2 * entry] == key + 1)
+            return entry;
+        if (mTable[2 * entry] == 0)
+            break;
+    }
+    return TABLE_SIZE;
+}
+
+bool SurfaceCache::Insert(uint32_t key)
+{
+    if (mFreeSlots.empty() && mSlotHighWater >= (uint32_t)MAX_SLOTS)
+    {
+        mStats.rejectedFaces++;
+        return false;
+    }
+
+    // The shaders give up after MAX_PROBES, so must this
+    size_t home = Hash(key);
+    for (int probe = 0; probe < MAX_PROBES; probe++)
+    {
+        size_t entry = (home + probe) & (TABLE_SIZE - 1);
+        if (mTable[2 * entry] != 0)
+            continue;
+
+        uint32_t slot;
+        if (!mFreeSlots.empty())
+        {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+        else
+            slot = mSlotHighWater++;
+
+        mSlotKey[slot] = key;
+        SetEntry(entry, key + 1, slot | PENDING_BIT);
+        mSlotPending[slot] = 1;
+        mPending.push_back(slot);
+        return true;
+    }
+
+    mStats.rejectedFaces++;
+    return false;
+}
+
+// Backward shift deletion, the entries after the hole that may move closer to home do, so no
+// probe sequence ever gets longer than it was when inserted
+void SurfaceCache::Remove(uint32_t key)
+{
+    size_t hole = Find(key);
+    if (hole == TABLE_SIZE)
+        return;
+
+    uint32_t slot = mTable[2 * hole + 1] & ~PENDING_BIT;
+    mSlotKey[slot] = FREE_SLOT;
+    mSlotPending[slot] = 0; // Stale copies in mPending are skipped
+    mFreeSlots.push_back(slot);
+
+    const size_t mask = TABLE_SIZE - 1;
+    for (size_t entry = (hole + 1) & mask; mTable[2 * entry] != 0; entry = (entry + 1) & mask)
+    {
+        size_t home = Hash(mTable[2 * entry] - 1);
+        if (((entry - home) & mask) < ((entry - hole) & mask))
+            continue; // Its home lies between the hole and itself
+
+        SetEntry(hole, mTable[2 * entry], mTable[2 * entry + 1]);
+        hole = entry;
+    }
+    SetEntry(hole, 0, 0);
+}
+
+void SurfaceCache::QueueFill(uint32_t slot)
+{
+    if (mSlotKey[slot] == FREE_SLOT || mSlotPending[slot])
+        return;
+
+    size_t entry = Find(mSlotKey[slot]);
+    SetEntry(entry, mTable[2 * entry], slot | PENDING_BIT);
+    mSlotPending[slot] = 1;
+    mPending.push_back(slot);
+}
+
+void SurfaceCache::Invalidate(const glm::ivec3 &boxMin, const glm::ivec3 &boxMax)
+{
+    for (uint32_t slot = 0; slot < mSlotHighWater; slot++)
+    {
+        if (mSlotKey[slot] == FREE_SLOT)
+            continue;
+
+        glm::ivec3 front = KeyVoxel(mSlotKey[slot]) + VoxelTerrain::faceNormal(mSlotKey[slot] % 6);
+        if (glm::all(glm::greaterThanEqual(front, boxMin)) && glm::all(glm::lessThanEqual(front, boxMax)))
+            QueueFill(slot);
+    }
+}
+
+void SurfaceCache::InvalidateAll()
+{
+    for (uint32_t slot = 0; slot < mSlotHighWater; slot++)
+        QueueFill(slot);
+}
+
+//################ RESIDENCY ####
+
+void SurfaceCache::ScanFaces(const std::vector<uint8_t> &voxels, int chunk, std::vector<uint32_t> &keys) const
+{
+    keys.clear();
+    glm::ivec3 origin = glm::ivec3(chunk % mChunksPerAxis, (chunk / mChunksPerAxis) % mChunksPerAxis, chunk / (mChunksPerAxis * mChunksPerAxis)) * CHUNK_SIZE;
+    glm::ivec3 end = glm::min(origin + CHUNK_SIZE, glm::ivec3(mWorldSize));
+
+    // Neighbour offsets in faceNormal order, the world border counts as empty
+    const size_t row = mWorldSize, slice = (size_t)mWorldSize * mWorldSize;
+    const int last = mWorldSize - 1;
+    for (int z = origin.z; z < end.z; z++)
+        for (int y = origin.y; y < end.y; y++)
+        {
+            size_t index = origin.x + y * row + z * slice;
+            for (int x = origin.x; x < end.x; x++, index++)
+            {
+                if (voxels[index] == 0)
+                    continue;
+
+                bool open[6] = {
+                    x == last || voxels[index + 1] == 0,
+                    x == 0 || voxels[index - 1] == 0,
+                    y == last || voxels[index + row] == 0,
+                    y == 0 || voxels[index - row] == 0,
+                    z == last || voxels[index + slice] == 0,
+                    z == 0 || voxels[index - slice] == 0,
+                };
+                for (int face = 0; face < 6; face++)
+                    if (open[face])
+                        keys.push_back((uint32_t)index * 6 + face);
+            }
+        }
+}
+
+void SurfaceCache::MakeResident(const std::vector<uint8_t> &voxels, int chunk)
+{
+    std::vector<uint32_t> keys;
+    ScanFaces(voxels, chunk, keys);
+
+    Chunk &c = mChunks[chunk];
+    c.resident = true;
+    c.keys.clear();
+    for (uint32_t key : keys)
+        if (Insert(key))
+            c.keys.push_back(key);
+}
+
+void SurfaceCache::Evict(int chunk)
+{
+    Chunk &c = mChunks[chunk];
+    for (uint32_t key : c.keys)
+        Remove(key);
+    c.keys.clear();
+    c.resident = false;
+}
+
+// Both key lists come out of ScanFaces in ascending order
+void SurfaceCache::Rescan(const std::vector<uint8_t> &voxels, int chunk)
+{
+    std::vector<uint32_t> keys;
+    ScanFaces(voxels, chunk, keys);
+
+    Chunk &c = mChunks[chunk];
+    std::vector<uint32_t> kept;
+    kept.reserve(keys.size());
+    size_t o = 0, n = 0;
+    while (o < c.keys.size() || n < keys.size())
+    {
+        if (n == keys.size() || (o < c.keys.size() && c.keys[o] < keys[n]))
+            Remove(c.keys[o++]);
+        else if (o == c.keys.size() || keys[n] < c.keys[o])
+        {
+            if (Insert(keys[n]))
+                kept.push_back(keys[n]);
+            n++;
+        }
+        else
+        {
+            kept.push_back(keys[n]);
+            o++;
+            n++;
+        }
+    }
+    c.keys.swap(kept);
+}
+
+//################ UPDATE ####
+
+void SurfaceCache::Update(const std::vector<uint8_t> &voxels, const glm::vec3 &cameraPos, const glm::vec3 &toSun)
+{
+    auto start = std::chrono::steady_clock::now();
+    int chunkCount = (int)mChunks.size();
+
+    // Edits: faces appear and disappear in the touched chunks, the faces next to the edit lose
+    // their AO and the ones whose sun rays cross it their shadow. Light spreading further away
+    // comes in through Invalidate.
+    if (mEdited)
+    {
+        glm::ivec3 boxMin = glm::max(mEditMin - 1, glm::ivec3(0));
+        glm::ivec3 boxMax = glm::min(mEditMax + 1, glm::ivec3(mWorldSize - 1));
+        glm::ivec3 chunkMin = boxMin / CHUNK_SIZE, chunkMax = boxMax / CHUNK_SIZE;
+        for (int cz = chunkMin.z; cz <= chunkMax.z; cz++)
+            for (int cy = chunkMin.y; cy <= chunkMax.y; cy++)
+                for (int cx = chunkMin.x; cx <= chunkMax.x; cx++)
+                {
+                    int chunk = (int)ChunkIndex(cx, cy, cz);
+                    if (mChunks[chunk].resident)
+                        Rescan(voxels, chunk);
+                }
+
+        // The fill jitters its sun rays, so the box grows by a voxel more
+        glm::vec3 shadowMin = glm::vec3(mEditMin) - 1.0f, shadowMax = glm::vec3(mEditMax) + 2.0f;
+        glm::vec3 invSun = 1.0f / toSun;
+        for (uint32_t slot = 0; slot < mSlotHighWater; slot++)
+        {
+            if (mSlotKey[slot] == FREE_SLOT)
+                continue;
+
+            glm::vec3 normal = glm::vec3(VoxelTerrain::faceNormal(mSlotKey[slot] % 6));
+            glm::vec3 center = glm::vec3(KeyVoxel(mSlotKey[slot])) + 0.5f + normal * 0.5f;
+            glm::vec3 t0 = (shadowMin - center) * invSun, t1 = (shadowMax - center) * invSun;
+            glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+            float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+            float leave = std::min(std::min(tFar.x, tFar.y), tFar.z);
+            if (enter <= leave)
+                QueueFill(slot);
+        }
+        mEdited = false;
+    }
+
+    // Residency: drop the chunks that fell out of range, with some slack so the camera moving
+    // back and forth over a border does not churn them, then add the nearest missing ones
+    std::vector<std::pair<float, int>> missing;
+    mStats.residentChunks = 0;
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        glm::vec3 boxMin = glm::vec3(chunk % mChunksPerAxis, (chunk / mChunksPerAxis) % mChunksPerAxis, chunk / (mChunksPerAxis * mChunksPerAxis)) * float(CHUNK_SIZE);
+        float distance = glm::length(glm::max(glm::max(boxMin - cameraPos, cameraPos - boxMin - float(CHUNK_SIZE)), glm::vec3(0.0f)));
+
+        if (mChunks[chunk].resident && distance > RESIDENT_RADIUS + CHUNK_SIZE)
+            Evict(chunk);
+        else if (!mChunks[chunk].resident && distance <= RESIDENT_RADIUS)
+            missing.push_back({ distance, chunk });
+    }
+    std::sort(missing.begin(), missing.end());
+    for (size_t i = 0; i < missing.size() && i < (size_t)CHUNKS_PER_FRAME; i++)
+        MakeResident(voxels, missing[i].second);
+
+    // Fills: faces without any light first, then the resident ones round robin
+    mFreshFills.clear();
+    mRefreshFills.clear();
+    while (!mPending.empty() && mFreshFills.size() < (size_t)FILL_BUDGET)
+    {
+        uint32_t slot = mPending.front();
+        mPending.pop_front();
+        if (!mSlotPending[slot])
+            continue; // Freed or already filled since it was queued
+
+        // Marked ready now, the fill is drawn before this frame's raycast reads it
+        mSlotPending[slot] = 0;
+        size_t entry = Find(mSlotKey[slot]);
+        SetEntry(entry, mTable[2 * entry], slot);
+        mFreshFills.push_back({ mSlotKey[slot], slot });
+    }
+
+    size_t budget = FILL_BUDGET - mFreshFills.size();
+    for (uint32_t visited = 0; visited < mSlotHighWater && mRefreshFills.size() < budget; visited++)
+    {
+        uint32_t slot = mRefreshCursor;
+        mRefreshCursor = mRefreshCursor + 1 < mSlotHighWater ? mRefreshCursor + 1 : 0;
+        if (mSlotKey[slot] != FREE_SLOT && !mSlotPending[slot])
+            mRefreshFills.push_back({ mSlotKey[slot], slot });
+    }
+
+    mStats.residentFaces = 0;
+    for (const Chunk &c : mChunks)
+    {
+        mStats.residentChunks += c.resident;
+        mStats.residentFaces += c.keys.size();
+    }
+    mStats.pendingFaces = mPending.size();
+    mStats.freshFills = mFreshFills.size();
+    mStats.refreshFills = mRefreshFills.size();
+    mStats.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//################ GL ####
+
+void SurfaceCache::CreateTextures()
+{
+    glGenTextures(1, &AtlasTexture);
+    glBindTexture(GL_TEXTURE_2D, AtlasTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    // Lookups clamp to the block's texel centers, so filtering never bleeds into a neighbour
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(1, &mTableBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, mTableBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, mTable.size() * sizeof(uint32_t), mTable.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    mDirtyBegin = mDirtyEnd = 0;
+
+    glGenTextures(1, &TableTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, TableTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, mTableBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    std::cout << "[SurfaceCache] Atlas " << ATLAS_SIZE << "^2 for " << MAX_SLOTS << " faces, table "
+              << (mTable.size() * sizeof(uint32_t)) / (1024 * 1024) << " MB" << std::endl;
+}
+
+void SurfaceCache::UploadTable()
+{
+    if (mTableBuffer == 0 || mDirtyBegin == mDirtyEnd)
+        return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, mTableBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, mDirtyBegin * 2 * sizeof(uint32_t), (mDirtyEnd - mDirtyBegin) * 2 * sizeof(uint32_t),
+                    &mTable[2 * mDirtyBegin]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    mDirtyBegin = mDirtyEnd = 0;
+}
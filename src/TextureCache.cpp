@@ -0,0 +1,355 @@
+#include "TextureCache.h"
+#include "Hash.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+std::string TextureCache::sDirectory = "cache/textures/";
+
+// Bump whenever the blob layout or the mip filter changes
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+static const int MAX_CACHED_LEVELS = 16;
+
+struct BlobHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t levels;
+    double decodeMs;  // Thread CPU time of decode + mip build when the blob was written
+    uint64_t levelOffsets[MAX_CACHED_LEVELS];
+};
+
+static std::mutex sStatsMutex;
+static TextureCache::Stats sStats;
+
+//################ Read-only file mapping #############
+class MappedFile {
+public:
+    static std::shared_ptr<MappedFile> Open(const std::string &path)
+    {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+        file->mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file->mFile == INVALID_HANDLE_VALUE)
+            return nullptr;
+        LARGE_INTEGER size;
+        GetFileSizeEx(file->mFile, &size);
+        file->mSize = (size_t)size.QuadPart;
+        file->mMapping = CreateFileMappingA(file->mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!file->mMapping)
+            return nullptr;
+        file->mData = (const uint8_t*)MapViewOfFile(file->mMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        file->mFd = open(path.c_str(), O_RDONLY);
+        if (file->mFd < 0)
+            return nullptr;
+        struct stat info;
+        if (fstat(file->mFd, &info) != 0 || info.st_size == 0)
+            return nullptr;
+        file->mSize = (size_t)info.st_size;
+        void* data = mmap(nullptr, file->mSize, PROT_READ, MAP_PRIVATE, file->mFd, 0);
+        file->mData = data == MAP_FAILED ? nullptr : (const uint8_t*)data;
+#endif
+        return file->mData ? file : nullptr;
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (mData) UnmapViewOfFile(mData);
+        if (mMapping) CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+#else
+        if (mData) munmap((void*)mData, mSize);
+        if (mFd >= 0) close(mFd);
+#endif
+    }
+
+    const uint8_t* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+
+private:
+    MappedFile() = default;
+
+    const uint8_t* mData = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = nullptr;
+#else
+    int mFd = -1;
+#endif
+};
+
+//################ Hashing #############
+static uint64_t RequestKey(const std::vector<uint8_t> &source, const ImageRequest &request)
+{
+    int32_t params[] = { (int32_t)TEXTURE_CACHE_VERSION, request.flipVertically, request.desiredChannels,
+                         request.mipLevels, request.tilesX, request.tilesY, request.tilePadding };
+    uint64_t hash = Fnv1a(source.data(), source.size());
+    return Fnv1a(params, sizeof(params), hash);
+}
+
+static std::string BlobPath(const std::string &sourcePath)
+{
+    std::string name = sourcePath;
+    for (char &c : name)
+    {
+        if (c == '/' || c == '\\' || c == ':' || c == '.')
+            c = '_';
+    }
+    return TextureCache::sDirectory + name + ".texcache";
+}
+
+//################ Mip chain #############
+// 2x2 box filter that stays inside the atlas tile of the destination texel, so tiles never
+// bleed into their neighbours. Texels in the padding gutter copy the nearest tile interior texel.
+static void DownsampleLevel(const uint8_t* src, int srcW, int srcH, uint8_t* dst, int dstW, int dstH,
+                            int channels, const ImageRequest &request, int dstLevel)
+{
+    int srcTileW = srcW / request.tilesX, srcTileH = srcH / request.tilesY;
+    int dstTileW = dstW / request.tilesX, dstTileH = dstH / request.tilesY;
+    int srcPad = request.tilePadding >> (dstLevel - 1);
+    int dstPad = request.tilePadding >> dstLevel;
+
+    auto clampInterior = [](int v, int tile, int pad) {
+        if (tile <= 2 * pad) pad = 0;
+        return std::min(std::max(v, pad), tile - pad - 1);
+    };
+
+    for (int y = 0; y < dstH; y++)
+    {
+        int tileY = std::min(y / dstTileH, request.tilesY - 1);
+        int localY = clampInterior(y - tileY * dstTileH, dstTileH, dstPad);
+        int srcY0 = tileY * srcTileH + clampInterior(localY * 2, srcTileH, srcPad);
+        int srcY1 = tileY * srcTileH + clampInterior(localY * 2 + 1, srcTileH, srcPad);
+
+        for (int x = 0; x < dstW; x++)
+        {
+            int tileX = std::min(x / dstTileW, request.tilesX - 1);
+            int localX = clampInterior(x - tileX * dstTileW, dstTileW, dstPad);
+            int srcX0 = tileX * srcTileW + clampInterior(localX * 2, srcTileW, srcPad);
+            int srcX1 = tileX * srcTileW + clampInterior(localX * 2 + 1, srcTileW, srcPad);
+
+            const uint8_t* taps[4] = {
+                src + (srcY0 * srcW + srcX0) * channels, src + (srcY0 * srcW + srcX1) * channels,
+                src + (srcY1 * srcW + srcX0) * channels, src + (srcY1 * srcW + srcX1) * channels
+            };
+            uint8_t* out = dst + (y * dstW + x) * channels;
+
+            // Weight colour by alpha so fully transparent texels do not darken cutout edges
+            int alphaSum = 0;
+            if (channels == 4)
+            {
+                for (const uint8_t* tap : taps)
+                    alphaSum += tap[3];
+                out[3] = (uint8_t)((alphaSum + 2) / 4);
+            }
+            int colorChannels = channels == 4 ? 3 : channels;
+            for (int c = 0; c < colorChannels; c++)
+            {
+                int sum = 0;
+                if (alphaSum > 0)
+                {
+                    for (const uint8_t* tap : taps)
+                        sum += tap[c] * tap[3];
+                    out[c] = (uint8_t)((sum + alphaSum / 2) / alphaSum);
+                }
+                else
+                {
+                    for (const uint8_t* tap : taps)
+                        sum += tap[c];
+                    out[c] = (uint8_t)((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+static int LevelCountFor(const ImageRequest &request, int width, int height)
+{
+    int levels = 1;
+    while (levels < std::min(request.mipLevels, MAX_CACHED_LEVELS))
+    {
+        // Stop once a tile would shrink below a single texel
+        if ((width >> levels) < request.tilesX || (height >> levels) < request.tilesY)
+            break;
+        levels++;
+    }
+    return levels;
+}
+
+//################ Blob building #############
+static std::shared_ptr<std::vector<uint8_t>> BuildBlob(const stbi_uc* pixels, int width, int height, int channels,
+                                                       const ImageRequest &request, uint64_t key)
+{
+    BlobHeader header = {};
+    memcpy(header.magic, "VTXC", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.key = key;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.levels = LevelCountFor(request, width, height);
+
+    size_t offset = (sizeof(BlobHeader) + 15) & ~size_t(15);
+    for (int level = 0; level < header.levels; level++)
+    {
+        header.levelOffsets[level] = offset;
+        size_t levelSize = (size_t)std::max(1, width >> level) * std::max(1, height >> level) * channels;
+        offset = (offset + levelSize + 15) & ~size_t(15);
+    }
+
+    auto blob = std::make_shared<std::vector<uint8_t>>(offset);
+    memcpy(blob->data() + header.levelOffsets[0], pixels, (size_t)width * height * channels);
+    for (int level = 1; level < header.levels; level++)
+    {
+        DownsampleLevel(blob->data() + header.levelOffsets[level - 1], std::max(1, width >> (level - 1)), std::max(1, height >> (level - 1)),
+                        blob->data() + header.levelOffsets[level], std::max(1, width >> level), std::max(1, height >> level),
+                        channels, request, level);
+    }
+    memcpy(blob->data(), &header, sizeof(header));
+    return blob;
+}
+
+static DecodedImage ImageFromBlob(const std::string &path, const uint8_t* blob, std::shared_ptr<void> storage)
+{
+    const BlobHeader* header = (const BlobHeader*)blob;
+
+    DecodedImage image;
+    image.path = path;
+    image.width = header->width;
+    image.height = header->height;
+    image.channels = header->channels;
+    for (int level = 0; level < header->levels; level++)
+        image.levels.push_back(blob + header->levelOffsets[level]);
+    image.storage = storage;
+    return image;
+}
+
+static bool ReadSource(const std::string &path, std::vector<uint8_t> &bytes)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read((char*)bytes.data(), bytes.size());
+    return (bool)file;
+}
+
+DecodedImage TextureCache::Load(const ImageRequest &request, bool* fromCache)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto elapsedMs = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    // Decode cost is stored as thread CPU time, wall time is meaningless while the workers share cores
+    double cpuStart = StartupTimeline::ThreadCpuNow();
+    if (fromCache)
+        *fromCache = false;
+
+    std::vector<uint8_t> source;
+    if (!ReadSource(request.path, source))
+    {
+        DecodedImage missing;
+        missing.path = request.path;
+        return missing;
+    }
+
+    uint64_t key = RequestKey(source, request);
+    std::string blobPath = BlobPath(request.path);
+
+    //################ Cache hit: map the blob and hand it out as is #############
+    std::shared_ptr<MappedFile> mapped = MappedFile::Open(blobPath);
+    if (mapped && mapped->Size() >= sizeof(BlobHeader))
+    {
+        const BlobHeader* header = (const BlobHeader*)mapped->Data();
+        bool valid = memcmp(header->magic, "VTXC", 4) == 0 && header->version == TEXTURE_CACHE_VERSION &&
+                     header->key == key && header->levels > 0 && header->levels <= MAX_CACHED_LEVELS;
+        size_t lastLevelEnd = valid ? header->levelOffsets[header->levels - 1] +
+                                      (size_t)std::max(1, header->width >> (header->levels - 1)) *
+                                      std::max(1, header->height >> (header->levels - 1)) * header->channels : 0;
+        if (valid && lastLevelEnd <= mapped->Size())
+        {
+            DecodedImage image = ImageFromBlob(request.path, mapped->Data(), mapped);
+            if (fromCache)
+                *fromCache = true;
+
+            std::lock_guard<std::mutex> lock(sStatsMutex);
+            sStats.hits++;
+            sStats.hitLoadMs += elapsedMs();
+            sStats.decodeMsEliminated += header->decodeMs;
+            return image;
+        }
+    }
+    mapped.reset();
+
+    //################ Cache miss: decode, build the mip chain and write the blob #############
+    stbi_set_flip_vertically_on_load_thread(request.flipVertically);
+    int width, height, fileChannels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &fileChannels, request.desiredChannels);
+    if (!pixels)
+    {
+        DecodedImage broken;
+        broken.path = request.path;
+        return broken;
+    }
+    int channels = request.desiredChannels != 0 ? request.desiredChannels : fileChannels;
+
+    std::shared_ptr<std::vector<uint8_t>> blob = BuildBlob(pixels, width, height, channels, request, key);
+    stbi_image_free(pixels);
+
+    ((BlobHeader*)blob->data())->decodeMs = StartupTimeline::ThreadCpuNow() - cpuStart;
+
+    std::error_code error;
+    std::filesystem::create_directories(sDirectory, error);
+    std::string tmpPath = blobPath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        out.write((const char*)blob->data(), blob->size());
+    }
+    std::filesystem::rename(tmpPath, blobPath, error);
+    if (error)
+        std::cerr << "[TextureCache] Could not write " << blobPath << ": " << error.message() << std::endl;
+
+    std::lock_guard<std::mutex> lock(sStatsMutex);
+    sStats.misses++;
+    sStats.missBuildMs += elapsedMs();
+    return ImageFromBlob(request.path, blob->data(), blob);
+}
+
+TextureCache::Stats TextureCache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(sStatsMutex);
+    return sStats;
+}
+
+void TextureCache::PrintStats()
+{
+    Stats stats = GetStats();
+    std::cout << std::fixed << std::setprecision(1)
+              << "[TextureCache] " << stats.hits << " hits, " << stats.misses << " misses. Hits took "
+              << stats.hitLoadMs << " ms instead of " << stats.decodeMsEliminated << " ms decoding ("
+              << stats.decodeMsEliminated - stats.hitLoadMs << " ms eliminated), misses took "
+              << stats.missBuildMs << " ms" << std::endl << std::defaultfloat;
+}
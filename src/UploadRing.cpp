@@ -0,0 +1,261 @@
+#include "UploadRing.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// 16MB is enough to keep a couple of skybox face chunks in flight without waiting.
+static const size_t UPLOAD_RING_SIZE = 16 * 1024 * 1024;
+// Large uploads are split so one texture never needs the whole ring at once. Allocate relies on
+// no request being larger than this, rows that are go straight from client memory instead.
+static const size_t UPLOAD_CHUNK_SIZE = UPLOAD_RING_SIZE / 4;
+static const size_t UPLOAD_ALIGNMENT = 16;
+
+UploadRing& UploadRing::Get()
+{
+    // Created on first use, by then the GL context exists. Never destroyed since the
+    // context is already gone by the time static destructors would run.
+    static UploadRing* ring = new UploadRing(UPLOAD_RING_SIZE);
+    return *ring;
+}
+
+UploadRing::UploadRing(size_t capacity)
+    : mCapacity(capacity)
+{
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+
+    if (GLAD_GL_ARB_buffer_storage)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, mCapacity, nullptr, flags);
+        mMapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, mCapacity, flags);
+        mPersistent = mMapped != nullptr;
+    }
+
+    if (!mPersistent)
+    {
+        // Immutable storage can not be orphaned, start over with a mutable buffer
+        if (GLAD_GL_ARB_buffer_storage)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &mBuffer);
+            glGenBuffers(1, &mBuffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+        }
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, mCapacity, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    std::cout << "[UploadRing] " << (mCapacity >> 20) << "MB ring, "
+              << (mPersistent ? "persistent mapping" : "buffer orphaning") << std::endl;
+}
+
+size_t UploadRing::BytesPerPixel(GLenum format, GLenum type)
+{
+    // Packed types hold the whole pixel whatever the format
+    switch (type)
+    {
+        case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1: case GL_UNSIGNED_SHORT_5_6_5: return 2;
+        case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_10F_11F_11F_REV: return 4;
+        default: break;
+    }
+
+    size_t components = 4;
+    switch (format)
+    {
+        case GL_RED: case GL_RED_INTEGER: components = 1; break;
+        case GL_RG:  case GL_RG_INTEGER:  components = 2; break;
+        case GL_RGB: case GL_RGB_INTEGER: components = 3; break;
+        default: break;
+    }
+
+    size_t componentSize = 1;
+    switch (type)
+    {
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: componentSize = 2; break;
+        case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT:         componentSize = 4; break;
+        default: break;
+    }
+    return components * componentSize;
+}
+
+void UploadRing::RetireSignaled()
+{
+    while (!mRegions.empty())
+    {
+        GLenum status = glClientWaitSync(mRegions.front().fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(mRegions.front().fence);
+        mRegions.pop_front();
+    }
+}
+
+void UploadRing::WaitForRange(size_t begin, size_t end)
+{
+    // Fences signal in order, so waiting on the newest overlapping region covers all older ones
+    int last = -1;
+    for (int i = 0; i < (int)mRegions.size(); i++)
+    {
+        if (mRegions[i].begin < end && begin < mRegions[i].end)
+            last = i;
+    }
+    if (last < 0)
+        return;
+
+    GLsync fence = mRegions[last].fence;
+    if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        auto stop = std::chrono::steady_clock::now();
+
+        mStats.stalls++;
+        mStats.stallWaitMs += std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    for (int i = 0; i <= last; i++)
+    {
+        glDeleteSync(mRegions.front().fence);
+        mRegions.pop_front();
+    }
+}
+
+size_t UploadRing::Allocate(size_t size)
+{
+    size_t offset = (mHead + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+    bool wrapped = offset + size > mCapacity;
+    if (wrapped)
+        offset = 0;
+
+    if (mPersistent)
+    {
+        RetireSignaled();
+        WaitForRange(offset, offset + size);
+    }
+    else if (wrapped)
+    {
+        // Hand the old storage to the driver and carry on writing into fresh memory
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, mCapacity, nullptr, GL_STREAM_DRAW);
+        mStats.orphans++;
+    }
+
+    mHead = offset + size;
+    return offset;
+}
+
+void UploadRing::Write(size_t offset, const void* data, size_t size)
+{
+    if (mPersistent)
+    {
+        memcpy(mMapped + offset, data, size);
+        return;
+    }
+
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, access);
+    if (dst)
+    {
+        memcpy(dst, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+}
+
+void UploadRing::Fence(size_t begin, size_t end)
+{
+    if (!mPersistent)
+        return;
+    mRegions.push_back({begin, end, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+}
+
+void UploadRing::TexImage2D(GLenum target, GLint level, GLint internalFormat, int width, int height,
+                            GLenum format, const void* data, GLenum type)
+{
+    glTexImage2D(target, level, internalFormat, width, height, 0, format, type, nullptr);
+    if (data)
+        TexSubImage2D(target, level, 0, 0, width, height, format, data, type);
+}
+
+void UploadRing::TexSubImage2D(GLenum target, GLint level, int x, int y, int width, int height,
+                               GLenum format, const void* data, GLenum type)
+{
+    size_t rowBytes = (size_t)width * BytesPerPixel(format, type);
+    const uint8_t* src = (const uint8_t*)data;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (rowBytes > UPLOAD_CHUNK_SIZE)
+    {
+        glTexSubImage2D(target, level, x, y, width, height, format, type, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        mStats.uploads++;
+        return;
+    }
+
+    int rowsPerChunk = (int)(UPLOAD_CHUNK_SIZE / rowBytes);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+    for (int row = 0; row < height; row += rowsPerChunk)
+    {
+        int rows = std::min(rowsPerChunk, height - row);
+        size_t size = rows * rowBytes;
+        size_t offset = Allocate(size);
+
+        Write(offset, src + row * rowBytes, size);
+        glTexSubImage2D(target, level, x, y + row, width, rows, format, type, (void*)offset);
+        Fence(offset, offset + size);
+
+        mStats.bytesStreamed += size;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    mStats.uploads++;
+}
+
+void UploadRing::TexImage3D(GLenum target, GLint level, GLint internalFormat, int width, int height, int depth,
+                            GLenum format, const void* data, GLenum type)
+{
+    glTexImage3D(target, level, internalFormat, width, height, depth, 0, format, type, nullptr);
+    if (data)
+        TexSubImage3D(target, level, 0, 0, 0, width, height, depth, format, data, type);
+}
+
+void UploadRing::TexSubImage3D(GLenum target, GLint level, int x, int y, int z, int width, int height, int depth,
+                               GLenum format, const void* data, GLenum type)
+{
+    size_t rowBytes = (size_t)width * BytesPerPixel(format, type);
+    size_t sliceBytes = rowBytes * height;
+    const uint8_t* src = (const uint8_t*)data;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (rowBytes > UPLOAD_CHUNK_SIZE)
+    {
+        glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        mStats.uploads++;
+        return;
+    }
+
+    // Whole slices per chunk, or a few rows of one slice when a slice alone is larger than a chunk
+    int slicesPerChunk = (int)std::max<size_t>(1, UPLOAD_CHUNK_SIZE / sliceBytes);
+    int rowsPerChunk = sliceBytes > UPLOAD_CHUNK_SIZE ? (int)(UPLOAD_CHUNK_SIZE / rowBytes) : height;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+    for (int slice = 0; slice < depth; slice += slicesPerChunk)
+    {
+        int slices = std::min(slicesPerChunk, depth - slice);
+        for (int row = 0; row < height; row += rowsPerChunk)
+        {
+            int rows = std::min(rowsPerChunk, height - row);
+            size_t size = slices * rows * rowBytes;
+            size_t offset = Allocate(size);
+
+            Write(offset, src + slice * sliceBytes + row * rowBytes, size);
+            glTexSubImage3D(target, level, x, y + row, z + slice, width, rows, slices, format, type, (void*)offset);
+            Fence(offset, offset + size);
+
+            mStats.bytesStreamed += size;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    mStats.uploads++;
+}
@@ -0,0 +1,239 @@
+#include "VoxelMesher.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+void VoxelMesher::Init(int worldSize)
+{
+    mWorldSize = worldSize;
+    mChunksPerAxis = worldSize / CHUNK_SIZE;
+    size_t chunkCount = (size_t)mChunksPerAxis * mChunksPerAxis * mChunksPerAxis;
+    mDirty.assign(chunkCount, true);
+    mDirtyCount = chunkCount;
+    mMeshes.assign(chunkCount, ChunkMesh());
+}
+
+void VoxelMesher::MarkDirty(int x, int y, int z)
+{
+    if (!IsInitialized())
+        return;
+
+    glm::ivec3 voxel(x, y, z);
+    glm::ivec3 chunk = voxel / CHUNK_SIZE;
+    glm::ivec3 local = voxel % CHUNK_SIZE;
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                // Only the neighbours across a face the voxel touches see it in their border
+                glm::ivec3 offset(dx, dy, dz);
+                bool touches = true;
+                for (int axis = 0; axis < 3; axis++)
+                    touches &= offset[axis] == 0 || local[axis] == (offset[axis] < 0 ? 0 : CHUNK_SIZE - 1);
+                glm::ivec3 neighbour = chunk + offset;
+                if (!touches || glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(mChunksPerAxis))))
+                    continue;
+
+                size_t index = neighbour.x + neighbour.y * mChunksPerAxis + (size_t)neighbour.z * mChunksPerAxis * mChunksPerAxis;
+                if (!mDirty[index]) {
+                    mDirty[index] = true;
+                    mDirtyCount++;
+                }
+            }
+}
+
+glm::ivec3 VoxelMesher::ChunkOrigin(int chunk) const
+{
+    return glm::ivec3(chunk % mChunksPerAxis, (chunk / mChunksPerAxis) % mChunksPerAxis, chunk / (mChunksPerAxis * mChunksPerAxis)) * CHUNK_SIZE;
+}
+
+// Sweeps every face direction slice by slice. Each slice gets a mask of the visible faces and
+// their materials, which is then covered by the largest rectangles of one material.
+void VoxelMesher::MeshChunk(ChunkJob &job)
+{
+    auto voxelAt = [&](glm::ivec3 p) {
+        return job.voxels[(p.x + 1) + (p.y + 1) * PADDED_SIZE + (size_t)(p.z + 1) * PADDED_SIZE * PADDED_SIZE];
+    };
+    auto pack = [](glm::ivec3 p, int face, uint8_t material) {
+        return (uint32_t)p.x | ((uint32_t)p.y << 6) | ((uint32_t)p.z << 12) | ((uint32_t)face << 18) | ((uint32_t)material << 24);
+    };
+
+    uint8_t mask[CHUNK_SIZE * CHUNK_SIZE];
+    job.vertices.clear();
+
+    for (int face = 0; face < 6; face++)
+    {
+        int axis = face / 2;
+        int sign = face % 2 == 0 ? 1 : -1;
+        // u x v = axis, so corners in u, v order wind counter-clockwise seen from the +axis side
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        glm::ivec3 normal(0);
+        normal[axis] = sign;
+
+        for (int d = 0; d < CHUNK_SIZE; d++)
+        {
+            for (int j = 0; j < CHUNK_SIZE; j++)
+                for (int i = 0; i < CHUNK_SIZE; i++)
+                {
+                    glm::ivec3 p(0);
+                    p[axis] = d; p[u] = i; p[v] = j;
+                    uint8_t material = voxelAt(p);
+                    mask[i + j * CHUNK_SIZE] = material != 0 && voxelAt(p + normal) == 0 ? material : 0;
+                }
+
+            for (int j = 0; j < CHUNK_SIZE; j++)
+                for (int i = 0; i < CHUNK_SIZE; )
+                {
+                    uint8_t material = mask[i + j * CHUNK_SIZE];
+                    if (material == 0) {
+                        i++;
+                        continue;
+                    }
+
+                    int width = 1;
+                    while (i + width < CHUNK_SIZE && mask[i + width + j * CHUNK_SIZE] == material)
+                        width++;
+                    int height = 1;
+                    for (; j + height < CHUNK_SIZE; height++) {
+                        bool rowMatches = true;
+                        for (int k = 0; k < width && rowMatches; k++)
+                            rowMatches = mask[i + k + (j + height) * CHUNK_SIZE] == material;
+                        if (!rowMatches)
+                            break;
+                    }
+                    for (int h = 0; h < height; h++)
+                        std::fill_n(mask + i + (j + h) * CHUNK_SIZE, width, 0);
+
+                    glm::ivec3 corners[4];
+                    for (int c = 0; c < 4; c++) {
+                        corners[c][axis] = d + (sign > 0 ? 1 : 0);
+                        corners[c][u] = i + (c == 1 || c == 2 ? width : 0);
+                        corners[c][v] = j + (c >= 2 ? height : 0);
+                    }
+                    static const int ccw[6] = { 0, 1, 2, 0, 2, 3 };
+                    static const int cw[6]  = { 0, 2, 1, 0, 3, 2 };
+                    for (int c : (sign > 0 ? ccw : cw))
+                        job.vertices.push_back(pack(corners[c], face, material));
+
+                    i += width;
+                }
+        }
+    }
+}
+
+std::vector<VoxelMesher::ChunkJob> VoxelMesher::MeshBatch(std::vector<ChunkJob> jobs)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t j = next++; j < jobs.size(); j = next++)
+            MeshChunk(jobs[j]);
+    };
+    int workerCount = std::max(1, std::min((int)std::thread::hardware_concurrency(), (int)jobs.size()));
+    std::vector<std::future<void>> workers;
+    for (int w = 1; w < workerCount; w++)
+        workers.push_back(std::async(std::launch::async, worker));
+    worker();
+    for (auto &w : workers)
+        w.get();
+    return jobs;
+}
+
+void VoxelMesher::Update(const std::vector<uint8_t> &voxels)
+{
+    if (!IsInitialized())
+        return;
+
+    if (mJob.valid()) {
+        if (mJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        for (const ChunkJob &job : mJob.get())
+            Upload(job);
+        mLastJobMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mJobStart).count();
+    }
+
+    if (mDirtyCount == 0)
+        return;
+
+    // Snapshot the dirty chunks with their borders, the workers never touch the live voxels
+    std::vector<ChunkJob> jobs;
+    for (int chunk = 0; chunk < (int)mDirty.size(); chunk++)
+    {
+        if (!mDirty[chunk])
+            continue;
+        mDirty[chunk] = false;
+
+        ChunkJob job;
+        job.chunk = chunk;
+        job.voxels.assign((size_t)PADDED_SIZE * PADDED_SIZE * PADDED_SIZE, 0);
+        glm::ivec3 origin = ChunkOrigin(chunk) - 1;
+        for (int z = 0; z < PADDED_SIZE; z++)
+            for (int y = 0; y < PADDED_SIZE; y++)
+            {
+                int wy = origin.y + y, wz = origin.z + z;
+                if (wy < 0 || wy >= mWorldSize || wz < 0 || wz >= mWorldSize)
+                    continue;
+                for (int x = 0; x < PADDED_SIZE; x++)
+                {
+                    int wx = origin.x + x;
+                    if (wx >= 0 && wx < mWorldSize)
+                        job.voxels[x + y * PADDED_SIZE + (size_t)z * PADDED_SIZE * PADDED_SIZE] = voxels[wx + wy * mWorldSize + (size_t)wz * mWorldSize * mWorldSize];
+                }
+            }
+        jobs.push_back(std::move(job));
+    }
+    mDirtyCount = 0;
+    mRemeshes += jobs.size();
+
+    mJobStart = std::chrono::steady_clock::now();
+    mJob = std::async(std::launch::async, MeshBatch, std::move(jobs));
+}
+
+void VoxelMesher::Upload(const ChunkJob &job)
+{
+    ChunkMesh &mesh = mMeshes[job.chunk];
+    if (mesh.vao == 0) {
+        glGenVertexArrays(1, &mesh.vao);
+        glGenBuffers(1, &mesh.vbo);
+        glBindVertexArray(mesh.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, job.vertices.size() * sizeof(uint32_t), job.vertices.data(), GL_STATIC_DRAW);
+    mesh.vertexCount = (GLsizei)job.vertices.size();
+}
+
+void VoxelMesher::Draw(GLint chunkOriginLocation, const std::vector<bool> &visible) const
+{
+    for (size_t chunk = 0; chunk < mMeshes.size(); chunk++)
+    {
+        const ChunkMesh &mesh = mMeshes[chunk];
+        if (mesh.vertexCount == 0 || !visible[chunk])
+            continue;
+        glm::vec3 origin(ChunkOrigin((int)chunk));
+        glUniform3f(chunkOriginLocation, origin.x, origin.y, origin.z);
+        glBindVertexArray(mesh.vao);
+        glDrawArrays(GL_TRIANGLES, 0, mesh.vertexCount);
+    }
+    glBindVertexArray(0);
+}
+
+VoxelMesher::Stats VoxelMesher::GetStats() const
+{
+    Stats stats;
+    stats.chunks = mMeshes.size();
+    for (const ChunkMesh &mesh : mMeshes)
+    {
+        stats.meshedChunks += mesh.vao != 0 ? 1 : 0;
+        stats.quads += mesh.vertexCount / 6;
+        stats.vertexBytes += mesh.vertexCount * sizeof(uint32_t);
+    }
+    stats.remeshes = mRemeshes;
+    stats.lastJobMs = mLastJobMs;
+    return stats;
+}
@@ -4,28 +4,118 @@
 #include <SDL2/SDL.h>
 #include <iostream>
 #include <cstdlib> // for rand()
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
 #include "VoxelTerrain.h"
 #include "BillboardSprite.h"
+#include "UploadRing.h"
+
+// Mipmapped textures are clamped to this level, so that is all the texture cache has to precompute
+static const int TEXTURE_MAX_LEVEL = 3;
+
+// Voxel spritesheet layout: one row per voxel ID, side texture in the left column and top/bottom in the right
+static const int VOXEL_SHEET_TILES_X  = 2;
+static const int VOXEL_SHEET_TILES_Y  = 7;
+static const int VOXEL_SHEET_PADDING  = 0;
+
+// Dynamic resolution: scale granularity per axis, frames between rescales and weight of a new GPU time
+static const float RENDER_SCALE_STEP = 0.05f;
+static const int RESCALE_INTERVAL = 20;
+static const float GPU_TIME_SMOOTHING = 0.1f;
+
+// Edge length in pixels of the tiles the coarse prepass finds a common ray start for
+static const int PREPASS_TILE_SIZE = 8;
+
+// Surface cache: samples averaged into a block on its first fill, weight of every later refresh
+static const int SURFACE_CACHE_FRESH_SAMPLES = 8;
+static const float SURFACE_CACHE_BLEND = 0.25f;
+
+// Camera moves further than this between frames are treated as cuts and drop the ray start history
+static const float REPROJECTION_MAX_MOVE = 8.0f;
+
+// Frustum planes from the rows of the view projection, normals pointing inwards
+static void FrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    for (int i = 0; i < 3; i++) {
+        glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        planes[i * 2] = w + row;
+        planes[i * 2 + 1] = w - row;
+    }
+}
+
+// A box is culled when it lies entirely behind one of the planes
+static bool BoxInFrustum(const glm::vec4 planes[6], const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (int p = 0; p < 6; p++) {
+        const glm::vec4& plane = planes[p];
+        // Corner furthest along the plane normal
+        glm::vec3 corner(plane.x > 0.0f ? boxMax.x : boxMin.x,
+                         plane.y > 0.0f ? boxMax.y : boxMin.y,
+                         plane.z > 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+VoxelRenderer::Assets VoxelRenderer::DecodeAssets(StartupTimeline* timeline)
+{
+    ImageRequest floor { "textures/voxels/FloorTexture.png", false, 3, TEXTURE_MAX_LEVEL + 1 };
+    ImageRequest wall  { "textures/voxels/WallTexture.png", false, 3, TEXTURE_MAX_LEVEL + 1 };
+    ImageRequest billboardSheet { "textures/sprites/spritesheet.png", true, 4 };
+    ImageRequest voxelSheet { "textures/sprites/voxelspritesheet_pad_v2.png", true, 4, TEXTURE_MAX_LEVEL + 1,
+                              VOXEL_SHEET_TILES_X, VOXEL_SHEET_TILES_Y, VOXEL_SHEET_PADDING };
+
+    Assets assets;
+    assets.floorTexture         = DecodeImageAsync(floor, timeline);
+    assets.wallTexture          = DecodeImageAsync(wall, timeline);
+    assets.billboardSpriteSheet = DecodeImageAsync(billboardSheet, timeline);
+    assets.voxelSpriteSheet     = DecodeImageAsync(voxelSheet, timeline);
+    assets.skyboxFaces          = SkyBox::DecodeFaces(timeline);
+    return assets;
+}
+
+void VoxelRenderer::Assets::Wait()
+{
+    floorTexture.wait();
+    wallTexture.wait();
+    billboardSpriteSheet.wait();
+    voxelSpriteSheet.wait();
+    for (auto& face : skyboxFaces)
+        face.wait();
+}
 
 VoxelRenderer::VoxelRenderer(int width, int height, VoxelTerrain *terrain)
-    : mScreenWidth(width), mScreenHeight(height)
+    : VoxelRenderer(width, height, terrain, DecodeAssets())
+{
+}
+
+VoxelRenderer::VoxelRenderer(int width, int height, VoxelTerrain *terrain, Assets assets)
+    : mScreenWidth(width), mScreenHeight(height), mRenderWidth(width), mRenderHeight(height), skyBox(assets.skyboxFaces)
 {
     mTerrain = terrain;
     Init();
 
-    loadTexture("textures/voxels/FloorTexture.png", voxelSurfaceTexture_floor,false);
-    loadTexture("textures/voxels/WallTexture.png", voxelSurfaceTexture_wall,false);
-    loadTexture("textures/sprites/spritesheet.png", billboardSpriteTexture,true,true,false);
-    loadTexture("textures/sprites/voxelspritesheet_pad_v2.png", voxelSpriteSheet,true,true, true);
+    loadTexture(assets.floorTexture.get(), voxelSurfaceTexture_floor);
+    loadTexture(assets.wallTexture.get(), voxelSurfaceTexture_wall);
+    loadTexture(assets.billboardSpriteSheet.get(), billboardSpriteTexture,true,false);
 
-    tilesPerRow = 2;
-    tilesPerCol = 7;
+    // Alpha tests go through the material table, the tiles only get sampled to shade hits
+    DecodedImage voxelSheet = assets.voxelSpriteSheet.get();
+    if (!voxelSheet.Valid()) {
+        std::cerr << "[VoxelRenderer] Error loading:" << voxelSheet.path.c_str() << std::endl;
+        exit(1);
+    }
+    mMaterials.Build(voxelSheet, VOXEL_SHEET_TILES_X, VOXEL_SHEET_TILES_Y);
+    mMaterials.CreateBuffer();
+    mMaterials.CreateTileArray(voxelSheet, TEXTURE_MAX_LEVEL);
 
     int spriteTilesPerCol = 10;
     int spriteTilesPerRow = 10;
-    
-    VoxelScaleX = 1.0f / tilesPerRow;
-    VoxelScaleY = 1.0f / tilesPerCol;
     // glm::vec2 uvVoxelScale = spriteScale;
     
     glm::vec2 spriteScale(1.0f / spriteTilesPerRow, 1.0f / spriteTilesPerCol);
@@ -45,12 +135,101 @@ VoxelRenderer::VoxelRenderer(int width, int height, VoxelTerrain *terrain)
 
 }
 
+ShaderDefines VoxelRenderer::RaycastDefines() const
+{
+    ShaderDefines defines;
+    // Fixed for the lifetime of the renderer, baked in so the compiler can fold them
+    defines["VOXEL_WORLD_SIZE"] = std::to_string(mTerrain->VoxelWorldSize);
+    defines["VOXEL_SHEET_TILES_X"] = std::to_string(VOXEL_SHEET_TILES_X);
+    defines["VOXEL_SHEET_TILES_Y"] = std::to_string(VOXEL_SHEET_TILES_Y);
+    defines["MATERIAL_MASK_SIZE"] = std::to_string(MaterialTable::MASK_SIZE);
+    defines["OCCUPANCY_LEVELS"] = std::to_string(mTerrain->Occupancy.GetLevelCount());
+    defines["LOD_LEVELS"] = std::to_string(mTerrain->MaterialLevels.GetLevelCount());
+    defines["BRICK_ATLAS_BRICKS"] = std::to_string(BrickMap::ATLAS_BRICKS_PER_AXIS);
+    defines["OCTREE_LEVELS"] = std::to_string(mTerrain->Octree.GetLevelCount());
+
+    defines["MAX_STEPS"] = std::to_string(mQuality.maxSteps);
+    defines["MAX_LIGHT_STEPS"] = std::to_string(mQuality.maxLightSteps);
+    defines["MAX_RAYTRACE_RANGE"] = std::to_string(mQuality.maxRaytraceRange);
+    defines["CAMERA_POINTLIGHT"] = mQuality.cameraPointLight ? "1" : "0";
+    defines["RAYTRACED_SHADOWS"] = mQuality.raytracedShadows ? "1" : "0";
+    defines["BAKED_SUN_VISIBILITY"] = mQuality.bakedSunVisibility ? "1" : "0";
+    defines["FLOOD_LIGHT"] = mQuality.floodLight ? "1" : "0";
+    defines["AMBIENT_OCCLUSION"] = mQuality.ambientOcclusion ? "1" : "0";
+    defines["CLUSTERED_LIGHTS"] = mQuality.clusteredLights ? "1" : "0";
+    defines["CLUSTER_GRID_X"] = std::to_string(ClusteredLights::GRID_X);
+    defines["CLUSTER_GRID_Y"] = std::to_string(ClusteredLights::GRID_Y);
+    defines["CLUSTER_GRID_Z"] = std::to_string(ClusteredLights::GRID_Z);
+    defines["SURFACE_CACHE"] = mQuality.surfaceCache && mSurfaceCacheSupported ? "1" : "0";
+    defines["SURFACE_TEXELS"] = std::to_string(SurfaceCache::TEXELS_PER_FACE);
+    defines["SURFACE_ATLAS_SIZE"] = std::to_string(SurfaceCache::ATLAS_SIZE);
+    defines["SURFACE_TABLE_BITS"] = std::to_string(SurfaceCache::TABLE_BITS);
+    defines["SURFACE_MAX_PROBES"] = std::to_string(SurfaceCache::MAX_PROBES);
+    defines["EMPTY_SPACE_SKIPPING"] = std::to_string(mQuality.emptySpaceSkipping);
+    defines["OCCUPANCY_BITS"] = mQuality.occupancyBits ? "1" : "0";
+    defines["VOXEL_STORAGE"] = std::to_string(mQuality.voxelStorage);
+    defines["COARSE_PREPASS"] = mQuality.coarsePrepass ? "1" : "0";
+    defines["PREPASS_TILE_SIZE"] = std::to_string(PREPASS_TILE_SIZE);
+    defines["TEMPORAL_REPROJECTION"] = mQuality.temporalReprojection ? "1" : "0";
+    defines["CHUNK_PROXIES"] = mQuality.chunkProxies ? "1" : "0";
+    defines["LOD_DISTANCE"] = std::to_string(mQuality.lodDistance);
+    defines["RAYCAST_STEP_HEATMAP"] = mQuality.stepHeatmap ? "1" : "0";
+    defines["CHECKERBOARD"] = mQuality.checkerboard ? "1" : "0";
+    return defines;
+}
+
+// The raycast program of one pass, see RAYCAST_PASS in voxel_raycast.frag
+ShaderDefines VoxelRenderer::RaycastPassDefines(int pass) const
+{
+    ShaderDefines defines = RaycastDefines();
+    defines["RAYCAST_PASS"] = std::to_string(pass);
+    return defines;
+}
+
+bool VoxelRenderer::IsVisibilityBufferActive() const
+{
+    return mQuality.visibilityBuffer && !mQuality.stepHeatmap && mVisibilityBufferSupported;
+}
+
+void VoxelRenderer::SetRaycastQuality(const RaycastQuality &quality)
+{
+    mQuality = quality;
+    mShader->setDefines(RaycastPassDefines(IsVisibilityBufferActive() ? PASS_VISIBILITY : PASS_FORWARD));
+    mShadeShader->setDefines(RaycastPassDefines(PASS_SHADE));
+    mMeshShader->setDefines(RaycastDefines());
+    mSurfaceCacheShader->setDefines(RaycastDefines());
+    // The cached light was filled with the old lighting terms
+    if (mTerrain->Cache.IsInitialized())
+        mTerrain->Cache.InvalidateAll();
+}
+
 void VoxelRenderer::Init() {
-    mShader = new Shader("shaders/voxel_raycast.vert", "shaders/voxel_raycast.frag");
+    // Before the first RaycastDefines, they depend on it
+    GLint textureUnits = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &textureUnits);
+    mSurfaceCacheSupported = textureUnits >= 18;
+    if (!mSurfaceCacheSupported)
+        std::cout << "[SurfaceCache] Warning: " << textureUnits << " texture units, the raycast needs 18 for the cache, it stays off" << std::endl;
+    mVisibilityBufferSupported = mTerrain->VoxelWorldSize <= 512;
+    if (!mVisibilityBufferSupported)
+        std::cout << "[VisibilityBuffer] Warning: a world of " << mTerrain->VoxelWorldSize << " voxels does not fit the 9 bit hit record coordinates, the raycast shades in one pass" << std::endl;
+
+    mRaycastPass = IsVisibilityBufferActive() ? PASS_VISIBILITY : PASS_FORWARD;
+    mShader = new Shader("shaders/voxel_raycast.vert", "shaders/voxel_raycast.frag", RaycastPassDefines(mRaycastPass));
+    mShadeShader = new Shader("shaders/voxel_raycast.vert", "shaders/voxel_raycast.frag", RaycastPassDefines(PASS_SHADE));
     mBillboardShader = new Shader("shaders/billboard.vert", "shaders/billboard.frag");
     mSkyboxShader = new Shader("shaders/skybox.vert","shaders/skybox.frag");
+    mProxyShader = new Shader("shaders/voxel_proxy.vert", "shaders/voxel_proxy.frag");
+    mMeshShader = new Shader("shaders/voxel_mesh.vert", "shaders/voxel_mesh.frag", RaycastDefines());
+    mSurfaceCacheShader = new Shader("shaders/surface_cache.vert", "shaders/surface_cache.frag", RaycastDefines());
+    mResolveShader = new Shader("shaders/voxel_raycast.vert", "shaders/checkerboard_resolve.frag");
+    mPrepassShader = new Shader("shaders/voxel_raycast.vert", "shaders/voxel_prepass.frag",
+                                ShaderDefines{ { "VOXEL_WORLD_SIZE", std::to_string(mTerrain->VoxelWorldSize) },
+                                               { "PREPASS_TILE_SIZE", std::to_string(PREPASS_TILE_SIZE) } });
 
     InitFullscreenQuad();
+    InitChunkProxies();
+    InitSurfaceCache();
 
     //Create an explicit framebuffer instead of using the default one so we can attach a depthbuffer.
     //We will write to it in the voxelrenderer fragmentshader
@@ -66,27 +245,54 @@ void VoxelRenderer::Init() {
 
     glGenTextures(1, &mColorTexture);
     glBindTexture(GL_TEXTURE_2D, mColorTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mScreenWidth, mScreenHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mRenderWidth, mRenderHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mColorTexture, 0);
 
     glGenTextures(1, &mDepthTexture);
     glBindTexture(GL_TEXTURE_2D, mDepthTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mScreenWidth, mScreenHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mRenderWidth, mRenderHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture, 0);
     
+    // Ray start history, attached as the second target of mFBO while the raycast draws.
+    // Sized by InitTraceTargets, like the hit records.
+    glGenTextures(2, mHistoryTextures);
+    for (unsigned int history : mHistoryTextures) {
+        glBindTexture(GL_TEXTURE_2D, history);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    InitVisibilityBuffer();
+    InitTraceTargets(mQuality.checkerboard);
+
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cerr << "[VoxelRenderer] FBO incomplete!" << std::endl;
 
+    // One texel per prepass tile, the safe distance every ray of the tile can start at
+    mPrepassWidth = (mRenderWidth + PREPASS_TILE_SIZE - 1) / PREPASS_TILE_SIZE;
+    mPrepassHeight = (mRenderHeight + PREPASS_TILE_SIZE - 1) / PREPASS_TILE_SIZE;
+    glGenFramebuffers(1, &mPrepassFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mPrepassFBO);
+    glGenTextures(1, &mPrepassTexture);
+    glBindTexture(GL_TEXTURE_2D, mPrepassTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mPrepassWidth, mPrepassHeight, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mPrepassTexture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "[VoxelRenderer] Prepass FBO incomplete!" << std::endl;
+
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGenQueries(FRAME_QUERIES, mFrameQueries);
 
     voxels = mTerrain->getVoxels();
     glGenTextures(1, &voxelTexture);
     glBindTexture(GL_TEXTURE_3D, voxelTexture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, mTerrain->VoxelWorldSize, mTerrain->VoxelWorldSize, mTerrain->VoxelWorldSize, 0, GL_RED, GL_UNSIGNED_BYTE, voxels.data());
+    UploadRing::Get().TexImage3D(GL_TEXTURE_3D, 0, GL_R8, mTerrain->VoxelWorldSize, mTerrain->VoxelWorldSize, mTerrain->VoxelWorldSize, GL_RED, voxels.data());
     
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -95,21 +301,30 @@ void VoxelRenderer::Init() {
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);      
     
     
+    mTerrain->Occupancy.CreateTexture();
+    mTerrain->MaterialLevels.CreateTexture();
+    mTerrain->Sun.CreateTexture();
+    mTerrain->Light.CreateTexture();
+    mTerrain->AO.CreateTexture();
+    mLights.CreateBuffer();
+    mTerrain->SolidBits.CreateTexture();
+    mTerrain->Distance.CreateTexture();
+    mTerrain->Bricks.CreateTextures();
+    mTerrain->Octree.CreateTexture();
+
     mTerrain->VoxelTexture = voxelTexture;
-    mTerrain->mFBO = mFBO;
 }
 
 void VoxelRenderer::loadTexture(const std::string &path, GLuint &textureRef, bool flipVertically, bool isRGBA, bool useMipMap){
 
-    int w, h, n;
-    stbi_uc* colorData;
-    stbi_set_flip_vertically_on_load(flipVertically);
-
     int desiredChannels = isRGBA ? 4 : 3;
-    colorData = stbi_load(path.c_str(), &w, &h, &n, desiredChannels);
-     
-    if (!colorData) {
-        std::cerr << "[VoxelRenderer] Error loading:" << path.c_str() << std::endl;
+    loadTexture(DecodeImage(path, flipVertically, desiredChannels), textureRef, isRGBA, useMipMap);
+}
+
+void VoxelRenderer::loadTexture(const DecodedImage &image, GLuint &textureRef, bool isRGBA, bool useMipMap){
+
+    if (!image.Valid()) {
+        std::cerr << "[VoxelRenderer] Error loading:" << image.path.c_str() << std::endl;
         exit(1);
     }
     
@@ -121,94 +336,1043 @@ void VoxelRenderer::loadTexture(const std::string &path, GLuint &textureRef, boo
     glGenTextures(1, &textureRef);
     glBindTexture(GL_TEXTURE_2D, textureRef);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_UNSIGNED_BYTE, colorData);
+    // Precomputed mip chains (texture cache) are uploaded level by level, otherwise let the driver build them
+    for (int level = 0; level < image.LevelCount(); level++)
+        UploadRing::Get().TexImage2D(GL_TEXTURE_2D, level, internalFormat, image.LevelWidth(level), image.LevelHeight(level), format, image.Level(level));
 
-    if(useMipMap)
+    int maxLevel = TEXTURE_MAX_LEVEL;
+    if (image.LevelCount() > 1)
+        maxLevel = std::min(maxLevel, image.LevelCount() - 1);
+    else if(useMipMap)
         glGenerateMipmap(GL_TEXTURE_2D);
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 3);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter); // Or GL_NEAREST
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    stbi_image_free(colorData);
 }
 
 
 void VoxelRenderer::RenderVoxels(const Camera& camera) 
 {
+    UpdateRenderScale();
+    glBeginQuery(GL_TIME_ELAPSED, mFrameQueries[mFrameQueryIndex]);
+
     glClearColor(0.529, 0.808, 0.922, 1.0);
     glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
-    glViewport(0, 0, mScreenWidth, mScreenHeight);
+    glViewport(0, 0, mRenderWidth, mRenderHeight);
     glEnable(GL_DEPTH_TEST);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glm::mat4 projection = camera.GetProjectionMatrix();
     glm::mat4 view = camera.GetViewMatrix();
 
+    mTerrain->updateLighting();
+    if (mQuality.clusteredLights)
+        GatherLights(camera, projection, view);
+    if (mQuality.surfaceCache && mSurfaceCacheSupported)
+        FillSurfaceCache(camera);
+    if (mBackend == BACKEND_MESH)
+        RenderMeshes(camera, projection, view);
+    else
+        RaycastVoxels(camera, projection, view);
+
+    //################ DRAW BILLBOARDS/SPRITES #############
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    for (auto& sprite : mSprites) {  // store your sprites as a member
+        sprite.Draw(view, projection, camera.mEye);
+    }
+    glDisable(GL_BLEND);
+
+    
+    RenderSkyBox(projection,view);
+    
+
+    // TEMP copy raycast buffer to main to see
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    if (mRenderWidth == mScreenWidth && mRenderHeight == mScreenHeight)
+    {
+        glBlitFramebuffer(0, 0, mRenderWidth, mRenderHeight,
+                          0, 0, mScreenWidth, mScreenHeight,
+                          GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+                          GL_NEAREST);
+    }
+    else
+    {
+        // Upscaled to the window, depth can only be blitted unfiltered
+        glBlitFramebuffer(0, 0, mRenderWidth, mRenderHeight,
+                          0, 0, mScreenWidth, mScreenHeight,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBlitFramebuffer(0, 0, mRenderWidth, mRenderHeight,
+                          0, 0, mScreenWidth, mScreenHeight,
+                          GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0); // back to default framebuffer
+
+    glEndQuery(GL_TIME_ELAPSED);
+    mFrameQueryIndex = (mFrameQueryIndex + 1) % FRAME_QUERIES;
+    mFrameQueriesIssued++;
+}
+
+void VoxelRenderer::SetScreenSize(int width, int height)
+{
+    if (width <= 0 || height <= 0 || (width == mScreenWidth && height == mScreenHeight))
+        return;
+    mScreenWidth = width;
+    mScreenHeight = height;
+    ResizeRenderTargets(std::max(1, (int)(width * mRenderScale + 0.5f)), std::max(1, (int)(height * mRenderScale + 0.5f)));
+    std::cout << "[VoxelRenderer] Screen " << width << "x" << height << ", rendering at " << mRenderWidth << "x"
+              << mRenderHeight << std::endl;
+}
+
+void VoxelRenderer::SetDynamicResolution(const DynamicResolution& settings)
+{
+    mDynamicResolution = settings;
+    mDynamicResolution.minScale = glm::clamp(settings.minScale, RENDER_SCALE_STEP, 1.0f);
+    mDynamicResolution.maxScale = glm::clamp(settings.maxScale, mDynamicResolution.minScale, 1.0f);
+    // Start over from the new range on the next frame
+    mFramesSinceRescale = RESCALE_INTERVAL;
+}
+
+// Reads back the timer query of FRAME_QUERIES frames ago and picks the render scale for this
+// frame. The scale moves in RENDER_SCALE_STEP steps, at most once every RESCALE_INTERVAL frames.
+void VoxelRenderer::UpdateRenderScale()
+{
+    // Queries issued before the last rescale timed the old size
+    mFramesSinceRescale = std::min(mFramesSinceRescale + 1, RESCALE_INTERVAL);
+    if (mFrameQueriesIssued >= FRAME_QUERIES && mFramesSinceRescale >= FRAME_QUERIES)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(mFrameQueries[mFrameQueryIndex], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(mFrameQueries[mFrameQueryIndex], GL_QUERY_RESULT, &nanoseconds);
+            float ms = (float)(nanoseconds / 1.0e6);
+            mGpuFrameMs = mGpuFrameMs > 0.0f ? glm::mix(mGpuFrameMs, ms, GPU_TIME_SMOOTHING) : ms;
+        }
+    }
+
+    float scale = 1.0f;
+    if (mDynamicResolution.enabled)
+    {
+        scale = mRenderScale;
+        if (mFramesSinceRescale >= RESCALE_INTERVAL && mGpuFrameMs > 0.0f)
+        {
+            // The cost follows the pixel count, the square of the scale. Rounding down drops a step as soon as
+            // the frame runs over and only climbs back with a step's worth of headroom, so the scale settles.
+            float ideal = mRenderScale * std::sqrt(mDynamicResolution.targetMs / mGpuFrameMs);
+            scale = std::floor(ideal / RENDER_SCALE_STEP + 1e-3f) * RENDER_SCALE_STEP;
+        }
+        scale = glm::clamp(scale, mDynamicResolution.minScale, mDynamicResolution.maxScale);
+    }
+    if (scale == mRenderScale)
+        return;
+
+    mRenderScale = scale;
+    mFramesSinceRescale = 0;
+    mGpuFrameMs = 0.0f;
+    ResizeRenderTargets(std::max(1, (int)(mScreenWidth * scale + 0.5f)), std::max(1, (int)(mScreenHeight * scale + 0.5f)));
+}
+
+// Reallocates everything sized per rendered pixel. Resizes happen between frames, nothing rendered
+// at the old size is reused.
+void VoxelRenderer::ResizeRenderTargets(int width, int height)
+{
+    if (width == mRenderWidth && height == mRenderHeight)
+        return;
+    mRenderWidth = width;
+    mRenderHeight = height;
+
+    glBindTexture(GL_TEXTURE_2D, mColorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mRenderWidth, mRenderHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mRenderWidth, mRenderHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, mProxyTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mRenderWidth, mRenderHeight, 0, GL_RED, GL_FLOAT, nullptr);
+
+    mPrepassWidth = (mRenderWidth + PREPASS_TILE_SIZE - 1) / PREPASS_TILE_SIZE;
+    mPrepassHeight = (mRenderHeight + PREPASS_TILE_SIZE - 1) / PREPASS_TILE_SIZE;
+    glBindTexture(GL_TEXTURE_2D, mPrepassTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mPrepassWidth, mPrepassHeight, 0, GL_RED, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Also resets the histories
+    InitTraceTargets(mTraceCheckerboard);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Sampler units and camera uniforms shared by every raycast pass
+void VoxelRenderer::SetRaycastUniforms(Shader* shader, const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
     glm::mat4 invProj = glm::inverse(projection);
     glm::mat4 invView = glm::inverse(view);
 
-    mShader->use();
+    shader->use();
 
-    mShader->setInt("voxelTexture",0);
+    shader->setInt("voxelTexture",0);
     //####
-    mShader->setInt("voxelSpriteSheet", 1);
+    shader->setInt("voxelTiles", 1);
+    shader->setUniformBlock("MaterialTable", MaterialTable::BINDING);
+    shader->setInt("occupancyTexture", 2);
+    shader->setInt("distanceField", 3);
+    shader->setInt("brickPageTable", 4);
+    shader->setInt("brickAtlas", 5);
+    shader->setInt("octreeNodes", 6);
+    shader->setInt("occupancyBits", 7);
+    shader->setInt("rayStartTexture", 8);
+    shader->setInt("historyDistance", 9);
+    shader->setInt("proxyStartTexture", 10);
+    shader->setInt("materialMips", 11);
+    shader->setInt("sunVisibility", 12);
+    shader->setInt("floodLight", 13);
+    shader->setInt("ambientOcclusion", 14);
+    shader->setInt("clusterData", 15);
+    shader->setInt("surfaceAtlas", 16);
+    shader->setInt("surfaceTable", 17);
     //####
-    
-    mShader->setVec3("cameraPos",camera.mEye);
-    mShader->setFloat("nearPlane", camera.mNearPlane);
-    mShader->setFloat("farPlane", camera.mFarPlane);
-    mShader->setMat4("invProjection",invProj);
-    mShader->setMat4("projectionMatrix",projection);
-    mShader->setMat4("invView",invView);
-    mShader->setMat4("viewMatrix",view);
-    mShader->setInt("voxelWorldSize",mTerrain->VoxelWorldSize);
-    mShader->setFloat("VoxelScaleX", VoxelScaleX);
-    mShader->setFloat("VoxelScaleY", VoxelScaleY);
-    mShader->setInt("tilesPerCol", tilesPerCol);
-    
+    shader->setVec3("cameraPos",camera.mEye);
+    shader->setVec3("lightDir", mTerrain->SunDirection);
+    shader->setFloat("nearPlane", camera.mNearPlane);
+    shader->setFloat("farPlane", camera.mFarPlane);
+    shader->setMat4("invProjection",invProj);
+    shader->setMat4("projectionMatrix",projection);
+    shader->setMat4("invView",invView);
+    shader->setMat4("viewMatrix",view);
+    shader->setInt("voxelWorldSize",mTerrain->VoxelWorldSize);
+    shader->setInt("checkerParity", mCheckerParity);
+    shader->setVec2("screenSize", glm::vec2(mRenderWidth, mRenderHeight));
+    shader->setVec2("clusterDepthParams", mLights.GetDepthSliceParams());
+}
+
+// Full screen raycast into mFBO, with the proxy, prepass and history passes feeding it. With the
+// visibility buffer the rays only write hit records and ShadeHitRecords lights them afterwards.
+void VoxelRenderer::RaycastVoxels(const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
+    glm::mat4 invProj = glm::inverse(projection);
+    glm::mat4 invView = glm::inverse(view);
 
+    SetRaycastUniforms(mShader, camera, projection, view);
+    // The program of the pass the quality asks for may still be compiling, keep feeding the one that runs
+    if (mShader->isVariantReady()) {
+        mRaycastPass = IsVisibilityBufferActive() ? PASS_VISIBILITY : PASS_FORWARD;
+        if (mTraceCheckerboard != mQuality.checkerboard)
+            InitTraceTargets(mQuality.checkerboard);
+    }
 
     //############## VOXELTERRAIN 3D TEXTURE ###########
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, voxelTexture);
     //##################################################
 
-    //################ WALL/FLOOR TEXTURES #############
+    //################ VOXEL TILES #####################
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, voxelSpriteSheet);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mMaterials.TileArray);
+    //#######################################################
+
+    //######## OCCUPANCY PYRAMID / DISTANCE FIELD ##########
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Occupancy.Texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Distance.Texture);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->SolidBits.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ MATERIAL LOD #########################
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->MaterialLevels.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ BAKED SUN VISIBILITY #################
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Sun.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ FLOOD FILL LIGHT #####################
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Light.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ AMBIENT OCCLUSION ####################
+    glActiveTexture(GL_TEXTURE14);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->AO.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ CLUSTERED LIGHTS #####################
+    glActiveTexture(GL_TEXTURE15);
+    glBindTexture(GL_TEXTURE_BUFFER, mLights.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ SURFACE CACHE ########################
+    if (mSurfaceCacheSupported)
+    {
+        glActiveTexture(GL_TEXTURE16);
+        glBindTexture(GL_TEXTURE_2D, mTerrain->Cache.AtlasTexture);
+        glActiveTexture(GL_TEXTURE17);
+        glBindTexture(GL_TEXTURE_BUFFER, mTerrain->Cache.TableTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    //#######################################################
+
+    //################ BRICK MAP ############################
+    if (mQuality.voxelStorage == STORAGE_BRICKMAP)
+        mTerrain->Bricks.Stream(camera.mEye);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Bricks.PageTable);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Bricks.Atlas);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //############### SPARSE VOXEL OCTREE ###################
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_BUFFER, mTerrain->Octree.Texture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ CHUNK PROXIES ########################
+    if (mQuality.chunkProxies)
+    {
+        RenderChunkProxies(projection * view, camera);
+        mShader->use();
+    }
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, mProxyTexture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ COARSE PREPASS #######################
+    if (mQuality.coarsePrepass)
+    {
+        RenderPrepass(invProj, invView, camera);
+        mShader->use();
+    }
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, mPrepassTexture);
+    glActiveTexture(GL_TEXTURE0);
+    //#######################################################
+
+    //################ CHECKERBOARD ########################
+    // Cleared like mFBO at the start of the frame, misses keep the clear color
+    if (mTraceCheckerboard)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, mCheckerFBO);
+        glViewport(0, 0, mTraceWidth, mTraceHeight);
+        GLenum colorOnly = GL_COLOR_ATTACHMENT0;
+        glDrawBuffers(1, &colorOnly);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    //#######################################################
+
+    //################ VISIBILITY BUFFER ###################
+    // Misses fail the depth test, so cleared records stand for the background
+    bool visibility = mRaycastPass == PASS_VISIBILITY;
+    if (visibility)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, mVisibilityFBO);
+        GLuint noHit[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, noHit);
+    }
+    //#######################################################
+
+    //############### RAY START HISTORY ####################
+    BindHistory(camera, projection);
     //#######################################################
 
     glBindVertexArray(mQuadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glBindVertexArray(0);
 
+    // Billboards and the skybox only draw color
+    GLenum colorOnly = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &colorOnly);
+    if (visibility)
+        ShadeHitRecords(camera, projection, view);
+    if (mTraceCheckerboard) {
+        ResolveCheckerboard(camera, projection, view);
+        mCheckerParity ^= 1;
+    }
+    mPrevProjection = projection;
+    mPrevViewProjection = projection * view;
+    mPrevCameraPos = camera.mEye;
 
+    if (mQuality.stepHeatmap)
+        MeasureSteps();
+}
 
-    //################ DRAW BILLBOARDS/SPRITES #############
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// Rasterizes the greedy meshes of the chunks in the frustum into mFBO. The first call starts
+// meshing the whole world on the workers, chunks show up as their meshes finish.
+void VoxelRenderer::RenderMeshes(const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
+    mTerrain->updateMeshes();
 
-    for (auto& sprite : mSprites) {  // store your sprites as a member
-        sprite.Draw(view, projection, camera.mEye);
+    glm::mat4 viewProjection = projection * view;
+    glm::vec4 planes[6];
+    FrustumPlanes(viewProjection, planes);
+    const std::vector<ChunkBounds::Box>& boxes = mTerrain->Chunks.GetBoxes();
+    mChunkVisible.assign(boxes.size(), false);
+    for (size_t chunk = 0; chunk < boxes.size(); chunk++)
+        mChunkVisible[chunk] = !boxes[chunk].IsEmpty() && BoxInFrustum(planes, glm::vec3(boxes[chunk].min), glm::vec3(boxes[chunk].max + 1));
+
+    mMeshShader->use();
+    mMeshShader->setInt("voxelTiles", 1);
+    mMeshShader->setUniformBlock("MaterialTable", MaterialTable::BINDING);
+    mMeshShader->setInt("sunVisibility", 2);
+    mMeshShader->setInt("floodLight", 3);
+    mMeshShader->setInt("ambientOcclusion", 4);
+    mMeshShader->setInt("clusterData", 5);
+    mMeshShader->setInt("surfaceAtlas", 6);
+    mMeshShader->setInt("surfaceTable", 7);
+    mMeshShader->setMat4("viewMatrix", view);
+    mMeshShader->setVec2("screenSize", glm::vec2(mRenderWidth, mRenderHeight));
+    mMeshShader->setVec2("clusterDepthParams", mLights.GetDepthSliceParams());
+    mMeshShader->setMat4("viewProjection", viewProjection);
+    mMeshShader->setVec3("cameraPos", camera.mEye);
+    mMeshShader->setVec3("lightDir", mTerrain->SunDirection);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mMaterials.TileArray);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Sun.Texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Light.Texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->AO.Texture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, mLights.Texture);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, mTerrain->Cache.AtlasTexture);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_BUFFER, mTerrain->Cache.TableTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    mTerrain->Meshes.Draw(glGetUniformLocation(mMeshShader->ID, "chunkOrigin"), mChunkVisible);
+    glDisable(GL_CULL_FACE);
+
+    // The raycast history and hit records were not written meanwhile
+    mHistoryValid = false;
+    mResolvedValid = false;
+}
+
+VoxelRenderer::BackendTimings VoxelRenderer::CompareBackends(const Camera& camera, int frames)
+{
+    // Mesh everything first, otherwise the mesh backend is timed while chunks are still missing
+    mTerrain->updateMeshes();
+    while (!mTerrain->Meshes.IsIdle()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        mTerrain->updateMeshes();
+    }
+
+    int previousBackend = mBackend;
+    Camera orbit = camera;
+    glm::vec3 center(mTerrain->VoxelWorldSize * 0.5f);
+    float radius = mTerrain->VoxelWorldSize * 0.9f;
+    double totalMs[2] = { 0.0, 0.0 };
+    for (int backend = BACKEND_RAYCAST; backend <= BACKEND_MESH; backend++) {
+        SetBackend(backend);
+        mHistoryValid = false;
+        for (int frame = 0; frame < frames; frame++) {
+            float angle = 6.2831853f * frame / frames;
+            orbit.mEye = center + glm::vec3(cos(angle) * radius, radius * 0.4f, sin(angle) * radius);
+            orbit.mViewDirection = glm::normalize(center - orbit.mEye);
+
+            auto begin = std::chrono::steady_clock::now();
+            RenderVoxels(orbit);
+            glFinish();
+            totalMs[backend] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        }
     }
+    SetBackend(previousBackend);
+    mHistoryValid = false;
+
+    BackendTimings timings;
+    timings.raycastMs = totalMs[BACKEND_RAYCAST] / frames;
+    timings.meshMs = totalMs[BACKEND_MESH] / frames;
+    std::cout << "[Benchmark] " << frames << " frames: raycast " << timings.raycastMs << " ms, greedy mesh "
+              << timings.meshMs << " ms per frame" << std::endl;
+    return timings;
+}
+
+// Emissive voxels, a torch light per sprite and the benchmark lights, binned for this view
+void VoxelRenderer::GatherLights(const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
+    mLightList.clear();
+    mTerrain->collectEmissiveLights(mLightList);
+    for (const BillboardSprite& sprite : mSprites)
+        mLightList.push_back({ sprite.position + glm::vec3(0.0f, sprite.size, 0.0f), 8.0f, glm::vec3(1.0f, 0.6f, 0.25f) * 1.2f });
+    mLightList.insert(mLightList.end(), mBenchmarkLights.begin(), mBenchmarkLights.end());
+
+    mLights.Bin(mLightList, view, projection, camera.mNearPlane, camera.mFarPlane);
+    mLights.Upload();
+}
+
+// Draws this frame's surface cache fills into the atlas: blocks without light yet replace what
+// is there, resident ones blend one more jittered sample into their running average
+void VoxelRenderer::FillSurfaceCache(const Camera& camera)
+{
+    mTerrain->updateSurfaceCache(camera.mEye);
+    const std::vector<SurfaceCache::Fill>& fresh = mTerrain->Cache.GetFreshFills();
+    const std::vector<SurfaceCache::Fill>& refresh = mTerrain->Cache.GetRefreshFills();
+    if (fresh.empty() && refresh.empty())
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mSurfaceCacheFBO);
+    glViewport(0, 0, SurfaceCache::ATLAS_SIZE, SurfaceCache::ATLAS_SIZE);
+    glDisable(GL_DEPTH_TEST);
+
+    mSurfaceCacheShader->use();
+    mSurfaceCacheShader->setInt("voxelTexture", 0);
+    mSurfaceCacheShader->setInt("floodLight", 1);
+    mSurfaceCacheShader->setInt("ambientOcclusion", 2);
+    mSurfaceCacheShader->setInt("frameIndex", mSurfaceCacheFrame++);
+    mSurfaceCacheShader->setVec3("lightDir", mTerrain->SunDirection);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, voxelTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->Light.Texture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, mTerrain->AO.Texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(mSurfaceCacheVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mSurfaceCacheVBO);
+    auto drawFills = [&](const std::vector<SurfaceCache::Fill>& fills, int samples) {
+        if (fills.empty())
+            return;
+        glBufferData(GL_ARRAY_BUFFER, fills.size() * sizeof(SurfaceCache::Fill), fills.data(), GL_STREAM_DRAW);
+        mSurfaceCacheShader->setInt("sampleCount", samples);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)fills.size());
+    };
+    drawFills(fresh, SURFACE_CACHE_FRESH_SAMPLES);
+
+    glEnable(GL_BLEND);
+    glBlendColor(0.0f, 0.0f, 0.0f, SURFACE_CACHE_BLEND);
+    glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+    drawFills(refresh, 1);
     glDisable(GL_BLEND);
+    glBindVertexArray(0);
 
-    
-    RenderSkyBox(projection,view);
-    
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mRenderWidth, mRenderHeight);
+    glEnable(GL_DEPTH_TEST);
+}
 
-    // TEMP copy raycast buffer to main to see
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBlitFramebuffer(0, 0, mScreenWidth, mScreenHeight,
-                      0, 0, mScreenWidth, mScreenHeight,
-                      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
-                      GL_NEAREST);
+std::vector<VoxelRenderer::LightTimings> VoxelRenderer::BenchmarkLights(const Camera& camera, int frames)
+{
+    std::vector<LightTimings> results;
+    RaycastQuality previousQuality = mQuality;
+    RaycastQuality benchmarkQuality = mQuality;
+    benchmarkQuality.clusteredLights = true;
+    SetRaycastQuality(benchmarkQuality);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); // back to default framebuffer
+    // Random lights just above the top of the terrain, same seed for every run
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float size = (float)mTerrain->VoxelWorldSize;
+    const size_t counts[] = { 10, 1000, 10000 };
+    for (size_t count : counts) {
+        mBenchmarkLights.clear();
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 position(unit(random) * size, size * 0.85f + unit(random) * 16.0f, unit(random) * size);
+            glm::vec3 color(unit(random), unit(random), unit(random));
+            mBenchmarkLights.push_back({ position, 4.0f + unit(random) * 8.0f, color });
+        }
+
+        // Variants compile in the background, wait so the new one is timed
+        RenderVoxels(camera);
+        while (!IsRaycastVariantReady()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            RenderVoxels(camera);
+        }
+
+        LightTimings timings;
+        timings.lights = count;
+        for (int frame = 0; frame < frames; frame++) {
+            auto begin = std::chrono::steady_clock::now();
+            RenderVoxels(camera);
+            glFinish();
+            timings.frameMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            timings.binMs += mLights.GetStats().binMs;
+        }
+        timings.frameMs /= frames;
+        timings.binMs /= frames;
+        timings.indices = mLights.GetStats().indices;
+        results.push_back(timings);
+        std::cout << "[Benchmark] " << count << " lights: binning " << timings.binMs << " ms, frame " << timings.frameMs
+                  << " ms, " << mLights.GetStats().visibleLights << " visible, " << timings.indices << " froxel entries" << std::endl;
+    }
+
+    mBenchmarkLights.clear();
+    SetRaycastQuality(previousQuality);
+    return results;
+}
+
+VoxelRenderer::CheckerboardTimings VoxelRenderer::CompareCheckerboard(const Camera& camera, int frames)
+{
+    const int COMPARE_EVERY = 8;
+    RaycastQuality previousQuality = mQuality;
+    Camera orbit = camera;
+    glm::vec3 center(mTerrain->VoxelWorldSize * 0.5f);
+    float radius = mTerrain->VoxelWorldSize * 0.9f;
+    auto orbitTo = [&](int frame) {
+        float angle = 6.2831853f * frame / frames;
+        orbit.mEye = center + glm::vec3(cos(angle) * radius, radius * 0.4f, sin(angle) * radius);
+        orbit.mViewDirection = glm::normalize(center - orbit.mEye);
+    };
+
+    // The frames are compared pixel by pixel, so they all render at the screen size
+    DynamicResolution previousResolution = mDynamicResolution;
+    mDynamicResolution.enabled = false;
+    mRenderScale = 1.0f;
+    ResizeRenderTargets(mScreenWidth, mScreenHeight);
+
+    // Full resolution frames are kept to compare the checkerboard ones against
+    std::vector<std::vector<uint8_t>> reference;
+    size_t pixelBytes = (size_t)mRenderWidth * mRenderHeight * 3;
+    double totalMs[2] = { 0.0, 0.0 };
+    double squaredError = 0.0;
+    double maxError = 0.0;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int checkerboard = 0; checkerboard < 2; checkerboard++) {
+        RaycastQuality quality = previousQuality;
+        quality.checkerboard = checkerboard != 0;
+        SetRaycastQuality(quality);
+
+        // Variants compile in the background, wait so the new one is timed
+        orbitTo(0);
+        RenderVoxels(orbit);
+        while (!IsRaycastVariantReady()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            RenderVoxels(orbit);
+        }
+        mHistoryValid = false;
+        mResolvedValid = false;
+
+        for (int frame = 0; frame < frames; frame++) {
+            orbitTo(frame);
+            auto begin = std::chrono::steady_clock::now();
+            RenderVoxels(orbit);
+            glFinish();
+            totalMs[checkerboard] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+            if (frame % COMPARE_EVERY != 0)
+                continue;
+            std::vector<uint8_t> pixels(pixelBytes);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
+            glReadPixels(0, 0, mRenderWidth, mRenderHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            if (checkerboard == 0) {
+                reference.push_back(std::move(pixels));
+                continue;
+            }
+            const std::vector<uint8_t>& full = reference[frame / COMPARE_EVERY];
+            for (size_t i = 0; i < pixelBytes; i++) {
+                double error = std::abs((int)pixels[i] - (int)full[i]);
+                squaredError += error * error;
+                maxError = std::max(maxError, error);
+            }
+        }
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    SetRaycastQuality(previousQuality);
+    SetDynamicResolution(previousResolution);
+    mHistoryValid = false;
+    mResolvedValid = false;
+
+    CheckerboardTimings timings;
+    timings.fullMs = totalMs[0] / frames;
+    timings.checkerboardMs = totalMs[1] / frames;
+    double meanSquaredError = squaredError / (double)(pixelBytes * reference.size());
+    timings.psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+    timings.maxError = maxError;
+    std::cout << "[Benchmark] " << frames << " frames: full " << timings.fullMs << " ms, checkerboard "
+              << timings.checkerboardMs << " ms per frame, " << timings.psnr << " dB PSNR, max error "
+              << timings.maxError << std::endl;
+    return timings;
+}
+
+VoxelRenderer::DayCycleTimings VoxelRenderer::BenchmarkDayCycle(const Camera& camera, int frames)
+{
+    glm::vec3 previousSun = mTerrain->SunDirection;
+    DayCycleTimings timings;
+    timings.frames = frames;
+    for (int frame = 0; frame < frames; frame++) {
+        mTerrain->setSunDirection(VoxelTerrain::sunDirectionAt(24.0f * frame / frames));
+        auto begin = std::chrono::steady_clock::now();
+        RenderVoxels(camera);
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        timings.averageMs += ms;
+        timings.worstMs = std::max(timings.worstMs, ms);
+        timings.worstSweepMs = std::max(timings.worstSweepMs, mTerrain->Sun.GetLastSweepMs());
+    }
+    timings.averageMs /= frames;
+    mTerrain->setSunDirection(previousSun);
+
+    std::cout << "[Benchmark] Day cycle over " << frames << " frames: " << timings.averageMs << " ms average, "
+              << timings.worstMs << " ms worst, sun re-bake at most " << timings.worstSweepMs << " ms" << std::endl;
+    return timings;
+}
+
+// Shades the hit records of the visibility pass into the trace target's color. Depth came with the records,
+// so the pass runs without the depth test and leaves the depth buffer alone.
+void VoxelRenderer::ShadeHitRecords(const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, mTraceFBO);
+    GLenum colorOnly = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &colorOnly);
+    glDisable(GL_DEPTH_TEST);
+
+    SetRaycastUniforms(mShadeShader, camera, projection, view);
+    mShadeShader->setInt("hitRecords", 8); // The prepass starts are only read by the traversal
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, mHitRecordTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(mQuadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Cone march at one fragment per tile, reads the distance field already bound to unit 3.
+// Leaves the raycast FBO bound with the full viewport.
+void VoxelRenderer::RenderPrepass(const glm::mat4& invProj, const glm::mat4& invView, const Camera& camera)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, mPrepassFBO);
+    glViewport(0, 0, mPrepassWidth, mPrepassHeight);
+    glDisable(GL_DEPTH_TEST);
+
+    mPrepassShader->use();
+    mPrepassShader->setInt("distanceField", 3);
+    mPrepassShader->setVec3("cameraPos", camera.mEye);
+    mPrepassShader->setMat4("invProjection", invProj);
+    mPrepassShader->setMat4("invView", invView);
+    mPrepassShader->setVec2("screenSize", glm::vec2(mRenderWidth, mRenderHeight));
+
+    glBindVertexArray(mQuadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mRenderWidth, mRenderHeight);
+}
+
+// Back faces of the chunk bounds, min-blended into the nearest ray entry per pixel.
+// Pixels no box covers keep the clear value and are skipped by the raycast.
+// Leaves the raycast FBO bound.
+void VoxelRenderer::RenderChunkProxies(const glm::mat4& viewProjection, const Camera& camera)
+{
+    glm::vec4 planes[6];
+    FrustumPlanes(viewProjection, planes);
+
+    mProxyInstances.clear();
+    for (const ChunkBounds::Box& box : mTerrain->Chunks.GetBoxes()) {
+        if (box.IsEmpty())
+            continue;
+        glm::vec3 boxMin(box.min);
+        glm::vec3 boxMax(box.max + 1);
+        if (BoxInFrustum(planes, boxMin, boxMax)) {
+            mProxyInstances.push_back(boxMin);
+            mProxyInstances.push_back(boxMax);
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mProxyFBO);
+    float noProxy = 1e30f;
+    glClearBufferfv(GL_COLOR, 0, &noProxy);
+
+    if (!mProxyInstances.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, mProxyInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, mProxyInstances.size() * sizeof(glm::vec3), mProxyInstances.data(), GL_STREAM_DRAW);
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_MIN);
+
+        mProxyShader->use();
+        mProxyShader->setMat4("viewProjection", viewProjection);
+        mProxyShader->setVec3("cameraPos", camera.mEye);
+        glBindVertexArray(mProxyVAO);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)(mProxyInstances.size() / 2));
+        glBindVertexArray(0);
+
+        glBlendEquation(GL_FUNC_ADD);
+        glDisable(GL_BLEND);
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+}
+
+// Binds last frame's first hit distances to unit 9 and makes the raycast write this frame's
+// into the other history texture. History is dropped on camera cuts, and the voxels edited
+// since last frame are passed along so rays passing them march in full.
+void VoxelRenderer::BindHistory(const Camera& camera, const glm::mat4& projection)
+{
+    glm::ivec3 editMin, editMax;
+    bool edited = mTerrain->consumeEditBounds(editMin, editMax);
+
+    if (!mQuality.temporalReprojection) {
+        mHistoryValid = false;
+        mShader->setInt("historyValid", 0);
+        return;
+    }
+
+    bool cut = glm::distance(camera.mEye, mPrevCameraPos) > REPROJECTION_MAX_MOVE || projection != mPrevProjection;
+    mShader->setInt("historyValid", mHistoryValid && !cut ? 1 : 0);
+    mShader->setMat4("prevViewProjection", mPrevViewProjection);
+    mShader->setVec3("prevCameraPos", mPrevCameraPos);
+
+    if (edited) {
+        mShader->setVec3("editBoxMin", glm::vec3(editMin));
+        mShader->setVec3("editBoxMax", glm::vec3(editMax + 1));
+    } else {
+        mShader->setVec3("editBoxMin", glm::vec3(1.0f));  // Empty box, min past max
+        mShader->setVec3("editBoxMax", glm::vec3(0.0f));
+    }
+
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, mHistoryTextures[mHistoryIndex]);
+    glActiveTexture(GL_TEXTURE0);
+
+    mHistoryIndex ^= 1;
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mHistoryTextures[mHistoryIndex], 0);
+    GLenum targets[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, targets);
+    mHistoryValid = true;
+}
+
+// The heatmap variant writes the step count of each ray into alpha. Reading the whole
+// target back stalls the pipeline, which is fine for a debug view.
+void VoxelRenderer::MeasureSteps()
+{
+    std::vector<float> pixels((size_t)mRenderWidth * mRenderHeight * 4);
+    glReadPixels(0, 0, mRenderWidth, mRenderHeight, GL_RGBA, GL_FLOAT, pixels.data());
+
+    double totalSteps = 0.0;
+    for (size_t i = 3; i < pixels.size(); i += 4)
+        totalSteps += pixels[i];
+    mAverageSteps = (float)(totalSteps / ((size_t)mRenderWidth * mRenderHeight));
+}
+
+void VoxelRenderer::InitSurfaceCache()
+{
+    if (!mSurfaceCacheSupported)
+        return;
+
+    mTerrain->Cache.Init(mTerrain->VoxelWorldSize);
+    mTerrain->Cache.CreateTextures();
+
+    // Fills are instanced quads, corners come from gl_VertexID
+    glGenVertexArrays(1, &mSurfaceCacheVAO);
+    glGenBuffers(1, &mSurfaceCacheVBO);
+    glBindVertexArray(mSurfaceCacheVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mSurfaceCacheVBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(SurfaceCache::Fill), (void*)0);
+    glVertexAttribDivisor(0, 1);
+    glBindVertexArray(0);
+
+    glGenFramebuffers(1, &mSurfaceCacheFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mSurfaceCacheFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTerrain->Cache.AtlasTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "[VoxelRenderer] Surface cache FBO incomplete!" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VoxelRenderer::InitVisibilityBuffer()
+{
+    glGenFramebuffers(1, &mVisibilityFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mVisibilityFBO);
+
+    // Storage and depth come from InitTraceTargets
+    glGenTextures(1, &mHitRecordTexture);
+    glBindTexture(GL_TEXTURE_2D, mHitRecordTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+}
+
+// Sizes what the raycast writes per traced pixel, the ray start history and the hit records, to
+// the full screen or to the half width checkerboard, and points the raycast FBOs at them.
+// Leaves mFBO bound.
+void VoxelRenderer::InitTraceTargets(bool checkerboard)
+{
+    mTraceCheckerboard = checkerboard;
+    mTraceWidth = checkerboard ? (mRenderWidth + 1) / 2 : mRenderWidth;
+    mTraceHeight = mRenderHeight;
+
+    for (unsigned int history : mHistoryTextures) {
+        glBindTexture(GL_TEXTURE_2D, history);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mTraceWidth, mTraceHeight, 0, GL_RED, GL_FLOAT, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, mHitRecordTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, mTraceWidth, mTraceHeight, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    if (checkerboard && mCheckerFBO == 0) {
+        glGenFramebuffers(1, &mCheckerFBO);
+        glGenTextures(1, &mCheckerColorTexture);
+        glGenTextures(1, &mCheckerDepthTexture);
+        glGenTextures(2, mResolvedTextures);
+        for (unsigned int texture : { mCheckerColorTexture, mCheckerDepthTexture, mResolvedTextures[0], mResolvedTextures[1] }) {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+    }
+    if (checkerboard) {
+        // Same format as mColorTexture, the step heatmap writes unclamped counts into alpha
+        glBindTexture(GL_TEXTURE_2D, mCheckerColorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mTraceWidth, mTraceHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, mCheckerDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mTraceWidth, mTraceHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, mCheckerFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mCheckerColorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mCheckerDepthTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mHistoryTextures[0], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "[VoxelRenderer] Checkerboard FBO incomplete!" << std::endl;
+
+        // Half floats hold the camera distance well within the tolerance the resolve compares it with
+        for (unsigned int resolved : mResolvedTextures) {
+            glBindTexture(GL_TEXTURE_2D, resolved);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, mRenderWidth, mRenderHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+        }
+    }
+    mTraceFBO = checkerboard ? mCheckerFBO : mFBO;
+
+    // The hit records share the depth of the target they get shaded into
+    glBindFramebuffer(GL_FRAMEBUFFER, mVisibilityFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mHitRecordTexture, 0);
+    // The ray start history is attached as the second target by BindHistory, like on mFBO
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mHistoryTextures[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, checkerboard ? mCheckerDepthTexture : mDepthTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "[VoxelRenderer] Visibility FBO incomplete!" << std::endl;
+
+    // A half width history on mFBO would shrink everything drawn into it to the smaller size
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, checkerboard ? 0 : mHistoryTextures[0], 0);
+
+    // Nothing written at the old size carries over
+    mHistoryValid = false;
+    mResolvedValid = false;
+}
+
+// Rebuilds mFBO's color and depth from this frame's checkerboard and the previous resolve, see
+// checkerboard_resolve.frag. Leaves mFBO bound with the full viewport, drawing color only.
+void VoxelRenderer::ResolveCheckerboard(const Camera& camera, const glm::mat4& projection, const glm::mat4& view)
+{
+    bool cut = glm::distance(camera.mEye, mPrevCameraPos) > REPROJECTION_MAX_MOVE || projection != mPrevProjection;
+    unsigned int previousResolved = mResolvedTextures[mResolvedIndex];
+    mResolvedIndex ^= 1;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mRenderWidth, mRenderHeight);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mResolvedTextures[mResolvedIndex], 0);
+    GLenum targets[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, targets);
+    // Every pixel takes its depth from the trace
+    glDepthFunc(GL_ALWAYS);
+
+    // Units the raycast binds again before it reads them next frame
+    mResolveShader->use();
+    mResolveShader->setInt("traceColor", 8);
+    mResolveShader->setInt("traceDepth", 9);
+    mResolveShader->setInt("previousResolved", 10);
+    mResolveShader->setInt("checkerParity", mCheckerParity);
+    mResolveShader->setInt("historyValid", mResolvedValid && !cut ? 1 : 0);
+    mResolveShader->setMat4("invViewProjection", glm::inverse(projection * view));
+    mResolveShader->setMat4("prevViewProjection", mPrevViewProjection);
+    mResolveShader->setVec3("cameraPos", camera.mEye);
+    mResolveShader->setVec3("prevCameraPos", mPrevCameraPos);
+    mResolveShader->setVec2("screenSize", glm::vec2(mRenderWidth, mRenderHeight));
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, mCheckerColorTexture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, mCheckerDepthTexture);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, previousResolved);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(mQuadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+
+    glDepthFunc(GL_LESS);
+    GLenum colorOnly = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &colorOnly);
+    mResolvedValid = true;
+}
+
+void VoxelRenderer::InitChunkProxies()
+{
+    // Unit cube, counter-clockwise from outside
+    static const float cube[] = {
+        0,0,0, 0,1,0, 1,1,0,  0,0,0, 1,1,0, 1,0,0,  // -Z
+        0,0,1, 1,0,1, 1,1,1,  0,0,1, 1,1,1, 0,1,1,  // +Z
+        0,0,0, 0,0,1, 0,1,1,  0,0,0, 0,1,1, 0,1,0,  // -X
+        1,0,0, 1,1,0, 1,1,1,  1,0,0, 1,1,1, 1,0,1,  // +X
+        0,0,0, 1,0,0, 1,0,1,  0,0,0, 1,0,1, 0,0,1,  // -Y
+        0,1,0, 0,1,1, 1,1,1,  0,1,0, 1,1,1, 1,1,0,  // +Y
+    };
+
+    glGenVertexArrays(1, &mProxyVAO);
+    glGenBuffers(1, &mProxyVBO);
+    glGenBuffers(1, &mProxyInstanceVBO);
+
+    glBindVertexArray(mProxyVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mProxyVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mProxyInstanceVBO);
+    glEnableVertexAttribArray(1); // box min
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2); // box max
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+
+    // One entry distance per pixel, GL_R32F so GL_MIN blending keeps full precision
+    glGenFramebuffers(1, &mProxyFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mProxyFBO);
+    glGenTextures(1, &mProxyTexture);
+    glBindTexture(GL_TEXTURE_2D, mProxyTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, mRenderWidth, mRenderHeight, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mProxyTexture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "[VoxelRenderer] Proxy FBO incomplete!" << std::endl;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void VoxelRenderer::InitFullscreenQuad() 
@@ -1,5 +1,10 @@
 #include "VoxelTerrain.h"
+#include "UploadRing.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdlib> // for rand()
+#include <future>
+#include <glm/gtc/constants.hpp>
 
 VoxelTerrain::VoxelTerrain(unsigned int seed)
 {
@@ -13,6 +18,19 @@ VoxelTerrain::VoxelTerrain(unsigned int seed)
         for (int y = VoxelPadding; y < VoxelWorldSize-VoxelPadding; ++y)
             for (int x = VoxelPadding; x < VoxelWorldSize-VoxelPadding; ++x)
                 voxels[x + y * VoxelWorldSize + z * VoxelWorldSize * VoxelWorldSize] = 1;
+
+    // Both only read the voxels, bake the distance field alongside the pyramid
+    auto distanceBake = std::async(std::launch::async, [this]() { Distance.Build(voxels, VoxelWorldSize); });
+    Occupancy.Build(voxels, VoxelWorldSize);
+    MaterialLevels.Build(voxels, VoxelWorldSize);
+    SolidBits.Build(voxels, VoxelWorldSize);
+    Bricks.Build(voxels, VoxelWorldSize);
+    Octree.Build(voxels, VoxelWorldSize);
+    Chunks.Build(voxels, VoxelWorldSize);
+    Sun.Build(voxels, VoxelWorldSize, SunDirection);
+    Light.Build(voxels, VoxelWorldSize);
+    AO.Build(voxels, VoxelWorldSize);
+    distanceBake.get();
 }
 
 bool VoxelTerrain::isVoxel(glm::vec3 pos)
@@ -28,6 +46,11 @@ bool VoxelTerrain::isVoxel(glm::vec3 pos)
     return voxels[index] != 0;
 }
 
+VoxelHit VoxelTerrain::raycast(const Ray &ray, float maxDistance)
+{
+    return Octree.Raycast(ray, maxDistance);
+}
+
 std::vector<GLubyte> VoxelTerrain::getVoxels()
 {
     return voxels;
@@ -39,40 +62,133 @@ void VoxelTerrain::setVoxel(int x, int y, int z, uint8_t value)
         y < 0 || y >= VoxelWorldSize ||
         z < 0 || z >= VoxelWorldSize) return;
 
-    voxels[x + y * VoxelWorldSize + z * VoxelWorldSize * VoxelWorldSize] = value;
+    size_t index = x + y * VoxelWorldSize + z * (size_t)VoxelWorldSize * VoxelWorldSize;
+    voxels[index] = value;
+    if (FloodLight::Emission(value) != glm::ivec3(0))
+        mEmissiveVoxels.insert(index);
+    else
+        mEmissiveVoxels.erase(index);
+    Occupancy.Update(voxels, x, y, z);
+    MaterialLevels.Update(voxels, x, y, z);
+    SolidBits.Update(voxels, x, y, z);
+    Distance.Update(voxels, x, y, z);
+    Bricks.SetVoxel(x, y, z, value);
+    Octree.Update(voxels, x, y, z);
+    Chunks.Update(voxels, x, y, z);
+    Meshes.MarkDirty(x, y, z);
+    Sun.MarkDirty(x, y, z);
+    Light.Update(voxels, x, y, z);
+    AO.Update(voxels, x, y, z);
+    Cache.MarkDirty(x, y, z);
+
+    glm::ivec3 voxel(x, y, z);
+    mEditMin = mHasEdits ? glm::min(mEditMin, voxel) : voxel;
+    mEditMax = mHasEdits ? glm::max(mEditMax, voxel) : voxel;
+    mHasEdits = true;
 }
 
-void VoxelTerrain::updateVoxelGPU(int x, int y, int z)
+void VoxelTerrain::updateMeshes()
 {
-    glBindTexture(GL_TEXTURE_3D, VoxelTexture);
-    uint8_t value = voxels[x + y * VoxelWorldSize + z * VoxelWorldSize * VoxelWorldSize];
-    glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, 1, 1, 1, GL_RED, GL_UNSIGNED_BYTE, &value);
+    if (!Meshes.IsInitialized())
+        Meshes.Init(VoxelWorldSize);
+    Meshes.Update(voxels);
 }
 
-glm::ivec3 VoxelTerrain::decodeVoxel(int mScreenWidth, int mScreenHeight, bool addBlock)
+void VoxelTerrain::updateLighting()
 {
-    float voxelRGBA[4];
+    Sun.Update(voxels);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
-        glReadPixels(mScreenWidth / 2, mScreenHeight / 2, 1, 1, GL_RGBA, GL_FLOAT, voxelRGBA);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Faces in front of relit voxels have stale light in the surface cache
+    glm::ivec3 relitMin, relitMax;
+    if (Cache.IsInitialized() && Light.GetDirtyBox(relitMin, relitMax))
+        Cache.Invalidate(relitMin, relitMax);
+    Light.UploadDirty();
+}
 
-    glm::ivec3 voxelXYZ = glm::floor(glm::vec3(voxelRGBA[0], voxelRGBA[1], voxelRGBA[2]) * float(VoxelWorldSize));
+// The sun rises in the east (+X) at 6, culminates at noon tilted towards +Z and sets in the west at
+// 18. At night the moon on the opposite side takes over, so something always casts the shadows.
+// Kept a little above the horizon, grazing rays would cross the whole world.
+glm::vec3 VoxelTerrain::sunDirectionAt(float hours)
+{
+    const float tilt = glm::radians(25.0f);
+    const float minElevation = 0.1f;
+    float angle = (hours - 6.0f) / 24.0f * glm::two_pi<float>();
+    glm::vec3 toSun(std::cos(angle), std::sin(angle) * std::cos(tilt), std::sin(angle) * std::sin(tilt));
+    if (toSun.y < 0.0f)
+        toSun = -toSun;
+    toSun.y = std::max(toSun.y, minElevation);
+    return glm::normalize(toSun);
+}
 
-    voxelXYZ = glm::ivec3(voxelXYZ.x, voxelXYZ.y, voxelXYZ.z);
-    int faceIndex = int(round(voxelRGBA[3] * 5.0f));
-        
-    glm::ivec3 faceNormal;
-    switch(faceIndex) {
-        case 0: faceNormal = { 1, 0, 0 }; break; // +X
-        case 1: faceNormal = {-1, 0, 0 }; break; // -X
-        case 2: faceNormal = { 0, 1, 0 }; break; // +Y
-        case 3: faceNormal = { 0,-1, 0 }; break; // -Y
-        case 4: faceNormal = { 0, 0, 1 }; break; // +Z
-        case 5: faceNormal = { 0, 0,-1 }; break; // -Z
+void VoxelTerrain::setSunDirection(const glm::vec3 &toSun)
+{
+    SunDirection = glm::normalize(toSun);
+    Sun.SetDirection(SunDirection);
+}
+
+void VoxelTerrain::updateSurfaceCache(const glm::vec3 &cameraPos)
+{
+    if (!Cache.IsInitialized())
+        Cache.Init(VoxelWorldSize);
+    Cache.Update(voxels, cameraPos, SunDirection);
+    Cache.UploadTable();
+}
+
+void VoxelTerrain::collectEmissiveLights(std::vector<ClusteredLights::PointLight> &lights) const
+{
+    for (size_t index : mEmissiveVoxels)
+    {
+        glm::ivec3 voxel(index % VoxelWorldSize, (index / VoxelWorldSize) % VoxelWorldSize, index / ((size_t)VoxelWorldSize * VoxelWorldSize));
+        bool exposed = false;
+        for (int face = 0; face < 6 && !exposed; face++)
+        {
+            glm::ivec3 neighbour = voxel + faceNormal(face);
+            bool inside = glm::all(glm::greaterThanEqual(neighbour, glm::ivec3(0))) && glm::all(glm::lessThan(neighbour, glm::ivec3(VoxelWorldSize)));
+            exposed = !inside || voxels[neighbour.x + neighbour.y * VoxelWorldSize + neighbour.z * (size_t)VoxelWorldSize * VoxelWorldSize] == 0;
+        }
+        if (!exposed)
+            continue;
+
+        // Same colour as the block light it spreads, a short reach since the flood fill covers the rest
+        glm::vec3 color = glm::vec3(FloodLight::Emission(voxels[index])) / float(FloodLight::MAX_LEVEL);
+        lights.push_back({ glm::vec3(voxel) + 0.5f, 6.0f, color * 0.6f });
     }
+}
 
-        glm::ivec3 targetVoxel = voxelXYZ + (addBlock ? faceNormal : glm::ivec3(0));
+bool VoxelTerrain::consumeEditBounds(glm::ivec3 &editMin, glm::ivec3 &editMax)
+{
+    if (!mHasEdits)
+        return false;
+
+    editMin = mEditMin;
+    editMax = mEditMax;
+    mHasEdits = false;
+    return true;
+}
 
-    return targetVoxel;
+void VoxelTerrain::updateVoxelGPU(int x, int y, int z)
+{
+    glBindTexture(GL_TEXTURE_3D, VoxelTexture);
+    uint8_t value = voxels[x + y * VoxelWorldSize + z * VoxelWorldSize * VoxelWorldSize];
+    UploadRing::Get().TexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, 1, 1, 1, GL_RED, &value);
+    SolidBits.UploadBlock(x, y, z); // Same frame as the material byte, the shader trusts the bits
+    Occupancy.UploadCell(x, y, z);
+    MaterialLevels.UploadCell(x, y, z);
+    AO.UploadCorners(x, y, z);
+    Distance.UploadRegion(x, y, z);
+    Bricks.UploadVoxel(x, y, z);
+    Octree.UploadDirty();
+}
+
+glm::ivec3 VoxelTerrain::faceNormal(int faceIndex)
+{
+    switch(faceIndex) {
+        case 0: return { 1, 0, 0 }; // +X
+        case 1: return {-1, 0, 0 }; // -X
+        case 2: return { 0, 1, 0 }; // +Y
+        case 3: return { 0,-1, 0 }; // -Y
+        case 4: return { 0, 0, 1 }; // +Z
+        case 5: return { 0, 0,-1 }; // -Z
+    }
+    return { 0, 0, 0 }; // Ray started inside a solid voxel
 }
\ No newline at end of file
@@ -10,16 +10,23 @@
 #include "VoxelRenderer.hpp"
 #include "Player.h"
 #include "VoxelTerrain.h"
+#include "UploadRing.h"
+#include "TextureCache.h"
 
 // STD libs + GLM
 #include <stdio.h>
 #include <iostream>
 #include <random>
 #include <string>
+#include <future>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
+#include <cmath>
+
+// Real seconds for a full 24 hours while the sun is animated
+static const float DAY_LENGTH_SECONDS = 120.0f;
 
 Engine::Engine()
 {
@@ -30,24 +37,48 @@ Engine::Engine()
     mOpenGLContext             = nullptr;
     bool mMouseActive          = true;
     int terrainSeed            = 69;
+
+    // Start the CPU heavy work (world generation + image decoding) before touching SDL/GL,
+    // the main thread only has to upload the results once the context exists.
+    StartupTimeline* timeline = &mStartup;
+    std::future<VoxelTerrain*> terrainFuture = std::async(std::launch::async, [terrainSeed, timeline]() {
+        double begin = timeline->Now();
+        double cpuBegin = StartupTimeline::ThreadCpuNow();
+        VoxelTerrain* generated = new VoxelTerrain(terrainSeed);
+        timeline->Record("terrain generation", true, begin, timeline->Now(), StartupTimeline::ThreadCpuNow() - cpuBegin);
+        return generated;
+    });
+    VoxelRenderer::Assets assets = VoxelRenderer::DecodeAssets(timeline);
+
     InitializeProgram();
 
     mPlayer = new Player(glm::vec3(199.0f, 228.0f, 68.0f),mScreenWidth,mScreenHeight,mGraphicsApplicationWindow);
-    terrain = new VoxelTerrain(terrainSeed);
-    renderer = new VoxelRenderer(mScreenWidth,mScreenHeight, terrain);
-    
+
+    double begin = mStartup.Now();
+    terrain = terrainFuture.get();
+    assets.Wait();
+    mStartup.Record("wait for workers", false, begin, mStartup.Now());
+
+    begin = mStartup.Now();
+    renderer = new VoxelRenderer(mScreenWidth,mScreenHeight, terrain, std::move(assets));
+    mStartup.Record("renderer init (shaders + GL uploads)", false, begin, mStartup.Now());
+
+    mStartup.Print();
+    TextureCache::PrintStats();
 }
 
 
 void Engine::InitializeProgram()
 {
     //Initialize SDL
+    double begin = mStartup.Now();
     std::cout << "[Engine] Initializing SDL...";
     if(SDL_Init(SDL_INIT_VIDEO) < 0){
         std::cout << "[!] SDL could not initialize" << std::endl;
         exit(1);
     }
     std::cout << "Done!" << std::endl;
+    mStartup.Record("SDL init", false, begin, mStartup.Now());
 
     //Set context to OpenGL version 4.1
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
@@ -58,6 +89,7 @@ void Engine::InitializeProgram()
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
+    begin = mStartup.Now();
     std::cout << "[Engine] Creating Window...";
     mGraphicsApplicationWindow = SDL_CreateWindow(
         "OpenGL Window",         // Window title
@@ -65,7 +97,7 @@ void Engine::InitializeProgram()
         SDL_WINDOWPOS_CENTERED,  // Y position: centered
         mScreenWidth,            // Window width
         mScreenHeight,           // Window height
-        SDL_WINDOW_OPENGL        // Window flags
+        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE // Window flags
     );
 
     if(mGraphicsApplicationWindow == nullptr){
@@ -82,16 +114,20 @@ void Engine::InitializeProgram()
     }
     SDL_GL_MakeCurrent(mGraphicsApplicationWindow, mOpenGLContext);
     std::cout << "Done!" << std::endl;
+    mStartup.Record("window + GL context", false, begin, mStartup.Now());
 
     //Initialize GLAD lib
+    begin = mStartup.Now();
     std::cout << "[Engine] Initializing GLAD...";  
     if(!gladLoadGLLoader(SDL_GL_GetProcAddress)){
         std::cout << "[!][Engine] Could not initialize GLAD-lib" << std::endl;
         exit(1);
     }
     std::cout << "Done!"<< std::endl;  
+    mStartup.Record("GLAD", false, begin, mStartup.Now());
 
     //Initialize ImGUI
+    begin = mStartup.Now();
     std::cout << "[Engine] Initializing ImGUI...";  
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -104,6 +140,7 @@ void Engine::InitializeProgram()
     ImGui_ImplSDL2_InitForOpenGL(mGraphicsApplicationWindow, mOpenGLContext);
     ImGui_ImplOpenGL3_Init("#version 410");
     std::cout << "Done!" << std::endl;  
+    mStartup.Record("ImGui", false, begin, mStartup.Now());
 
 
     std::cout << "[Engine] System info:" << std::endl;
@@ -132,6 +169,17 @@ void Engine::MainLoop()
         float deltaTime = GetDeltaTime();
         mPlayer->Update(deltaTime, terrain);
 
+        // Polled instead of waiting for the resize event, a minimized window reports no size at all
+        int drawableWidth, drawableHeight;
+        SDL_GL_GetDrawableSize(mGraphicsApplicationWindow, &drawableWidth, &drawableHeight);
+        if (drawableWidth > 0 && drawableHeight > 0 && (drawableWidth != mScreenWidth || drawableHeight != mScreenHeight))
+        {
+            mScreenWidth = drawableWidth;
+            mScreenHeight = drawableHeight;
+            mPlayer->SetScreenSize(mScreenWidth, mScreenHeight);
+            renderer->SetScreenSize(mScreenWidth, mScreenHeight);
+        }
+
         renderer->RenderVoxels(mPlayer->mCamera);
         
         ImGui::Begin("Info panel");
@@ -147,6 +195,157 @@ void Engine::MainLoop()
             ImGui::Checkbox("Collisions", &mPlayer->collisionMode);
             ImGui::Checkbox("[G]ravity", &mPlayer->mGravity);
             ImGui::Text("Chosen Block: %i", playerChosenBlock);
+
+            const UploadRing::Stats& uploadStats = UploadRing::Get().GetStats();
+            ImGui::Text("Upload ring (%s): %.2f MB streamed, %llu uploads", UploadRing::Get().IsPersistent() ? "persistent" : "orphaning",
+                        uploadStats.bytesStreamed / (1024.0 * 1024.0), (unsigned long long)uploadStats.uploads);
+            ImGui::Text("Upload stalls: %llu (%.2f ms waited)", (unsigned long long)uploadStats.stalls, uploadStats.stallWaitMs);
+        ImGui::End();
+
+        ImGui::Begin("Raycast quality");
+            // Presets instead of sliders, every distinct value is a separate shader variant
+            static const int stepPresets[] = { 128, 256, 512, 1024 };
+            static const int lightStepPresets[] = { 4, 8, 16 };
+            static const int rangePresets[] = { 32, 64, 128 };
+            static const int lodPresets[] = { 0, 64, 128, 256 };
+            static const char* backends[] = { "Raycast", "Greedy mesh" };
+            int backend = renderer->GetBackend();
+            if (ImGui::Combo("Renderer", &backend, backends, 2))
+                renderer->SetBackend(backend);
+            static VoxelRenderer::BackendTimings backendTimings;
+            if (ImGui::Button("Compare backends"))
+                backendTimings = renderer->CompareBackends(mPlayer->mCamera);
+            if (backendTimings.raycastMs > 0.0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("raycast %.2f ms / mesh %.2f ms", backendTimings.raycastMs, backendTimings.meshMs);
+            }
+
+            VoxelRenderer::RaycastQuality quality = renderer->GetRaycastQuality();
+            bool changed = false;
+            auto presetCombo = [&changed](const char* label, int& value, const int* presets, int count) {
+                if (ImGui::BeginCombo(label, std::to_string(value).c_str()))
+                {
+                    for (int i = 0; i < count; i++)
+                    {
+                        if (ImGui::Selectable(std::to_string(presets[i]).c_str(), presets[i] == value) && presets[i] != value)
+                        {
+                            value = presets[i];
+                            changed = true;
+                        }
+                    }
+                    ImGui::EndCombo();
+                }
+            };
+            presetCombo("Max steps", quality.maxSteps, stepPresets, 4);
+            presetCombo("Max light steps", quality.maxLightSteps, lightStepPresets, 3);
+            presetCombo("Shadow range", quality.maxRaytraceRange, rangePresets, 3);
+            presetCombo("LOD distance (0 = off)", quality.lodDistance, lodPresets, 4);
+            static float timeOfDay = 12.0f;
+            static bool animateSun = false;
+            bool sunMoved = ImGui::SliderFloat("Time of day", &timeOfDay, 0.0f, 24.0f, "%.1f h");
+            ImGui::Checkbox("Animate sun", &animateSun);
+            if (animateSun)
+            {
+                timeOfDay = std::fmod(timeOfDay + deltaTime * 24.0f / DAY_LENGTH_SECONDS, 24.0f);
+                sunMoved = true;
+            }
+            if (sunMoved)
+                terrain->setSunDirection(VoxelTerrain::sunDirectionAt(timeOfDay));
+            changed |= ImGui::Checkbox("Raytraced shadows", &quality.raytracedShadows);
+            changed |= ImGui::Checkbox("Baked sun visibility", &quality.bakedSunVisibility);
+            changed |= ImGui::Checkbox("Flood fill light", &quality.floodLight);
+            changed |= ImGui::Checkbox("Ambient occlusion", &quality.ambientOcclusion);
+            changed |= ImGui::Checkbox("Clustered point lights", &quality.clusteredLights);
+            if (renderer->IsSurfaceCacheSupported())
+                changed |= ImGui::Checkbox("Surface cache", &quality.surfaceCache);
+            changed |= ImGui::Checkbox("Camera point light", &quality.cameraPointLight);
+            static const char* skipModes[] = { "Off", "Occupancy pyramid", "Distance field" };
+            changed |= ImGui::Combo("Empty space skipping", &quality.emptySpaceSkipping, skipModes, 3);
+            static const char* storageModes[] = { "Dense 3D texture", "Brick map", "Sparse octree" };
+            changed |= ImGui::Checkbox("Packed occupancy bits", &quality.occupancyBits);
+            changed |= ImGui::Combo("Voxel storage", &quality.voxelStorage, storageModes, 3);
+            changed |= ImGui::Checkbox("Coarse ray prepass", &quality.coarsePrepass);
+            changed |= ImGui::Checkbox("Temporal ray start", &quality.temporalReprojection);
+            changed |= ImGui::Checkbox("Chunk proxies", &quality.chunkProxies);
+            changed |= ImGui::Checkbox("Visibility buffer (shade in a second pass)", &quality.visibilityBuffer);
+            changed |= ImGui::Checkbox("Checkerboard (trace half the pixels)", &quality.checkerboard);
+            changed |= ImGui::Checkbox("Step heatmap", &quality.stepHeatmap);
+            if (changed)
+                renderer->SetRaycastQuality(quality);
+
+            ImGui::Text("Variant: %s (%zu compiled)", renderer->IsRaycastVariantReady() ? "active" : "compiling...",
+                        renderer->GetRaycastVariantCount());
+            VoxelRenderer::DynamicResolution resolution = renderer->GetDynamicResolution();
+            bool resolutionChanged = ImGui::Checkbox("Dynamic resolution", &resolution.enabled);
+            resolutionChanged |= ImGui::SliderFloat("Target GPU ms", &resolution.targetMs, 4.0f, 33.3f, "%.1f");
+            resolutionChanged |= ImGui::SliderFloat("Minimum scale", &resolution.minScale, 0.25f, 1.0f, "%.2f");
+            if (resolutionChanged)
+                renderer->SetDynamicResolution(resolution);
+            ImGui::Text("Rendering %dx%d (%.0f%%), GPU %.2f ms", renderer->GetRenderWidth(), renderer->GetRenderHeight(),
+                        renderer->GetRenderScale() * 100.0f, renderer->GetGpuFrameMs());
+            static VoxelRenderer::CheckerboardTimings checkerTimings;
+            if (ImGui::Button("Compare checkerboard"))
+                checkerTimings = renderer->CompareCheckerboard(mPlayer->mCamera);
+            if (checkerTimings.fullMs > 0.0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("full %.2f ms / checkerboard %.2f ms, %.1f dB", checkerTimings.fullMs,
+                            checkerTimings.checkerboardMs, checkerTimings.psnr);
+            }
+            if (quality.stepHeatmap)
+                ImGui::Text("Average steps per pixel: %.1f", renderer->GetAverageSteps());
+            ImGui::Text("Sun visibility: baked in %.1f ms, last edit %.2f ms (%zu voxels)", terrain->Sun.GetBuildMs(),
+                        terrain->Sun.GetLastUpdateMs(), terrain->Sun.GetLastUpdateVoxels());
+            ImGui::Text("Sun re-bake: %.0f%%, %.2f ms this frame", terrain->Sun.GetSweepProgress() * 100.0f, terrain->Sun.GetLastSweepMs());
+            static VoxelRenderer::DayCycleTimings dayTimings;
+            if (ImGui::Button("Benchmark day cycle"))
+                dayTimings = renderer->BenchmarkDayCycle(mPlayer->mCamera);
+            if (dayTimings.frames > 0)
+                ImGui::Text("Day cycle: %.2f ms average, %.2f ms worst frame, re-bake at most %.2f ms", dayTimings.averageMs,
+                            dayTimings.worstMs, dayTimings.worstSweepMs);
+            ImGui::Text("Flood light: built in %.1f ms, last edit %.3f ms (%zu voxels relit)", terrain->Light.GetBuildMs(),
+                        terrain->Light.GetLastUpdateMs(), terrain->Light.GetLastUpdateVoxels());
+            ImGui::Text("Ambient occlusion: baked in %.1f ms", terrain->AO.GetBuildMs());
+            const MaterialTable& materials = renderer->GetMaterials();
+            ImGui::Text("Materials: %d, %zu of %d tiles opaque (no fetch while marching)", materials.GetMaterialCount(),
+                        materials.GetOpaqueTileCount(), materials.GetMaterialCount() * materials.GetColumnCount());
+            if (quality.surfaceCache && renderer->IsSurfaceCacheSupported())
+            {
+                const SurfaceCache::Stats& cacheStats = terrain->Cache.GetStats();
+                ImGui::Text("Surface cache: %zu faces in %zu chunks, %zu pending, %zu new + %zu refreshed, %.2f ms, %zu rejected",
+                            cacheStats.residentFaces, cacheStats.residentChunks, cacheStats.pendingFaces, cacheStats.freshFills,
+                            cacheStats.refreshFills, cacheStats.lastUpdateMs, cacheStats.rejectedFaces);
+            }
+            if (quality.clusteredLights)
+            {
+                const ClusteredLights::Stats& lightStats = renderer->GetLightStats();
+                ImGui::Text("Lights: %zu / %zu visible, %zu froxel entries (max %d), binned in %.3f ms", lightStats.visibleLights,
+                            lightStats.lights, lightStats.indices, lightStats.maxPerCluster, lightStats.binMs);
+            }
+            static std::vector<VoxelRenderer::LightTimings> lightTimings;
+            if (ImGui::Button("Benchmark lights"))
+                lightTimings = renderer->BenchmarkLights(mPlayer->mCamera);
+            for (const VoxelRenderer::LightTimings& timings : lightTimings)
+                ImGui::Text("%zu lights: binning %.3f ms, frame %.2f ms", timings.lights, timings.binMs, timings.frameMs);
+            ImGui::Text("Distance field: baked in %.1f ms, last edit %.3f ms", terrain->Distance.GetBuildMs(),
+                        terrain->Distance.GetLastUpdateMs());
+            BrickMap::Stats brickStats = terrain->Bricks.GetStats();
+            ImGui::Text("Bricks: %zu mixed (%zu resident) / %zu uniform / %zu empty", brickStats.mixedBricks,
+                        brickStats.residentBricks, brickStats.uniformBricks, brickStats.emptyBricks);
+            ImGui::Text("Brick map: %zu KB on the GPU next to %zu KB dense, %llu evictions", (brickStats.pageTableBytes + brickStats.atlasBytes) / 1024,
+                        brickStats.denseBytes / 1024, (unsigned long long)brickStats.evictions);
+            SparseVoxelOctree::Stats octreeStats = terrain->Octree.GetStats();
+            ImGui::Text("Octree: %zu nodes, %zu KB, built in %.1f ms, last edit %.3f ms", octreeStats.nodes, octreeStats.bytes / 1024,
+                        octreeStats.buildMs, octreeStats.lastUpdateMs);
+            ImGui::Text("Chunk proxies: %zu drawn / %zu non-empty", renderer->GetDrawnProxyCount(), terrain->Chunks.GetNonEmptyCount());
+            if (terrain->Meshes.IsInitialized())
+            {
+                VoxelMesher::Stats meshStats = terrain->Meshes.GetStats();
+                ImGui::Text("Meshes: %zu / %zu chunks, %zu quads, %zu KB, %llu remeshes, last batch %.1f ms", meshStats.meshedChunks,
+                            meshStats.chunks, meshStats.quads, meshStats.vertexBytes / 1024, (unsigned long long)meshStats.remeshes,
+                            meshStats.lastJobMs);
+            }
         ImGui::End();
         
         ImGui::Render();
@@ -14,7 +14,7 @@
 
 
 //**NEW**
-//c++ src/*.cpp lib/build/*.o -I lib/include -Wl,-rpath=$PWD/lib/build lib/build/libassimp.so -lSDL2 -ldl -o bin/Game
+//c++ src/*.cpp lib/build/*.o -I lib/include -Wl,-rpath=$PWD/lib/build lib/build/libassimp.so -lSDL2 -ldl -pthread -o bin/Game
 
 
 
@@ -8,10 +8,23 @@
 #include <iostream>
 #include <stdio.h>
 #include <filesystem>
+#include "UploadRing.h"
 
 SkyBox::SkyBox()
 {
+    std::vector<std::future<DecodedImage>> faces = DecodeFaces();
+    cubemapTexture = loadCubemap(faces);
+    InitBuffers();
+}
+
+SkyBox::SkyBox(std::vector<std::future<DecodedImage>> &faces)
+{
+    cubemapTexture = loadCubemap(faces);
+    InitBuffers();
+}
 
+std::vector<std::future<DecodedImage>> SkyBox::DecodeFaces(StartupTimeline* timeline)
+{
     std::vector<std::string> faces
     {
         "textures/skybox/right.jpg",
@@ -32,8 +45,14 @@ SkyBox::SkyBox()
     //     "textures/skybox2/back.jpg",
     // };
 
-    cubemapTexture = loadCubemap(faces);
+    std::vector<std::future<DecodedImage>> decodes;
+    for (const std::string &face : faces)
+        decodes.push_back(DecodeImageAsync(face, false, 0, timeline));
+    return decodes;
+}
 
+void SkyBox::InitBuffers()
+{
     float skyboxVertices[] = {
         // positions          
         -1.0f,  1.0f, -1.0f,
@@ -92,27 +111,22 @@ SkyBox::SkyBox()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 }
 
-unsigned int SkyBox::loadCubemap(std::vector<std::string> faces)
+unsigned int SkyBox::loadCubemap(std::vector<std::future<DecodedImage>> &faces)
 {
-    stbi_set_flip_vertically_on_load(false);
-
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrComponents;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        DecodedImage face = faces[i].get();
+        if (face.Valid())
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            UploadRing::Get().TexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, face.width, face.height, GL_RGB, face.Level(0));
         }
         else
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            std::cout << "Cubemap texture failed to load at path: " << face.path << std::endl;
         }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -122,6 +136,5 @@ unsigned int SkyBox::loadCubemap(std::vector<std::string> faces)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
 
-    stbi_set_flip_vertically_on_load(true);
     return textureID;
 }
\ No newline at end of file